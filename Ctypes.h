@@ -19,28 +19,98 @@
 #define debug_warn( ... )
 #endif
 
+/* Everything the XS side needs to know about one native C type. The
+   table of these in util.c, indexed by sizecode byte, is the single
+   source of type information; $Ctypes::Type::_types is built from it */
+typedef struct _Ct_typedesc_t {
+  char code;            /* sizecode; 0 marks an unused slot */
+  ffi_type* ffi;
+  unsigned short size;
+  unsigned short align;
+  char packcode;        /* pack() letter for one native value */
+  char kind;            /* 'i'nt, 'u'nsigned, 'f'loat, 'p'ointer, 'v'oid */
+  NV min;               /* range of values that fit, for validation */
+  NV max;
+} Ct_typedesc_t;
+
+/* A Perl-visible typecode: Python-style (the default) and Perl
+   pack-style (use Ctypes 'PERL') typecodes each have a table */
+typedef struct _Ct_typename_t {
+  char typecode;
+  const char* name;
+  char sizecode;
+  char packcode;
+} Ct_typename_t;
+
+/* The native side of a Struct class's layout (Ctypes::Type::Struct::
+   _Layout), kept in ext magic on the layout object. type is what
+   libffi sees: an FFI_TYPE_STRUCT whose elements are the scalar types
+   of the fields, in order, with arrays flattened. Where a signature
+   passes or returns such a Struct by value its typecode is 'T' */
+typedef struct _Ct_layout_t {
+  ffi_type type;
+  ffi_type** elements;  /* NULL terminated */
+  struct _Ct_layout_t** nested; /* layouts of Struct fields, held */
+  unsigned int nnested;
+  int byvalue;          /* offsets are the C compiler's, so libffi can
+                           pass and return it by value */
+  char* klass;          /* Struct subclass the layout belongs to */
+  int refcnt;
+} Ct_layout_t;
+
+/* A closure from the pool (see closures.c), free or in use */
+typedef struct _Ct_closure_slot_t {
+  ffi_closure* closure;
+  void* code;             /* its executable address */
+  struct _Ct_closure_slot_t* next;  /* on the free list */
+} Ct_closure_slot_t;
+
+/* The cif for one callback signature, shared by every Callback with
+   it. Nothing in it is Perl data, so it outlives interpreters. */
+typedef struct _Ct_cb_cif_t {
+  ffi_cif cif;
+  ffi_type** argtypes;
+  char* sig;              /* own copy */
+  Ct_layout_t** layouts;  /* per sig position, set for 'T' (held) */
+  unsigned int refcnt;
+  struct _Ct_cb_cif_t* next;
+} Ct_cb_cif_t;
+
 typedef struct _cb_data_t {
-  char* sig;
-  SV* coderef;
+  char* sig;              /* these three are shared's */
   ffi_cif* cif;
-  ffi_closure* closure; 
+  Ct_layout_t** layouts;
+  SV* coderef;            /* held */
+  SV** argsvs;            /* per argument, reused from call to call */
+  int depth;              /* calls of it in progress on its thread */
+  ffi_closure* closure;
+  Ct_closure_slot_t* slot;
+  Ct_cb_cif_t* shared;
+  struct _Ct_cb_queue_t* queue; /* its thread's, for others' calls; held */
+  int queued;             /* such calls return at once, not wait */
+  int dead;               /* DESTROYed, with calls still queued */
+  int refcnt;             /* the Callback's, and a queued call's each */
 } cb_data_t;
 
 /* from Py's callproc.c, for _CallProc */
+/* Big and aligned enough for any scalar argument or return value;
+   used as the per-argument slot when marshalling a call */
 union result {
         char c;
         char b;
         short h;
         int i;
         long l;
-/*
-#ifdef HAVE_LONG_LONG
-        PY_LONG_LONG q;
+#ifdef HAS_LONG_LONG
+        long long q;
 #endif
-*/
         double d;
         float f;
+#ifdef HAS_LONG_DOUBLE
+        long double D;
+#endif
         void *p;
+        ffi_arg r;      /* libffi widens small integer returns to this */
 };
 
 struct argument {
@@ -49,4 +119,49 @@ struct argument {
         union result value;
 };
 
+/* A direct call of fn for one signature, in ffi_call's terms: args
+   point at the argument values and rvalue gets the result, small
+   integers widened. Makefile.PL generates these into
+   Ctypes_call_thunks.h for the signatures in its THUNKS list */
+typedef void (*Ct_thunk_fn)(void* fn, void* rvalue, void** args);
+typedef struct _Ct_thunk_t {
+  const char* sig;      /* return sizecode, then argument sizecodes */
+  Ct_thunk_fn thunk;
+} Ct_thunk_t;
+
+/* A compiled Ctypes::Function signature, kept in ext magic on the
+   object so ffi_prep_cif is only run when the signature changes */
+typedef struct _call_plan_t {
+  ffi_cif cif;
+  ffi_type* rtype;
+  ffi_type** argtypes;  /* nargs entries */
+  char* argcodes;       /* nargs typecodes, NUL terminated */
+  unsigned int nargs;
+  unsigned int rsize;   /* bytes needed for the return value */
+  char rcode;           /* return typecode */
+  char abi;
+  int fixed;            /* argtypes declared, so signature can't vary */
+  int prepped;          /* cif is valid for argcodes */
+  Ct_thunk_fn thunk;    /* direct call for the signature, or NULL */
+  UV calls;             /* calls so far; not exact across threads */
+  UV promote_at;        /* call count at which it's promoted (UV_MAX never) */
+  int opauto;           /* attached with op => 'auto' */
+  int opped;            /* some call site runs as a Ct_pp_attached op */
+  void* addr;
+  Ct_layout_t* rlayout;    /* held layout of a 'T' return */
+  Ct_layout_t** arglayouts; /* nargs entries, set for 'T' args (held) */
+  int refcnt;
+} call_plan_t;
+
+/* One argument column of a Function::call_many batch: either a Perl
+   array of values or the packed buffer of a Ctypes::Type::Array */
+typedef struct _Ct_column_t {
+  AV* av;
+  char* buf;
+  STRLEN rows;          /* element count of a packed column */
+  STRLEN size;          /* member size of a packed column */
+  char code;            /* member typecode of a packed column */
+} Ct_column_t;
+
+
 #endif /* _INC_CTYPES_H */
@@ -18,20 +18,32 @@
 #include "limits.h"
 #include "Ctypes.h"
 #include "Ctypes_float_minima.h"
+#include "Ctypes_call_thunks.h"
 #include "obj_util.c"
 #include "util.c"
+#include "struct_layout.c"
+#include "stubs.c"
+#include "call_plan.c"
+#include "async.c"
+#include "closures.c"
+#include "native_cb.c"
+#include "cb_queue.c"
+#include "simd.c"
+#include "array_buf.c"
+#include "views.c"
 
 #include "const-c.inc"
 
-int
-ConvArg(SV* obj, char type_expected,
-        ffi_type **argtypes, void **argvalues, int index)
+/* Convert obj into the slot argvalues[index] points at (the caller
+   provides the storage); returns the typecode used */
+char
+ConvArg(SV* obj, char type_expected, void **argvalues, int index)
 {
   debug_warn("#[%s:%i] In ConvArg...", __FILE__, __LINE__);
   debug_warn("#    Type expected: %c",type_expected);
-  SV *arg, *tmp;
+  SV *arg, *tmp, **fetched;
+  const Ct_typedesc_t* desc;
   char type, type_got = '\0';
-  STRLEN tc_len = 1;
 
   if(SvROK(obj) && !sv_isobject(obj)) {
     tmp = SvRV(obj);
@@ -52,18 +64,21 @@ ConvArg(SV* obj, char type_expected,
 
   debug_warn("#    Checking type_got...");
   if( sv_isobject(obj) ) {
-    type_got = (char)*SvPV(Ct_HVObj_GET_ATTR_KEY(obj,"_typecode"),tc_len);
-//    tmp = Ct_HVObj_GET_ATTR_KEY(obj, "_as_param_");
-//    if( tmp == NULL || !SvOK(tmp) ) {
-      AV* args = NULL;
-      tmp = Ct_CallPerlObjMethod(obj, "_as_param_", args);
+    fetched = SvTYPE(SvRV(obj)) == SVt_PVHV
+      ? hv_fetchs((HV*)SvRV(obj), "_typecode", 0) : NULL;
+    if( fetched == NULL || !SvOK(*fetched) )
+      croak("ConvArg: arg %i is an object without a _typecode", index);
+    type_got = *SvPV_nolen(*fetched);
+    /* Built-in types: read their packed data directly */
+    tmp = Ct_Obj_NativeData(obj);
+    if( tmp == NULL ) {
+      tmp = Ct_CallPerlObjMethod(obj, "_as_param_", NULL);
+      if( tmp == NULL )
+        croak("ConvArg: couldn't get _as_param_ data from arg %i", index);
+      sv_2mortal(tmp);
       if(SvROK(tmp))
         tmp = SvRV(tmp);
-//    }
-    if( tmp == NULL )
-      croak("ConvArg: couldn't get _as_param_ data from arg %i", index);
-//    debug_warn("_as_param_ gave: %i", (((int*)SvPV_nolen(tmp))[2]));
-   /* {_as_param_} will now exist, straight after calling _as_param_() */
+    }
     obj = tmp;
   } else {
     type_got = '\0';
@@ -73,7 +88,7 @@ ConvArg(SV* obj, char type_expected,
   if( type_expected )
     type = type_expected;
   else if( type_got )
-    type = type_got;
+    type = Ct_sizecode_of(type_got);
   else if( SvPOK(obj) )
     type = 's';
   else if( SvNOK(obj) )
@@ -84,82 +99,89 @@ ConvArg(SV* obj, char type_expected,
     croak("ConvArg error: No type information for SV object");
 
   debug_warn( "#  type %i: %c", index+1, type);
-  argtypes[index] = get_ffi_type(type);
 
   arg = obj;
 
+  /* An object already holding exactly this type: just copy it */
+  if( type_got && type != 'p' && Ct_sizecode_of(type_got) == type ) {
+    desc = Ct_typedesc(type);
+    if( SvCUR(arg) >= desc->size ) {
+      Copy(SvPVX(arg), argvalues[index], desc->size, char);
+      return type;
+    }
+  }
+
   switch(type)
   {
   case 'c':
-    Newxc(argvalues[index], 1, char, char);
     *(char*)argvalues[index] = type_got
       ? *(char*)SvPVX(arg)
       : SvIV(arg); 
     break;
   case 'C':
-    Newxc(argvalues[index], 1, unsigned char, unsigned char);
     *(unsigned char*)argvalues[index] = type_got
       ? *(unsigned char*)SvPVX(arg)
       : SvIV(arg);
     break;
   case 's':
-    Newxc(argvalues[index], 1, short, short);
     *(short*)argvalues[index] = type_got
       ? *(short*)SvPVX(arg)
       : SvIV(arg);
     break;
   case 'S':
-    Newxc(argvalues[index], 1, unsigned short, unsigned short);
     *(unsigned short*)argvalues[index] = type_got
       ? *(unsigned short*)SvPVX(arg)
       : SvIV(arg);
     break;
   case 'i':
-    Newxc(argvalues[index], 1, int, int);
     *(int*)argvalues[index] = type_got
       ? (int)*(intptr_t*)SvPVX(arg)
       : SvIV(arg);
     debug_warn("    argvalues[%i] is: %i", index,*(int*)argvalues[index]);
     break;
   case 'I':
-    Newxc(argvalues[index], 1, unsigned int, unsigned int);
     *(unsigned int*)argvalues[index] = type_got
       ? *(unsigned int*)SvPVX(arg)
       : SvIV(arg);
     break;
   case 'l':
-    Newxc(argvalues[index], 1, long, long);
     *(long*)argvalues[index] = type_got
       ? *(long*)SvPVX(arg)
       : SvIV(arg);
     break;
   case 'L':
-    Newxc(argvalues[index], 1, unsigned long, unsigned long);
     *(unsigned long*)argvalues[index] = type_got
       ? *(unsigned long*)SvPVX(arg)
       : SvIV(arg);
    break;
+#ifdef HAS_LONG_LONG
+  case 'q':
+    *(long long*)argvalues[index] = type_got
+      ? *(long long*)SvPVX(arg)
+      : Ct_SvLL(arg);
+    break;
+  case 'Q':
+    *(unsigned long long*)argvalues[index] = type_got
+      ? *(unsigned long long*)SvPVX(arg)
+      : Ct_SvULL(arg);
+    break;
+#endif
   case 'f':
-    Newxc(argvalues[index], 1, float, float);
     *(float*)argvalues[index] = type_got
       ? *(float*)SvPVX(arg)
       : SvNV(arg);
     break;
   case 'd':
-    Newxc(argvalues[index], 1, double, double);
     *(double*)argvalues[index] = type_got
       ? *(double*)SvPVX(arg)
       : SvNV(arg);
     break;
   case 'D':
-    Newxc(argvalues[index], 1, long double, long double);
     *(long double*)argvalues[index] = type_got
       ? *(long double*)SvPVX(arg)
       : SvNV(arg);
     break;
   case 'p':
-    Newx(argvalues[index], 1, void);
-    STRLEN len = sv_len(arg);
     if(SvIOK(arg)) {
       debug_warn( "#    [%s:%i] Pointer: SvIOK: assuming 'PTR2IV' value",
                    __func__, __LINE__ );
@@ -179,66 +201,355 @@ ConvArg(SV* obj, char type_expected,
   default: croak( "ConvArg error: Unrecognised type '%c' (line %i)",
              type, __LINE__ );
   }
-  return 0;
+  return type;
 }
 
+/* Convert the num_args SVs at PL_stack_base[first] for plan: each
+   argvalues entry ends up pointing at the native value, in its
+   argslots entry or, for Structs by value, their own buffer. Indexes
+   the stack rather than taking an SV**, since _as_param_ methods
+   called by ConvArg may reallocate it. */
 void
-_perl_cb_call( ffi_cif* cif, void* retval, void** args, void* udata )
+Ct_plan_marshal(call_plan_t* plan, I32 first, unsigned int num_args,
+                union result* argslots, void** argvalues, char* argcodes)
 {
-    dSP;
-    debug_warn( "\n#[%s:%i] Entered _perl_cb_call...", __FILE__, __LINE__ );
+  unsigned int i;
+
+  if( plan->fixed && num_args != plan->nargs )
+    croak( "Ctypes::Function::_call error: specified %i arguments but supplied %i",
+           plan->nargs, num_args );
+
+  debug_warn( "#[%s:%i] Getting types & values of args...",
+    __FILE__, __LINE__ );
+  for (i = 0; i < num_args; ++i) {
+    if( plan->fixed && plan->argcodes[i] == 'T' ) {
+      /* Structs by value: libffi copies straight from their buffer */
+      argvalues[i] = Ct_struct_data( PL_stack_base[first + i],
+                                     plan->arglayouts[i] );
+      argcodes[i] = 'T';
+      continue;
+    }
+    argvalues[i] = &argslots[i];
+    /* ConvArg croaks a lot */
+    argcodes[i] = ConvArg( PL_stack_base[first + i],
+                           plan->fixed ? plan->argcodes[i] : '\0',
+                           argvalues,
+                           i );
+  }
+  argcodes[num_args] = '\0';
+}
 
-    unsigned int i;
-    int flags = G_SCALAR;
-    unsigned int count = 0;
-    char type;
-    STRLEN len;
-    cb_data_t* data = (cb_data_t*)udata;
-    char* sig = data->sig;
+/* The (non-mortal) Perl value of plan's return value in rvalue, or
+   NULL for void functions */
+#define Ct_plan_result(plan, rvalue)                                \
+  ( (plan)->rcode == 'T'                                            \
+    ? Ct_struct_from_bytes((plan)->rlayout, (rvalue))               \
+    : Ct_newSV_result((plan)->rcode, (rvalue)) )
 
-    if( sig[0] == 'v' ) { flags = G_VOID; }
+/* Marshal the num_args SVs at PL_stack_base[first] through plan and
+   call the function. Returns the (non-mortal) result, or NULL for
+   void functions. */
+SV*
+Ct_plan_call(call_plan_t* plan, I32 first, unsigned int num_args)
+{
+  /* One aligned slot per argument and one for the return value, all
+     on the C stack: nothing to free, so croaking mid-way can't leak */
+  union result argslots[num_args ? num_args : 1];
+  void *argvalues[num_args ? num_args : 1];
+  char argcodes[num_args + 1];
+  /* Structs returned by value can be bigger than one slot */
+  union result rvalue[plan->rsize / sizeof(union result) + 1];
+  SV* result;
+
+  debug_warn( "#[Ctypes.xs:%i] Return type found: %c", __LINE__,  plan->rcode );
+  Ct_plan_marshal(plan, first, num_args, argslots, argvalues, argcodes);
+  /* argtype-less functions take their signature from the arguments */
+  if( !plan->fixed )
+    Ct_plan_prep(plan, num_args, argcodes);
+
+  debug_warn( "#[%s:%i] Calling ffi_call...", __FILE__, __LINE__ );
+  Ct_plan_invoke(plan, rvalue, argvalues);
+  debug_warn( "#    ffi_call returned!");
+
+  result = Ct_plan_result(plan, rvalue);
+  Ct_plan_count(plan, 1);
+  return result;
+}
+
+/* Call plan's function once per row of the columns, entering the
+   interpreter only for the batch. Returns a mortal arrayref of
+   results, or if outcode is set a mortal string of the results
+   packed as native outcode values. */
+SV*
+Ct_plan_call_many(call_plan_t* plan, Ct_column_t* cols,
+                  unsigned int ncols, char outcode)
+{
+  union result argslots[ncols ? ncols : 1];
+  void *argvalues[ncols ? ncols : 1];
+  char argcodes[ncols + 1];
+  union result rvalue;
+  SV *out, **fetched;
+  AV* out_av = NULL;
+  char* out_buf = NULL;
+  STRLEN rows = 0, row;
+  unsigned int i;
+
+  if( plan->fixed && ncols != plan->nargs )
+    croak( "Ctypes::Function::call_many error: specified %i arguments but supplied %i",
+           plan->nargs, ncols );
+  if( plan->rlayout != NULL || plan->arglayouts != NULL )
+    croak( "Ctypes::Function::call_many: Structs by value aren't supported" );
+  for( i = 0; i < ncols; i++ ) {
+    STRLEN len = cols[i].av ? (STRLEN)(av_len(cols[i].av) + 1)
+                            : cols[i].rows;
+    if( i == 0 )
+      rows = len;
+    else if( len != rows )
+      croak( "Ctypes::Function::call_many: column %i has %i rows, expected %i",
+             i, (int)len, (int)rows );
+    if( cols[i].buf ) {
+      if( plan->fixed && cols[i].code != plan->argcodes[i] )
+        croak( "Ctypes::Function::call_many: column %i holds '%c' but argument is '%c'",
+               i, cols[i].code, plan->argcodes[i] );
+      argcodes[i] = cols[i].code;
+    }
+    argvalues[i] = &argslots[i];
+  }
 
-    if( cif->nargs > 0 ) {
-      debug_warn( "#[%s:%i] Have %i args so pushing to stack...",
-                __FILE__, __LINE__, cif->nargs );
-      ENTER;
-      SAVETMPS;
+  if( outcode ) {
+    if( outcode != plan->rcode )
+      croak( "Ctypes::Function::call_many: out Array holds '%c' but function returns '%c'",
+             outcode, plan->rcode );
+    out = sv_2mortal(newSV(rows * plan->rtype->size + 1));
+    SvPOK_on(out);
+    SvCUR_set(out, rows * plan->rtype->size);
+    out_buf = SvPVX(out);
+  } else {
+    out_av = newAV();
+    out = sv_2mortal(newRV_noinc((SV*)out_av));
+    if( plan->rcode != 'v' && rows )
+      av_extend(out_av, rows - 1);
+  }
 
-      PUSHMARK(SP);
-      for( i = 0; i < cif->nargs; i++ ) {
-        type = sig[i+1]; /* sig[0] = return type */
-        debug_warn("This arg type is %c", type);
-        switch (type)
-        {
-          case 'v': break;
-          case 'c': 
-          case 'C': XPUSHs(sv_2mortal(newSViv(*(int*)*(void**)args[i])));   break;
-          case 's': 
-          case 'S':
-              debug_warn( "#    Have type %c, pushing %i to stack...",
-                          type, *(short*)*(void**)args[i] );
-              XPUSHs(sv_2mortal(newSViv((int)*(short*)*(void**)args[i])));   break;
-          case 'i':
-/*              debug_warn( "#    Have type %c, pushing %i to stack...",
-                          type, *(int*)*(void**)args[i] ); */
-              XPUSHs(sv_2mortal(newSViv(*(int*)*(void**)args[i])));   break;
-          case 'I': XPUSHs(sv_2mortal(newSVuv(*(unsigned int*)*(void**)args[i])));   break;
-          case 'l': XPUSHs(sv_2mortal(newSViv(*(long*)*(void**)args[i])));   break;
-          case 'L': XPUSHs(sv_2mortal(newSVuv(*(unsigned long*)*(void**)args[i])));   break;
-          case 'f': XPUSHs(sv_2mortal(newSVnv(*(float*)*(void**)args[i])));    break;
-          case 'd': XPUSHs(sv_2mortal(newSVnv(*(double*)*(void**)args[i])));    break;
-          case 'D': XPUSHs(sv_2mortal(newSVnv(*(long double*)*(void**)args[i])));    break;
-          case 'p':
-              debug_warn( "#    Have type %c, pushing to stack...",
-                          type );
-              XPUSHs(sv_2mortal(newSVpv((char*)*(void**)args[i], 0))); break;
-        }
+  for( row = 0; row < rows; row++ ) {
+    for( i = 0; i < ncols; i++ ) {
+      if( cols[i].buf ) {
+        /* packed: already native, just copy the element */
+        Copy(cols[i].buf + row * cols[i].size, &argslots[i], cols[i].size, char);
+        continue;
       }
-    PUTBACK;
+      fetched = av_fetch(cols[i].av, row, 0);
+      if( fetched == NULL )
+        croak( "Ctypes::Function::call_many: no value at row %i of column %i",
+               (int)row, i );
+      argcodes[i] = ConvArg( *fetched,
+                             plan->fixed ? plan->argcodes[i] : '\0',
+                             argvalues,
+                             i );
+    }
+    if( !plan->fixed )
+      Ct_plan_prep(plan, ncols, argcodes);
+
+    Ct_plan_invoke(plan, &rvalue, argvalues);
+
+    if( out_buf )
+      Ct_store_result(plan->rcode, plan->rtype, &rvalue,
+                      out_buf + row * plan->rtype->size);
+    else if( plan->rcode != 'v' )
+      av_store(out_av, row, Ct_newSV_result(plan->rcode, &rvalue));
+  }
+  Ct_plan_count(plan, rows);
+  return out;
+}
+
+#ifdef Ct_HAS_ASYNC
+/* The job behind a Ctypes::Function::Async handle */
+static Ct_job_t*
+Ct_job_of(SV* self) {
+  SV** fetched = NULL;
+  if( Ct_Obj_IsDeriv(self, "Ctypes::Function::Async") )
+    fetched = hv_fetchs((HV*)SvRV(self), "_job", 0);
+  if( fetched == NULL || !SvIOK(*fetched) || SvIV(*fetched) == 0 )
+    croak("Ctypes::Function::Async: not a call_async handle");
+  return INT2PTR(Ct_job_t*, SvIV(*fetched));
+}
+#endif
+
+#if defined(cv_set_call_checker) && defined(XopENTRY_set)
+#define Ct_HAS_XOP
+#endif
+
+/* Body of every sub installed by Ctypes::Function::attach. The
+   compiled plan hangs off the CV, so a call goes straight from
+   entersub to ffi_call. */
+XS(Ct_attached_xsub)
+{
+  dXSARGS;
+  call_plan_t* plan = Ct_plan_of((SV*)cv);
+  SV* result;
+
+  result = Ct_plan_call(plan, ax, items);
+  if( result == NULL )
+    XSRETURN_EMPTY;
+  ST(0) = sv_2mortal(result);
+  XSRETURN(1);
+}
+
+#ifdef Ct_HAS_XOP
+static XOP Ct_xop_attached;
+
+/* Run in place of entersub for calls compiled against a sub from
+   attach( name, { op => 1 } ). The stack is as entersub would see
+   it: the mark, the arguments, then the sub (a GV, or the CV or a
+   ref to it). No scope, @_ or call frame is set up. */
+static OP*
+Ct_pp_attached(pTHX)
+{
+  dSP;
+  SV* sv = TOPs;
+  CV* cv = NULL;
+  call_plan_t* plan;
+  SV* result;
+  I32 mark;
+  U8 gimme = GIMME_V;
+
+  if( SvTYPE(sv) == SVt_PVGV )
+    cv = GvCV((GV*)sv);
+  else if( SvTYPE(sv) == SVt_PVCV )
+    cv = (CV*)sv;
+  else if( SvROK(sv) && SvTYPE(SvRV(sv)) == SVt_PVCV )
+    cv = (CV*)SvRV(sv);
+  /* Redefined since the call was compiled: let entersub handle it */
+  if( cv == NULL || !CvISXSUB(cv) || CvXSUB(cv) != Ct_attached_xsub )
+    return PL_ppaddr[OP_ENTERSUB](aTHX);
+  plan = Ct_plan_of((SV*)cv);
+  /* op => 'auto': an ordinary sub call until the plan is hot */
+  if( plan->opauto && plan->calls < plan->promote_at )
+    return PL_ppaddr[OP_ENTERSUB](aTHX);
+  if( !plan->opped ) {
+    debug_warn( "#[%s:%i] Call sites promoted to ops", __FILE__, __LINE__ );
+    plan->opped = 1;
+  }
+
+  (void)POPs;
+  mark = POPMARK;
+  PUTBACK;
+  /* may call _as_param_ methods, so works by stack index */
+  result = Ct_plan_call(plan, mark + 1, (unsigned int)(SP - PL_stack_base - mark));
+  SP = PL_stack_base + mark;
+  if( result != NULL ) {
+    if( gimme == G_VOID )
+      SvREFCNT_dec(result);
+    else
+      XPUSHs(sv_2mortal(result));
+  }
+  else if( gimme == G_SCALAR )
+    XPUSHs(&PL_sv_undef);
+  PUTBACK;
+  return NORMAL;
+}
+
+/* Call checker for op-mode attached subs: once the arguments have
+   had the usual checks, turn the entersub into a Ct_pp_attached
+   custom op. Only ever here, at compile time: ops are shared between
+   threads once they run. Left alone under the debugger, which needs
+   DB::sub. */
+static OP*
+Ct_ck_attached(pTHX_ OP* o, GV* namegv, SV* ckobj)
+{
+  o = ck_entersub_args_proto_or_list(o, namegv, ckobj);
+  if( o->op_type == OP_ENTERSUB && !PERLDB_SUB ) {
+    call_plan_t* plan = Ct_plan_of(ckobj);
+    o->op_type = OP_CUSTOM;
+    o->op_ppaddr = Ct_pp_attached;
+    if( !plan->opauto )
+      plan->opped = 1;
+  }
+  return o;
+}
+#endif
+
+/* A callback argument's SV: the callback's own, set in place, unless
+   the Perl sub kept hold of it or tied it last time, when it's left to
+   the sub and a new one made. A call made while another is in progress
+   (the sub calling back into C which calls it again) gets mortals: the
+   outer call's @_ is still using the callback's own. */
+static SV*
+Ct_cb_argsv(cb_data_t* data, unsigned int i) {
+  SV* sv = data->argsvs[i];
+  if( data->depth > 1 )
+    return sv_newmortal();
+  if( sv == NULL || SvREFCNT(sv) > 1 || SvMAGICAL(sv) || SvREADONLY(sv) ) {
+    SvREFCNT_dec(sv);
+    sv = data->argsvs[i] = newSV(0);
+  }
+  return sv;
+}
+
+/* Call data's Perl sub with the arguments at vals: each points at a
+   scalar argument's value, a 'p' argument's string or a Struct's
+   bytes. On the Callback's own thread only. */
+static void
+Ct_cb_invoke(cb_data_t* data, void* retval, void** vals)
+{
+    dSP;
+    unsigned int i;
+    int count;
+    char type;
+    ffi_cif* cif = data->cif;
+    char* sig = data->sig;
+    SV *sv, *cv = data->coderef;
+
+    /* Scalar arguments go in the callback's own SVs, so the usual
+       call makes nothing mortal and FREETMPS has nothing to do;
+       Structs are still new objects each time */
+    ENTER;
+    SAVETMPS;
+    /* Put back by LEAVE, even if the sub dies */
+    SAVEINT(data->depth);
+    data->depth++;
+    PUSHMARK(SP);
+    EXTEND(SP, (SSize_t)cif->nargs);
+    for( i = 0; i < cif->nargs; i++ ) {
+      type = sig[i+1]; /* sig[0] = return type */
+      if( type == 'T' ) {
+        /* by value: vals[i] is the Struct itself */
+        PUTBACK;
+        sv = sv_2mortal(Ct_struct_from_bytes(data->layouts[i+1], vals[i]));
+        SPAGAIN;
+        XPUSHs(sv);
+        continue;
+      }
+      sv = Ct_cb_argsv(data, i);
+      switch (type)
+      {
+        case 'c': sv_setiv(sv, *(signed char*)vals[i]);   break;
+        case 'C': sv_setuv(sv, *(unsigned char*)vals[i]);   break;
+        case 's': sv_setiv(sv, *(short*)vals[i]);   break;
+        case 'S': sv_setuv(sv, *(unsigned short*)vals[i]);   break;
+        case 'i': sv_setiv(sv, *(int*)vals[i]);   break;
+        case 'I': sv_setuv(sv, *(unsigned int*)vals[i]);   break;
+        case 'l': sv_setiv(sv, *(long*)vals[i]);   break;
+        case 'L': sv_setuv(sv, *(unsigned long*)vals[i]);   break;
+#ifdef HAS_LONG_LONG
+        case 'q': Ct_sv_setll(sv, *(long long*)vals[i]);   break;
+        case 'Q': Ct_sv_setull(sv, *(unsigned long long*)vals[i]);   break;
+#endif
+        case 'f': sv_setnv(sv, *(float*)vals[i]);    break;
+        case 'd': sv_setnv(sv, *(double*)vals[i]);    break;
+        case 'D': sv_setnv(sv, *(long double*)vals[i]);    break;
+        case 'p': sv_setpv(sv, (char*)vals[i]); break;
+        default: SvOK_off(sv);
+      }
+      PUSHs(sv);
     }
+    PUTBACK;
 
-    debug_warn( "#[%s:%i] Calling Perl sub...", __FILE__, __LINE__, sig );
-    count = call_sv(data->coderef, G_SCALAR);
+    /* A code ref is called as its CV, saving call_sv the lookup */
+    if( SvROK(cv) && SvTYPE(SvRV(cv)) == SVt_PVCV )
+      cv = SvRV(cv);
+    debug_warn( "#[%s:%i] Calling Perl sub...", __FILE__, __LINE__ );
+    count = call_sv(cv, sig[0] == 'v' ? G_VOID : G_SCALAR);
     debug_warn( "#[%s:%i] Returned from Perl sub with %i values", __FILE__, __LINE__, count );
 
     SPAGAIN;
@@ -248,71 +559,48 @@ _perl_cb_call( ffi_cif* cif, void* retval, void** args, void* udata )
         croak( "_perl_cb_call:%i: Expected single %c from Perl callback",
                __LINE__, sig[0] );
       }
-      if( count > 1 && sig[0] != 'p' ) {
-       croak( "_perl_cb_call:%i: Received multiple values from Perl \
-callback; expected %c", __LINE__, sig[0] );
-      }
+      sv = POPs;
       type = sig[0];
+      /* libffi wants integer returns narrower than ffi_arg widened */
       switch(type)
       {
-      case 'c':
-        *(char*)retval = POPi;
-        break;
-      case 'C':
-          *(unsigned char*)retval = POPi;
-          break;
-        case 's':
-          *(short*)retval = POPi;
-          break;
-        case 'S':
-          *(unsigned short*)retval = POPi;
-          break;
-        case 'i':
-          *(int*)retval = POPi;
-          debug_warn( "#[%s:%i] retval is %i!", __FILE__, __LINE__, *(int*)retval );
-          break;
-        case 'I':
-          *(int*)retval = POPi;
-          break;
+        case 'c': *(ffi_sarg*)retval = (signed char)SvIV(sv);   break;
+        case 'C': *(ffi_arg*)retval = (unsigned char)SvUV(sv);   break;
+        case 's': *(ffi_sarg*)retval = (short)SvIV(sv);   break;
+        case 'S': *(ffi_arg*)retval = (unsigned short)SvUV(sv);   break;
+        case 'i': *(ffi_sarg*)retval = (int)SvIV(sv);   break;
+        case 'I': *(ffi_arg*)retval = (unsigned int)SvUV(sv);   break;
         case 'l':
-          *(long*)retval = POPl;
+          if( sizeof(long) < sizeof(ffi_arg) )
+            *(ffi_sarg*)retval = (long)SvIV(sv);
+          else
+            *(long*)retval = SvIV(sv);
           break;
         case 'L':
-          *(unsigned long*)retval = POPl;
-         break;
-        case 'f':
-          *(float*)retval = POPn;
-          break;
-        case 'd':
-          *(double*)retval  = POPn;
-          break;
-        case 'D':
-          *(long double*)retval = POPn;
+          if( sizeof(long) < sizeof(ffi_arg) )
+            *(ffi_arg*)retval = (unsigned long)SvUV(sv);
+          else
+            *(unsigned long*)retval = SvUV(sv);
           break;
+#ifdef HAS_LONG_LONG
+        case 'q': *(long long*)retval = Ct_SvLL(sv);   break;
+        case 'Q': *(unsigned long long*)retval = Ct_SvULL(sv);   break;
+#endif
+        case 'f': *(float*)retval = SvNV(sv);   break;
+        case 'd': *(double*)retval = SvNV(sv);   break;
+        case 'D': *(long double*)retval = SvNV(sv);   break;
         case 'p':
           croak( "_perl_cb_call: Returning pointers from Perl subs not yet implemented!" );
-        /*  len = sv_len(SP[0]);
-          debug_warn( "#_perl_cb_call: Got a pointer..." );
-          if(SvIOK(SP[0])) {
-            debug_warn( "#    [%i] SvIOK: assuming 'PTR2IV' value",  __LINE__ );
-            char* thing = POPpx;
-            *(intptr_t*)retval = (intptr_t)INT2PTR(void*, SvIV(ST(i+2)));
-          } else {
-            debug_warn( "#    [%i] Not SvIOK: assuming 'pack' value",  __LINE__ );
-            debug_warn( "#    [%i] sizeof packed array (sv_len): %i",  __LINE__, (int)len );
-            debug_warn( "#    [%i] %i items in array (assumed int)",  __LINE__, (int)((int)len/sizeof(int)) );
-            *(intptr_t*)retval = (intptr_t)SvPVbyte(ST(i+2), len);
-          #ifdef CTYPES_DEBUG
-            int j;
-            for( j = 0; j < ((int)len/sizeof(int)); j++ ) {
-                debug_warn( "#    argvalues[%i][%i]: %i", i, j, ((int*)*(intptr_t*)retval)[j] );
-            }
-          #endif
-          } */
+          break;
+        case 'T':
+          PUTBACK;
+          Copy(Ct_struct_data(sv, data->layouts[0]), retval,
+               data->layouts[0]->type.size, char);
+          SPAGAIN;
           break;
         /* should never happen here */
         default: croak( "_perl_cb_call error: Unrecognised type '%c'", type );
-        }        
+      }
     }
 
     PUTBACK;
@@ -320,10 +608,60 @@ callback; expected %c", __LINE__, sig[0] );
     LEAVE;
 }
     
+#define Ct_CB_FIXED_ARGS 16
+
+/* The closures' entry point. Scalar arguments arrive as pointers to
+   the value (qsort's convention), Structs by value. Called on any
+   other thread, it's passed to the Callback's own (see cb_queue.c):
+   nothing here may touch Perl before that check. */
+void
+_perl_cb_call( ffi_cif* cif, void* retval, void** args, void* udata )
+{
+    cb_data_t* data = (cb_data_t*)udata;
+    void* fixed[Ct_CB_FIXED_ARGS];
+    void** vals = fixed;
+    unsigned int i;
+
+    /* There may be no Perl here to allocate with, so it's malloc for
+       the odd callback with more arguments than that */
+    if( cif->nargs > Ct_CB_FIXED_ARGS
+        && (vals = (void**)malloc(cif->nargs * sizeof(void*))) == NULL ) {
+      i = cif->rtype->size;
+      memset(retval, 0, i > sizeof(ffi_arg) ? i : sizeof(ffi_arg));
+      return;
+    }
+    for( i = 0; i < cif->nargs; i++ )
+      vals[i] = data->sig[i+1] == 'T' ? args[i] : *(void**)args[i];
+#ifdef Ct_HAS_ASYNC
+    if( !Ct_cb_on_owner(data) )
+      Ct_cb_enqueue(data, retval, vals);
+    else
+#endif
+    {
+      debug_warn( "\n#[%s:%i] Entered _perl_cb_call...", __FILE__, __LINE__ );
+      Ct_cb_invoke(data, retval, vals);
+    }
+    if( vals != fixed )
+      free(vals);
+}
+    
 MODULE = Ctypes		PACKAGE = Ctypes
 
 INCLUDE: const-xs.inc
 
+BOOT:
+#ifdef USE_ITHREADS
+  MUTEX_INIT(&Ct_stubs_mutex);
+  MUTEX_INIT(&Ct_closures_mutex);
+#endif
+  Ct_kernels = Ct_kernels_for(NULL);
+#ifdef Ct_HAS_XOP
+  XopENTRY_set(&Ct_xop_attached, xop_name, "ctypes_attached");
+  XopENTRY_set(&Ct_xop_attached, xop_desc, "call an attached C function");
+  XopENTRY_set(&Ct_xop_attached, xop_class, OA_UNOP);
+  Perl_custom_op_register(aTHX_ Ct_pp_attached, &Ct_xop_attached);
+#endif
+
 #define strictchar char
 
 void
@@ -336,12 +674,12 @@ _call( addr, sig, ... )
     ffi_cif cif;
     ffi_status status;
     ffi_type *rtype;
-    char *rvalue;
-    STRLEN len;
-    unsigned int args_in_sig, rsize;
+    union result rvalue;
+    unsigned int args_in_sig;
     unsigned int num_args = items - 2;
-    ffi_type *argtypes[num_args];
-    void *argvalues[num_args];
+    ffi_type *argtypes[num_args ? num_args : 1];
+    union result argslots[num_args ? num_args : 1];
+    void *argvalues[num_args ? num_args : 1];
  
     debug_warn( "\n#[Ctypes.xs: %i ] XS_Ctypes_call_raw( 0x%x, \"%s\", ...)", __LINE__, (unsigned int)(intptr_t)addr, sig );
     debug_warn( "#Module compiled with -DCTYPES_DEBUG for detailed output from XS" );
@@ -361,10 +699,6 @@ _call( addr, sig, ... )
 
     rtype = get_ffi_type( sig[1] );
     debug_warn( "#[Ctypes.xs: %i ] Return type found: %c", __LINE__,  sig[1] );
-    rsize = FFI_SIZEOF_ARG;
-    if (sig[1] == 'd') rsize = sizeof(double);
-    if (sig[1] == 'D') rsize = sizeof(long double);
-    rvalue = (char*)malloc(rsize);
 
     if( num_args > 0 ) {
       int i;
@@ -377,6 +711,7 @@ _call( addr, sig, ... )
 	  croak("Ctypes::_call_raw error: too many args (%d expected)", i - 2); /* should never happen here */
 
         argtypes[i] = get_ffi_type(type);
+        argvalues[i] = &argslots[i];
         /* Could pop ST(0) & ST(1) (func pointer & sig) off beforehand to make this neater? */
         SV* thisSV = ST(i+2);
         if(SvROK(thisSV)) {
@@ -385,62 +720,47 @@ _call( addr, sig, ... )
         switch(type)
         {
         case 'c':
-          Newxc(argvalues[i], 1, char, char);
           *(char*)argvalues[i] = SvIV(thisSV);
           break;
         case 'C':
-          Newxc(argvalues[i], 1, unsigned char, unsigned char);
           *(unsigned char*)argvalues[i] = SvIV(thisSV);
           break;
         case 's':
-          Newxc(argvalues[i], 1, short, short);
           *(short*)argvalues[i] = SvIV(thisSV);
           break;
         case 'S':
-          Newxc(argvalues[i], 1, unsigned short, unsigned short);
           *(unsigned short*)argvalues[i] = SvIV(thisSV);
           break;
         case 'i':
-          Newxc(argvalues[i], 1, int, int);
           *(int*)argvalues[i] = SvIV(thisSV);
           break;
         case 'I':
-          Newxc(argvalues[i], 1, unsigned int, unsigned int);
           *(int*)argvalues[i] = SvIV(thisSV);
           break;
         case 'l':
-          Newxc(argvalues[i], 1, long, long);
           *(long*)argvalues[i] = SvIV(thisSV);
           break;
         case 'L':
-          Newxc(argvalues[i], 1, unsigned long, unsigned long);
           *(unsigned long*)argvalues[i] = SvIV(thisSV);
          break;
         case 'f':
-          Newxc(argvalues[i], 1, float, float);
           *(float*)argvalues[i] = SvNV(thisSV);
           break;
         case 'd':
-          Newxc(argvalues[i], 1, double, double);
           *(double*)argvalues[i]  = SvNV(thisSV);
           break;
         case 'D':
-          Newxc(argvalues[i], 1, long double, long double);
           *(long double*)argvalues[i] = SvNV(thisSV);
           break;
-	#if HAS_LONG_LONG
+	#ifdef HAS_LONG_LONG
         case 'q':
-          Newxc(argvalues[i], 1, long long, long long);
-          *(long long*)argvalues[i] = SvNV(thisSV);
+          *(long long*)argvalues[i] = Ct_SvLL(thisSV);
           break;
         case 'Q':
-          Newxc(argvalues[i], 1, unsigned long long, unsigned long long);
-          *(unsigned long long*)argvalues[i] = SvNV(thisSV);
+          *(unsigned long long*)argvalues[i] = Ct_SvULL(thisSV);
           break;
 	#endif
         case 'p':
-          len = sv_len(thisSV);
-          Newx(argvalues[i], 1, void);
           if(SvIOK(thisSV)) {
             debug_warn( "#    [%i] Pointer: SvIOK: assuming 'PTR2IV' value",  __LINE__ );
             *(intptr_t*)argvalues[i] = (intptr_t)INT2PTR(void*, SvIV(thisSV));
@@ -471,36 +791,13 @@ _call( addr, sig, ... )
     debug_warn( "#[%s:%i] cif OK.", __FILE__, __LINE__ );
 
     debug_warn( "#[%s:%i] Calling ffi_call...", __FILE__, __LINE__ );
-    ffi_call(&cif, FFI_FN(addr), rvalue, argvalues);
-    debug_warn( "#ffi_call returned normally with rvalue at 0x%x", (unsigned int)(intptr_t)rvalue );
+    ffi_call(&cif, FFI_FN(addr), &rvalue, argvalues);
+    debug_warn( "#ffi_call returned normally with rvalue at 0x%x", (unsigned int)(intptr_t)&rvalue );
     debug_warn( "#[%s:%i] Pushing retvals to Perl stack...", __FILE__, __LINE__ );
-    switch (sig[1])
     {
-      case 'v': break;
-      case 'c': 
-      case 'C': XPUSHs(sv_2mortal(newSViv(*(int*)rvalue)));   break;
-      case 's': 
-      case 'S': XPUSHs(sv_2mortal(newSVpv((char *)rvalue, 0)));   break;
-      case 'i': XPUSHs(sv_2mortal(newSViv(*(int*)rvalue)));   break;
-      case 'I': XPUSHs(sv_2mortal(newSVuv(*(unsigned int*)rvalue)));   break;
-      case 'l': XPUSHs(sv_2mortal(newSViv(*(long*)rvalue)));   break;
-      case 'L': XPUSHs(sv_2mortal(newSVuv(*(unsigned long*)rvalue)));   break;
-      case 'f': XPUSHs(sv_2mortal(newSVnv(*(float*)rvalue)));    break;
-      case 'd': XPUSHs(sv_2mortal(newSVnv(*(double*)rvalue)));    break;
-      case 'D': XPUSHs(sv_2mortal(newSVnv(*(long double*)rvalue)));    break;
-      #if HAS_LONG_LONG
-      case 'q': XPUSHs(sv_2mortal(newSVnv(*(long long*)rvalue)));      break;
-      case 'Q': XPUSHs(sv_2mortal(newSVnv(*(unsigned long long*)rvalue))); break;
-      #endif
-      case 'p': XPUSHs(sv_2mortal(newSVpv((void*)rvalue, 0))); break;
-    }
-
-    debug_warn( "#[%s:%i] Cleaning up...", __FILE__, __LINE__ );
-    free(rvalue);
-    int i = 0;
-    for( i = 0; i < num_args; i++ ) {
-      Safefree(argvalues[i]);
-      debug_warn( "#    Successfully free'd argvalues[%i]", i );
+      SV* result = Ct_newSV_result(sig[1], &rvalue);
+      if( result != NULL )
+        XPUSHs(sv_2mortal(result));
     }
     debug_warn( "#[%s:%i] Leaving XS_Ctypes_call...\n\n", __FILE__, __LINE__ );
 
@@ -512,158 +809,276 @@ _call(self, ...)
     SV* self;
   PROTOTYPE: DISABLE
   PPCODE:
-    ffi_cif cif;
-    ffi_status status;
-    ffi_type *rtype;
-    char *rvalue, rtypechar;
-    STRLEN len;
-    unsigned int num_argtypes, rsize;
-    unsigned int num_args = items - 1;
-    ffi_type *argtypes[num_args];
-    void *argvalues[num_args];
-    SV *self_argtypesRV, *rtypeSV;
-    AV *self_argtypes;
-    STRLEN tc_len = 1;
+    call_plan_t* plan;
+    SV* result;
 
     debug_warn( "\n#[%s:%i] XS_Ctypes_Function__call( %i args )",
-                __FILE__, __LINE__, num_args );
+                __FILE__, __LINE__, (int)items - 1 );
     debug_warn( "#Module compiled with -DCTYPES_DEBUG for detailed output from XS" );
-    #ifndef PERL_ARGS_ASSERT_CROAK_XS_USAGE
-    if( num_args < 0 ) {
-      croak( "Ctypes::_call error: Not enough arguments" );
-    }
-    #endif
 
-    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function"))) 
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
       croak("Ctypes::_call: $self must be a Ctypes::Function or derivative");
 
-    rtypeSV = Ct_HVObj_GET_ATTR_KEY(self, "restype");
-    if( Ct_Obj_IsDeriv(rtypeSV,"Ctypes::Type") ) {
-      rtypechar =
-        (char)*SvPV_nolen(Ct_HVObj_GET_ATTR_KEY(rtypeSV,"_typecode"));
-      rtype = get_ffi_type( rtypechar );
-    } else {
-      rtypechar = (char)*SvPV_nolen(rtypeSV);
-      rtype = get_ffi_type( rtypechar );
-    }
-    debug_warn( "#[Ctypes.xs:%i] Return type found: %c", __LINE__,  rtypechar );
-    rsize = FFI_SIZEOF_ARG;
-    if (rtypechar == 'd') rsize = sizeof(double);
-    if (rtypechar == 'D') rsize = sizeof(long double);
-    rvalue = (char*)malloc(rsize);
- 
-    if( num_args > 0 ) {
-      debug_warn( "#[%s:%i] Getting types & values of args...",
-        __FILE__, __LINE__ );
+    plan = Ct_plan_fetch(self);
+    result = Ct_plan_call(plan, ax + 1, items - 1);
+    /* It can call Perl (_as_param_ methods, Ctypes::Stub when the
+       plan becomes hot), which may have moved the stack */
+    SP = PL_stack_base + ax - 1;
+    if( result != NULL )
+      XPUSHs(sv_2mortal(result));
+    debug_warn( "#[%s:%i] Leaving XS_Ctypes_call...\n\n", __FILE__, __LINE__ );
 
-      int i, err;
-      char type_expected;
-      char type_got;
-      char type;
+SV*
+_call_many(self, outcode, ...)
+    SV* self;
+    char* outcode;
+  CODE:
+    call_plan_t* plan;
+    unsigned int i, ncols = items - 2;
+    Ct_column_t cols[ncols ? ncols : 1];
+    SV *col, *tmp;
+    STRLEN len;
 
-      /* get $self->argtypes and make sure they make sense */
-      self_argtypesRV = Ct_HVObj_GET_ATTR_KEY(self, "argtypes");
-      if( self_argtypesRV == NULL ) {
-        self_argtypes == NULL;
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::Function::call_many: $self must be a Ctypes::Function");
+    plan = Ct_plan_fetch(self);
+
+    /* Ctypes::Type::Array columns are read straight from their packed
+       data rather than element by element */
+    for( i = 0; i < ncols; i++ ) {
+      col = ST(i + 2);
+      Zero(&cols[i], 1, Ct_column_t);
+      if( Ct_Obj_IsDeriv(col, "Ctypes::Type::Array") ) {
+        tmp = sv_2mortal(Ct_HVObj_GET_ATTR_KEY(col, "_member_type"));
+        cols[i].code = *SvPV_nolen(tmp);
+        tmp = sv_2mortal(Ct_HVObj_GET_ATTR_KEY(col, "_member_size"));
+        cols[i].size = SvUV(tmp);
+        tmp = sv_2mortal(Ct_CallPerlObjMethod(col, "data", NULL));
+        if( SvROK(tmp) )
+          tmp = SvRV(tmp);
+        cols[i].buf = SvPV(tmp, len);
+        if( cols[i].size == 0 )
+          croak("Ctypes::Function::call_many: column %i has zero-sized members", i);
+        cols[i].rows = len / cols[i].size;
+      } else if( SvROK(col) && SvTYPE(SvRV(col)) == SVt_PVAV ) {
+        cols[i].av = (AV*)SvRV(col);
       } else {
-        if( !( SvROK(self_argtypesRV)
-               && SvTYPE(SvRV(self_argtypesRV)) == SVt_PVAV) )
-          croak("Ctypes::_call error: argtypes must be array reference");
-        else
-          self_argtypes = (AV*)SvRV(self_argtypesRV);
-        if( av_len(self_argtypes) == -1 ) {
-          /* could this equally be SvREFCNT_dec(self_argtypes)? */ 
-          SvREFCNT_dec(self_argtypesRV);
-          self_argtypes == NULL;
-        }
-      }
-      debug_warn("#    num_args is %i", num_args);
-      for (i = 0; i < num_args; ++i) {
-        debug_warn("#    i is %i", i);
-        SV *this_arg = ST(i+1);
-        SV *this_argtype, **fetched_argtype;
-        if( self_argtypes ) {
-          fetched_argtype = av_fetch(self_argtypes, i, 0);
-          if( fetched_argtype != NULL ) {
-            this_argtype = *fetched_argtype;
-            type_expected = Ct_Obj_IsDeriv(this_argtype, "Ctypes::Type")
-              ? (char)*SvPV(Ct_HVObj_GET_ATTR_KEY(this_argtype,"_typecode"),tc_len)
-              : (char)*SvPV(this_argtype,tc_len);
-          } else {
-  croak("[%s:%i] Function::_call error: Can't grok argtype at position %i",
-                  __FILE__, __LINE__, i);
-          }
-        } else {
-          this_argtype = NULL;
-          type_expected = '\0';
-        }
-
-        /* err not used yet, ConvArg croaks a lot */
-        debug_warn("#    calling ConvArg...");
-        err = ConvArg( this_arg,
-                 type_expected,
-                 argtypes,
-                 argvalues,
-                 i);
+        croak("Ctypes::Function::call_many: column %i must be an array "
+              "reference or Ctypes::Type::Array", i);
       }
+    }
+    RETVAL = SvREFCNT_inc(Ct_plan_call_many(plan, cols, ncols, *outcode));
+  OUTPUT:
+    RETVAL
 
-      if( av_len(self_argtypes) > -1 ) /* if not, has been dec'd already */
-        SvREFCNT_dec(self_argtypesRV);
+SV*
+_attach(self, name, op = 0)
+    SV* self;
+    char* name;
+    int op;
+  CODE:
+    call_plan_t* plan;
+    CV* xsub;
+
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::Function::attach: $self must be a Ctypes::Function");
+    plan = Ct_plan_fetch(self);
+    debug_warn( "#[%s:%i] Attaching %s", __FILE__, __LINE__, name );
+    xsub = newXS(name, Ct_attached_xsub, __FILE__);
+    /* The CV keeps its own reference, so later changes to $self
+       don't affect the installed sub. It's found through the CV's
+       magic, which new threads give their own copy. */
+    Ct_plan_hold(plan);
+    Ct_plan_attach((SV*)xsub, plan);
+#ifdef Ct_HAS_XOP
+    /* Calls compiled from now on are ops: at once for 1, and once
+       the plan is hot for 2 (op => 'auto') */
+    plan->opauto = op == 2;
+    if( op )
+      cv_set_call_checker(xsub, Ct_ck_attached, (SV*)xsub);
+#endif
+    RETVAL = newRV_inc((SV*)xsub);
+  OUTPUT:
+    RETVAL
 
-    } else {
-      debug_warn( "#[Ctypes.xs: %i ] No argtypes/values to get", __LINE__ );
+void
+_call_async(self, ...)
+    SV* self;
+  PPCODE:
+#ifdef Ct_HAS_ASYNC
+    call_plan_t* plan;
+    Ct_job_t* job;
+    AV* held;
+    unsigned int i, nargs = items - 1;
+    union result argslots[nargs ? nargs : 1];
+    void *argvalues[nargs ? nargs : 1];
+    char argcodes[nargs + 1];
+    IV tmps_floor = PL_tmps_ix;
+
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::Function::call_async: $self must be a Ctypes::Function");
+    plan = Ct_plan_fetch(self);
+    Ct_plan_marshal(plan, ax + 1, nargs, argslots, argvalues, argcodes);
+    if( !plan->fixed )
+      Ct_plan_prep(plan, nargs, argcodes);
+    /* The arguments, and anything made for them (_as_param_ data),
+       have to outlive the call: the handle keeps them */
+    held = newAV();
+    for( i = 0; i < nargs; i++ )
+      av_push(held, SvREFCNT_inc(ST(i + 1)));
+    while( tmps_floor < PL_tmps_ix )
+      av_push(held, SvREFCNT_inc(PL_tmps_stack[++tmps_floor]));
+    held = (AV*)sv_2mortal((SV*)held);
+    job = Ct_job_new(plan, nargs, argslots, argvalues);
+    if( !Ct_job_submit(job) ) {
+      Ct_job_free(job);
+      croak("Ctypes::Function::call_async: can't start any worker threads");
     }
+    Ct_plan_count(plan, 1);
+    EXTEND(SP, 2);
+    PUSHs(sv_2mortal(newSViv(PTR2IV(job))));
+    PUSHs(sv_2mortal(newRV_inc((SV*)held)));
+#else
+    PERL_UNUSED_VAR(self);
+    croak("Ctypes::Function::call_async isn't supported on this platform");
+#endif
 
-    char abi =  *SvPV((Ct_HVObj_GET_ATTR_KEY(self,"abi")),tc_len);
-    void* addr = INT2PTR(void*,(int)SvIV(Ct_HVObj_GET_ATTR_KEY(self,"func")));
+SV*
+_parallel_map(self, incode, insize, in, byref, outcode, nthreads)
+    SV* self;
+    char incode;
+    UV insize;
+    SV* in;
+    int byref;
+    char outcode;
+    unsigned int nthreads;
+  CODE:
+#ifdef Ct_HAS_ASYNC
+    call_plan_t* plan;
+    STRLEN len, rows, per, i, njobs;
+    const char* inbuf;
+    char argcode;
+
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::parallel_map: $func must be a Ctypes::Function");
+    plan = Ct_plan_fetch(self);
+    if( !plan->fixed || plan->nargs != 1 )
+      croak("Ctypes::parallel_map: the function must have argtypes, "
+            "and take one argument");
+    if( plan->rcode == 'T' || plan->rcode == 'v' )
+      croak("Ctypes::parallel_map: the function must return a simple type");
+    if( Ct_sizecode_of(outcode) != plan->rcode )
+      croak("Ctypes::parallel_map: out Array holds '%c' but function returns '%c'",
+            outcode, plan->rcode);
+    argcode = plan->argcodes[0];
+    if( argcode == 'T' ? insize != plan->arglayouts[0]->type.size
+        : !byref && ( Ct_sizecode_of(incode) != argcode
+                      || insize != Ct_typedesc(argcode)->size ) )
+      croak("Ctypes::parallel_map: input Array holds '%c' but argument is '%c'",
+            incode, argcode);
+    if( insize == 0 )
+      croak("Ctypes::parallel_map: input Array has zero-sized members");
+    inbuf = SvPV(in, len);
+    rows = len / insize;
+    RETVAL = newSV(rows * plan->rtype->size + 1);
+    SvPOK_on(RETVAL);
+    SvCUR_set(RETVAL, rows * plan->rtype->size);
+
+    if( nthreads == 0 )
+      nthreads = 1;
+    if( nthreads > rows )
+      nthreads = rows ? rows : 1;
+    if( Ct_pool_threads(0) < nthreads )
+      (void)Ct_pool_threads(nthreads);
+    per = (rows + nthreads - 1) / nthreads;
+    njobs = rows ? (rows + per - 1) / per : 0;
+    {
+      /* The chunks only read plan and in, and each writes its own rows
+         of RETVAL, so nothing is locked while they run */
+      Ct_map_chunk_t chunks[njobs ? njobs : 1];
+      Ct_job_t* jobs[njobs ? njobs : 1];
+      STRLEN queued = 0;
+      for( i = 0; i < njobs; i++ ) {
+        chunks[i].plan = plan;
+        chunks[i].in = inbuf;
+        chunks[i].insize = insize;
+        chunks[i].out = SvPVX(RETVAL);
+        chunks[i].from = i * per;
+        chunks[i].to = (i + 1) * per < rows ? (i + 1) * per : rows;
+        chunks[i].byref = byref;
+        jobs[i] = Ct_job_new_run(Ct_map_run, &chunks[i]);
+        if( Ct_job_submit(jobs[i]) )
+          queued++;
+      }
+      for( i = 0; i < njobs; i++ )
+        Ct_job_free(jobs[i]);
+      if( queued < njobs ) {
+        SvREFCNT_dec(RETVAL);
+        croak("Ctypes::parallel_map: can't start any worker threads");
+      }
+    }
+    Ct_plan_count(plan, rows);
+#else
+    PERL_UNUSED_VAR(self); PERL_UNUSED_VAR(incode); PERL_UNUSED_VAR(insize);
+    PERL_UNUSED_VAR(in); PERL_UNUSED_VAR(byref); PERL_UNUSED_VAR(outcode);
+    PERL_UNUSED_VAR(nthreads);
+    croak("Ctypes::parallel_map isn't supported on this platform");
+#endif
+  OUTPUT:
+    RETVAL
 
-    if((status = ffi_prep_cif
-         (&cif,
-	  /* x86-64 uses for 'c' UNIX64 resp. WIN64, which is f not c */
-#if defined(__CYGWIN__) || defined (_WIN32)
-           abi == 's' ? FFI_STDCALL : 
+unsigned int
+_async_threads(n = 0)
+    unsigned int n;
+  CODE:
+#ifdef Ct_HAS_ASYNC
+    RETVAL = Ct_pool_threads(n);
+#else
+    PERL_UNUSED_VAR(n);
+    RETVAL = 0;
 #endif
-		FFI_DEFAULT_ABI,
-          num_args, rtype, argtypes)) != FFI_OK ) {
-      croak( "Ctypes::_call error: ffi_prep_cif error %d", status );
-    }
+  OUTPUT:
+    RETVAL
 
-    debug_warn( "#[%s:%i] cif OK.", __FILE__, __LINE__ );
+const char*
+tier(self)
+    SV* self;
+  CODE:
+    call_plan_t* plan;
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::Function::tier: $self must be a Ctypes::Function");
+    plan = Ct_plan_peek(self);
+    RETVAL = plan != NULL ? Ct_plan_tier(plan) : "none";
+  OUTPUT:
+    RETVAL
 
-    debug_warn( "#[%s:%i] Calling ffi_call...", __FILE__, __LINE__ );
-    ffi_call(&cif, FFI_FN(addr), rvalue, argvalues);
-    debug_warn( "#    ffi_call returned!");
+UV
+calls(self)
+    SV* self;
+  CODE:
+    call_plan_t* plan;
+    if( !(Ct_Obj_IsDeriv(self,"Ctypes::Function")))
+      croak("Ctypes::Function::calls: $self must be a Ctypes::Function");
+    plan = Ct_plan_peek(self);
+    RETVAL = plan != NULL ? plan->calls : 0;
+  OUTPUT:
+    RETVAL
 
-    debug_warn( "#[%s:%i] Pushing retvals to Perl stack...", __FILE__, __LINE__ );
-    switch (rtypechar)
-    {
-      case 'v': break;
-      case 'c': 
-      case 'C': XPUSHs(sv_2mortal(newSViv(*(int*)rvalue)));   break;
-      case 's': 
-      case 'S': XPUSHs(sv_2mortal(newSVpv((char *)rvalue, 0)));   break;
-      case 'i': XPUSHs(sv_2mortal(newSViv(*(int*)rvalue)));   break;
-      case 'I': XPUSHs(sv_2mortal(newSVuv(*(unsigned int*)rvalue)));   break;
-      case 'l': XPUSHs(sv_2mortal(newSViv(*(long*)rvalue)));   break;
-      case 'L': XPUSHs(sv_2mortal(newSVuv(*(unsigned long*)rvalue)));   break;
-      case 'f': XPUSHs(sv_2mortal(newSVnv(*(float*)rvalue)));    break;
-      case 'd': XPUSHs(sv_2mortal(newSVnv(*(double*)rvalue)));    break;
-      case 'D': XPUSHs(sv_2mortal(newSVnv(*(long double*)rvalue)));    break;
-      #if HAS_LONG_LONG
-      case 'q': XPUSHs(sv_2mortal(newSVnv(*(long long*)rvalue)));      break;
-      case 'Q': XPUSHs(sv_2mortal(newSVnv(*(unsigned long long*)rvalue))); break;
-      #endif
-      case 'p': XPUSHs(sv_2mortal(newSVpv((void*)rvalue, 0))); break;
-    }
+int
+_thunked(self)
+    SV* self;
+  CODE:
+    /* Whether calls currently bypass ffi_call through a thunk */
+    RETVAL = Ct_plan_fetch(self)->thunk != NULL;
+  OUTPUT:
+    RETVAL
 
-    debug_warn( "#[%s:%i] Cleaning up...", __FILE__, __LINE__ );
-    free(rvalue);
-    int i = 0;
-    for( i = 0; i < num_args; i++ ) {
-      Safefree(argvalues[i]);
-      debug_warn( "#    Successfully free'd argvalues[%i]", i );
-    }
-    debug_warn( "#[%s:%i] Leaving XS_Ctypes_call...\n\n", __FILE__, __LINE__ );
+void
+_clear_plan(self)
+    SV* self;
+  CODE:
+    /* Called whenever the signature changes; the next _call recompiles */
+    Ct_plan_clear(self);
 
 
 MODULE = Ctypes		PACKAGE = Ctypes
@@ -674,26 +1089,7 @@ sizeof(type)
 CODE:
   debug_warn( "#[%s:%i] Ctypes::sizeof entered with typecode %c",
               __FILE__, __LINE__, *type );
-  switch (*type) {
-    case 'v': RETVAL = 0;           break;
-    case 'c':
-    case 'C': RETVAL = 1;           break;
-    case 's':
-    case 'S': RETVAL = 2;           break;
-    case 'i': 
-    case 'I': RETVAL = sizeof(int); break;
-    case 'l': 
-    case 'L': RETVAL = sizeof(long);  break;
-    case 'f': RETVAL = sizeof(float); break;
-    case 'd': RETVAL = sizeof(double);     break;
-    case 'D': RETVAL = sizeof(long double);break;
-    #if HAS_LONG_LONG
-    case 'q': 
-    case 'Q': RETVAL = sizeof(long long);break;
-    #endif
-    case 'p': RETVAL = sizeof(void*);      break;
-    default: croak( "Unrecognised type '%c'", *type );
-  }
+  RETVAL = Ct_typedesc(*type)->size;
   debug_warn( "# Ctypes::sizeof returning size %i", RETVAL );
 OUTPUT:
   RETVAL
@@ -703,82 +1099,26 @@ _valid_for_type(arg_sv,type)
   SV* arg_sv;
   char type;
 CODE:
-  void* arg_p;
-  NV arg_nv;
-  short i;
+  const Ct_typedesc_t* desc;
   RETVAL = 0;
   debug_warn("#[%s:%i] Entered _valid_for_type with type %c",
     __FILE__, __LINE__, type);
   if( !SvOK(arg_sv) || !type ) { XSRETURN_UNDEF; }
-  SV* typecode_sv = get_types_info( type, "sizecode", 8 );
-  STRLEN len = 1;
-  type = *SvPV( typecode_sv, len );
-  switch (type) {
+  desc = Ct_typedesc_maybe(Ct_sizecode_of(type));
+  if( desc == NULL )
+    croak( "Invalid type: %c", type );
+  switch (desc->kind) {
     case 'v': break;
-    case 'c':
-    case 'C':
-      arg_nv = SvNV(arg_sv);  /* no wrap-around: higher bits discarded */
-      if( arg_nv < CHAR_MIN || arg_nv > CHAR_MAX ) {
-        debug_warn("#    ... out of range, needs cast");
-        RETVAL = 0; break;
-      }
-      RETVAL = 1; break;
-    case 's':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_SHORT_MIN || arg_nv > PERL_SHORT_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
-    case 'S':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_USHORT_MIN || arg_nv > PERL_USHORT_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
     case 'i':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_INT_MIN || arg_nv > PERL_INT_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
-    case 'I':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_UINT_MIN || arg_nv > PERL_UINT_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
-    case 'l':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_LONG_MIN || arg_nv > PERL_LONG_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
-    case 'L':
-      arg_nv = SvNV(arg_sv);
-      if( arg_nv < PERL_ULONG_MIN || arg_nv > PERL_ULONG_MAX ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
+    case 'u':
     case 'f':
-      arg_nv = SvNV(arg_sv);
-      if( ( FLT_MIN - arg_nv) > FLT_EPSILON || (arg_nv - FLT_MAX) > FLT_EPSILON ) {
-        RETVAL = -1; break;
-      }
-      RETVAL = 1; break;
-    case 'd':
-      arg_nv = SvNV(arg_sv);
-      if( (DBL_MIN - arg_nv) > DBL_EPSILON || (arg_nv - DBL_MAX) > DBL_EPSILON ) {
-        RETVAL = -1; break;  /* XXX Wtf... what's going wrong here??? */
-      }
-      RETVAL = 1; break;
-    #ifdef HAS_LONG_DOUBLE
-    case 'D':
-      arg_nv = SvNV(arg_sv);
-      if( (LDBL_MIN - arg_nv) > LDBL_EPSILON || (arg_nv - LDBL_MAX) > LDBL_EPSILON ) {
-        RETVAL = -1; break;
+      /* no wrap-around: higher bits discarded */
+      if( !Ct_in_range(desc, arg_sv) ) {
+        debug_warn("#    ... out of range, needs cast");
+        /* single chars can always be cast */
+        RETVAL = desc->size == 1 ? 0 : -1; break;
       }
       RETVAL = 1; break;
-    #endif
     case 'p':
     /* Pointers can be just about anything
        ??? Could this be improved? */
@@ -788,7 +1128,6 @@ CODE:
         RETVAL = 0; break;
       }
       RETVAL = 1; break;
-    default: croak( "Invalid type: %c", type );
   }
 OUTPUT:
   RETVAL
@@ -799,13 +1138,10 @@ _cast(arg_sv,type)
   char type;
 CODE:
   debug_warn("#[%s:%i] _cast: got type %c", __FILE__, __LINE__, type);
-  void *retval = NULL;
-  #ifdef HAS_LONG_DOUBLE
-  Newxc(retval, 1, long double, long double);
-  #else
-  Newxc(retval, 1, double, double);
-  #endif
-  if(retval == NULL) croak("Ctypes::_cast: Out of memory!");
+  union result slot;
+  void *retval = &slot;
+  (void)Ct_typedesc(type);  /* croaks for unknown types */
+  Zero(&slot, 1, union result);
   STRLEN len = 1;
   STRLEN utf8retlen = 0;
   NV arg_nv;
@@ -990,27 +1326,27 @@ CODE:
     #endif
     #ifdef HAS_LONG_LONG
     case 'q':
-      if(SvNOK(arg_sv)) {
+      if(SvIOK(arg_sv)) {
+        *(long long*) retval = Ct_SvLL(arg_sv);
+      } else if(SvNOK(arg_sv)) {
         *(long long*) retval = (long long)SvNV(arg_sv);
-      } else if(SvIOK(arg_sv)) {
-        *(long long*) retval = (long long)SvIV(arg_sv);
       } else if(SvPOK(arg_sv)) {
         *(long long*) retval = (long long)*SvPV_nolen(arg_sv);
       }
       if(*(long long*)retval) {
-        RETVAL = newSViv(*(long long*)retval);
+        RETVAL = Ct_newSVll(*(long long*)retval);
       }
       break;
     case 'Q':
-      if(SvNOK(arg_sv)) {
+      if(SvIOK(arg_sv)) {
+        *(unsigned long long*) retval = Ct_SvULL(arg_sv);
+      } else if(SvNOK(arg_sv)) {
         *(unsigned long long*) retval = (unsigned long long)SvNV(arg_sv);
-      } else if(SvIOK(arg_sv)) {
-        *(unsigned long long*) retval = (unsigned long long)SvIV(arg_sv);
       } else if(SvPOK(arg_sv)) {
         *(unsigned long long*) retval = (unsigned long long)*SvPV_nolen(arg_sv);
       }
       if(*(unsigned long long*)retval) {
-        RETVAL = newSVuv(*(unsigned long long*)retval);
+        RETVAL = Ct_newSVull(*(unsigned long long*)retval);
       }
       break;
     #endif
@@ -1030,13 +1366,63 @@ CODE:
       break;
     default: croak( "Unimplemented / Invalid type: %c", type );
   }
-  Safefree(retval);
 OUTPUT:
   RETVAL
 
 
 MODULE=Ctypes   PACKAGE=Ctypes::Type
 
+void
+_view(self, source, offset, length, writable = 1)
+    SV* self
+    SV* source
+    UV offset
+    UV length
+    int writable
+CODE:
+  /* self's _data becomes length bytes of the string source refers to,
+     from offset, in place */
+  Ct_view_of_sv(self, source, offset, length, writable);
+
+void
+_view_address(self, addr, length, writable = 1)
+    SV* self
+    UV addr
+    UV length
+    int writable
+CODE:
+  if( !SvROK(self) || SvTYPE(SvRV(self)) != SVt_PVHV )
+    croak("Ctypes: can only give objects views");
+  if( addr == 0 )
+    croak("Ctypes: can't view a NULL pointer");
+  (void)hv_stores( (HV*)SvRV(self), "_data",
+                   Ct_view_new(INT2PTR(char*, addr), length, NULL, NULL,
+                               writable) );
+
+void
+_view_move(self, span, offset)
+    SV* self
+    SV* span
+    UV offset
+CODE:
+  /* self's view moves to offset in span, the string it was made from */
+  Ct_view_move(self, span, offset);
+
+SV*
+_types_table(perltypes)
+  int perltypes
+CODE:
+  /* $_pytypes / $_perltypes, generated from the C type tables */
+  RETVAL = Ct_typenames_hv(perltypes);
+OUTPUT:
+  RETVAL
+
+void
+_select_types(perltypes)
+  int perltypes
+CODE:
+  Ct_select_typenames(perltypes);
+
 int
 is_a_number(arg_sv)
   SV* arg_sv
@@ -1230,70 +1616,334 @@ PPCODE:
   XPUSHs(converted);
 
 
+MODULE=Ctypes	PACKAGE=Ctypes::Type::Struct::_Layout
+
+int
+_compile(self, size, spec)
+    SV* self
+    UV size
+    SV* spec
+CODE:
+  Ct_layout_t* layout;
+  SV** klass;
+  if( !( SvROK(spec) && SvTYPE(SvRV(spec)) == SVt_PVAV ) )
+    croak("Usage: $layout->_compile(SIZE, ARRAYREF)");
+  layout = Ct_layout_compile(size, (AV*)SvRV(spec));
+  klass = hv_fetchs((HV*)SvRV(self), "_class", 0);
+  layout->klass = savepv(klass != NULL && SvOK(*klass)
+                         ? SvPV_nolen(*klass) : "Ctypes::Type::Struct");
+  sv_unmagicext(SvRV(self), PERL_MAGIC_ext, &Ct_layout_vtbl);
+  Ct_layout_attach(SvRV(self), layout);
+  RETVAL = layout->byvalue;
+OUTPUT:
+  RETVAL
+
+
+MODULE=Ctypes	PACKAGE=Ctypes::Type::Array
+
+void
+_buf_store(data, code, start, values, strict)
+    SV* data
+    char code
+    UV start
+    SV* values
+    int strict
+PPCODE:
+  /* Store a value, or an arrayref of them, from element start on.
+     Returns nothing if they all fit; else the index (from start) and
+     complaint of the first which didn't, how many didn't, and whether
+     to die: then nothing from that one on has been stored. */
+  const Ct_typedesc_t* desc = Ct_buf_desc(code);
+  AV* av = NULL;
+  SV** item;
+  Ct_buf_elem_t tmp;
+  char why[Ct_BUF_WHYLEN], first[Ct_BUF_WHYLEN];
+  char* p;
+  UV i, count = 1, bad = 0, nbad = 0;
+  int r, fatal = 0;
+  if( SvROK(values) && SvTYPE(SvRV(values)) == SVt_PVAV
+      && !sv_isobject(values) ) {
+    av = (AV*)SvRV(values);
+    count = av_len(av) + 1;
+  }
+  p = Ct_buf_span(data, desc, start, count, 1);
+  if( av != NULL && !strict && !SvMAGICAL((SV*)av) ) {
+    /* A plain array: the elements themselves, chunk by chunk */
+    r = Ct_buf_store_many(desc, p, AvARRAY(av), count, &bad, &nbad, first);
+    fatal = r == Ct_BUF_REJECTED;
+    count = 0;
+  }
+  for( i = 0; i < count; i++, p += desc->size ) {
+    item = av != NULL ? av_fetch(av, i, 0) : &values;
+    r = Ct_buf_put(desc, tmp.bytes, item != NULL ? *item : &PL_sv_undef, why);
+    if( r != Ct_BUF_OK ) {
+      if( nbad++ == 0 ) {
+        bad = i;
+        my_strlcpy(first, why, Ct_BUF_WHYLEN);
+      }
+      if( r == Ct_BUF_REJECTED || strict ) {
+        fatal = 1;
+        break;
+      }
+    }
+    Copy(tmp.bytes, p, desc->size, char);
+  }
+  SvSETMAGIC(data);
+  if( nbad ) {
+    EXTEND(SP, 4);
+    mPUSHu(bad);
+    mPUSHp(first, strlen(first));
+    mPUSHu(nbad);
+    mPUSHi(fatal);
+  }
+
+void
+_buf_fetch(data, code, start, count, chars)
+    SV* data
+    char code
+    UV start
+    UV count
+    int chars
+PPCODE:
+  const Ct_typedesc_t* desc = Ct_buf_desc(code);
+  const char* p = Ct_buf_span(data, desc, start, count, 0);
+  UV i;
+  EXTEND(SP, count);
+  Ct_buf_get_many(desc, p, count, chars, SP + 1);
+  for( i = 1; i <= count; i++ )
+    sv_2mortal(SP[i]);
+  SP += count;
+
+void
+_buf_fill(data, code, start, count, value, strict)
+    SV* data
+    char code
+    UV start
+    UV count
+    SV* value
+    int strict
+PPCODE:
+  /* Returns as _buf_store */
+  const Ct_typedesc_t* desc = Ct_buf_desc(code);
+  Ct_buf_elem_t tmp;
+  char why[Ct_BUF_WHYLEN];
+  char* p = Ct_buf_span(data, desc, start, count, 1);
+  size_t done, total = count * desc->size;
+  int r = Ct_buf_put(desc, tmp.bytes, value, why);
+  int fatal = r == Ct_BUF_REJECTED || (r != Ct_BUF_OK && strict);
+  if( !fatal && count ) {
+    /* Doubling copies of what's filled so far */
+    Copy(tmp.bytes, p, desc->size, char);
+    for( done = desc->size; done < total; done *= 2 )
+      Copy(p, p + done, done * 2 > total ? total - done : done, char);
+    SvSETMAGIC(data);
+  }
+  if( r != Ct_BUF_OK ) {
+    EXTEND(SP, 4);
+    mPUSHu(0);
+    mPUSHp(why, strlen(why));
+    mPUSHu(1);
+    mPUSHi(fatal);
+  }
+
+SV*
+_mmap(path, writable)
+    const char* path
+    int writable
+CODE:
+  /* A reference to a view of the whole file */
+#ifdef Ct_HAS_MMAP
+  RETVAL = newRV_noinc(Ct_view_file(path, writable));
+#else
+  PERL_UNUSED_VAR(path);
+  PERL_UNUSED_VAR(writable);
+  croak("Ctypes::Type::Array::mmap isn't supported on this platform");
+#endif
+OUTPUT:
+  RETVAL
+
+int
+_madvise(data, how)
+    SV* data
+    const char* how
+CODE:
+  RETVAL = Ct_view_advise(data, how);
+OUTPUT:
+  RETVAL
+
+const char*
+_simd(level = NULL)
+    const char* level
+CODE:
+  /* The kernels converting in bulk: which, and with level, which to
+     use from now on */
+  const Ct_kernels_t* kernels;
+  if( level != NULL ) {
+    if( (kernels = Ct_kernels_for(level)) == NULL )
+      croak("Ctypes::Type::Array: this CPU can't run '%s' kernels", level);
+    Ct_kernels = kernels;
+  }
+  RETVAL = Ct_kernels->name;
+OUTPUT:
+  RETVAL
+
+
+MODULE=Ctypes	PACKAGE=Ctypes::Function::Async
+
+#ifdef Ct_HAS_ASYNC
+
+int
+fd(self)
+    SV* self
+CODE:
+  RETVAL = Ct_job_of(self)->fds[0];
+OUTPUT:
+  RETVAL
+
+int
+ready(self)
+    SV* self
+CODE:
+  RETVAL = Ct_job_done(Ct_job_of(self));
+OUTPUT:
+  RETVAL
+
+void
+wait(self)
+    SV* self
+CODE:
+  Ct_job_wait_dispatching(Ct_job_of(self));
+
+SV*
+result(self)
+    SV* self
+CODE:
+  Ct_job_t* job = Ct_job_of(self);
+  if( !Ct_job_ours(job) )
+    croak("Ctypes::Function::Async: the call was made by the parent process");
+  Ct_job_wait_dispatching(job);
+  /* Unmarshalled here, on the interpreter's thread */
+  RETVAL = Ct_plan_result(job->plan, job->rvalue);
+  if( RETVAL == NULL )
+    RETVAL = &PL_sv_undef;
+OUTPUT:
+  RETVAL
+
+void
+DESTROY(self)
+    SV* self
+CODE:
+  SV** fetched = hv_fetchs((HV*)SvRV(self), "_job", 0);
+  if( fetched != NULL && SvIOK(*fetched) && SvIV(*fetched) ) {
+    Ct_job_wait_dispatching(INT2PTR(Ct_job_t*, SvIV(*fetched)));
+    Ct_job_free(INT2PTR(Ct_job_t*, SvIV(*fetched)));
+    sv_setiv(*fetched, 0);
+  }
+
+#endif
+
+
+MODULE=Ctypes	PACKAGE=Ctypes::Stub
+
+void
+_register(abi, sig, addr)
+    char abi
+    char* sig
+    UV addr
+CODE:
+  /* A stub Ctypes::Stub has built and loaded; plans compiled from
+     now on with this signature use it */
+  if( addr == 0 )
+    croak("Ctypes::Stub::_register: no stub address");
+  Ct_stub_register(abi, sig, INT2PTR(Ct_thunk_fn, addr));
+
+UV
+_ffi_arg_size()
+CODE:
+  /* What stubs widen small integer returns to, as libffi does */
+  RETVAL = sizeof(ffi_arg);
+OUTPUT:
+  RETVAL
+
+
 MODULE=Ctypes	PACKAGE=Ctypes::Callback
 
 void
-_make_callback( coderef, sig, ... )
+_make_callback( coderef, sig, queued, ... )
+    SV* coderef;
     STRLEN siglen = 0;
-    SV* coderef = newSVsv(ST(0));
     char* sig = (char*)SvPV(ST(1), siglen);
+    int queued;
   PPCODE:
     /* It should be remembered that unlike Ctypes::_call above,
        sig here won't include an abi (since it refers to a Perl
        function), so offsets for arg types will always be +1, not +2 */
-    ffi_status status = FFI_BAD_TYPEDEF;
-    ffi_type *rtype;
-    char *rvalue;
-    unsigned int args_in_sig, rsize;
-    unsigned int num_args = siglen - 1;
-    ffi_type** argtypes;
+    ffi_status status;
+    Ct_layout_t** layouts;
+    Ct_closure_slot_t* slot;
+    Ct_cb_cif_t* shared;
+    struct _Ct_cb_queue_t* queue = NULL;
     cb_data_t* cb_data;
-    void* code;
-    ffi_cif* cb_cif;
-    ffi_closure* closure;
+    int i, next, nstructs = 0;
 
     debug_warn( "\n#[%s:%i] Entered _make_callback", __FILE__, __LINE__ );
-    
-    debug_warn( "#[%s:%i] Allocating memory for  closure...", __FILE__, __LINE__ );
-    closure = ffi_closure_alloc( sizeof(ffi_closure), &code );
-
-    Newx( cb_data, 1, cb_data_t );
-    Newx(cb_data->cif, 1, ffi_cif);
-    Newx(argtypes, num_args, ffi_type*);
 
-    debug_warn( "#[%s:%i] Setting rtype '%c'", __FILE__, __LINE__, sig[0] );
-    rtype = get_ffi_type( sig[0] );
-
-    if( num_args > 0 ) {
-      int i;
-      for( i = 0; i < num_args; i++ ) {
-        argtypes[i] = get_ffi_type(sig[i+1]); 
-        debug_warn( "#    Got argtype '%c'", sig[i+1] );
+    /* Structs passed by value are 'T' in sig; the Struct type objects
+       follow sig, one per 'T' in order. Their classes hold the
+       layouts, so no references are kept here. */
+    for( i = 0; i < siglen; i++ )
+      if( sig[i] == 'T' )
+        nstructs++;
+    if( items - 3 != nstructs )
+      croak( "Ctypes::Callback: sig has %i Structs but %i were given",
+             nstructs, (int)items - 3 );
+    Newx( layouts, siglen ? siglen : 1, Ct_layout_t* );
+    SAVEFREEPV( layouts );
+    for( i = 0, next = 3; i < siglen; i++ ) {
+      layouts[i] = NULL;
+      if( sig[i] == 'T' ) {
+        layouts[i] = Ct_struct_layout_of(ST(next++));
+        Ct_layout_free(layouts[i]);
       }
     }
+#ifdef Ct_HAS_ASYNC
+    queue = Ct_cb_queue_mine(1);
+#endif
+    shared = Ct_cb_cif_get(sig, siglen, layouts);
+    if( (slot = Ct_closure_take()) == NULL ) {
+      Ct_cb_cif_release(shared);
+      croak( "Ctypes::Callback::new error: can't allocate a closure" );
+    }
 
-    debug_warn( "#[%s:%i] Prep'ing cif for _perl_cb_call...", __FILE__, __LINE__ ); 
-    if((status = ffi_prep_cif
-        (cb_data->cif,
-         /* Might Perl XS libs use stdcall on win32? How to check? */
-         FFI_DEFAULT_ABI,
-         num_args, rtype, argtypes)) != FFI_OK ) {
-       croak( "Ctypes::_call error: ffi_prep_cif error %d", status );
-     }
+    Newx( cb_data, 1, cb_data_t );
+    cb_data->shared = shared;
+    cb_data->sig = shared->sig;
+    cb_data->cif = &shared->cif;
+    cb_data->layouts = shared->layouts;
+    cb_data->slot = slot;
+    cb_data->closure = slot->closure;
+    cb_data->queue = queue;
+    cb_data->queued = queued;
+    cb_data->dead = 0;
+    cb_data->depth = 0;
+    cb_data->refcnt = 1;
 
     debug_warn( "#[%s:%i] Prep'ing closure...", __FILE__, __LINE__ ); 
     if((status = ffi_prep_closure_loc
-        ( closure, cb_data->cif, &_perl_cb_call, cb_data, code )) != FFI_OK ) {
-        croak( "Ctypes::Callback::new error: ffi_prep_closure_loc error %d",
-            status );
-        }
-
-    cb_data->sig = sig;
-    cb_data->coderef = coderef;
-    cb_data->closure = closure;
+        ( slot->closure, cb_data->cif, &_perl_cb_call, cb_data, slot->code ))
+       != FFI_OK ) {
+      Ct_closure_give(slot);
+      Ct_cb_cif_release(shared);
+      Safefree(cb_data);
+      croak( "Ctypes::Callback::new error: ffi_prep_closure_loc error %d",
+             status );
+    }
+    if( queue != NULL )
+      Ct_cb_queue_hold(queue);
+    cb_data->coderef = newSVsv(coderef);
+    Newxz(cb_data->argsvs, siglen, SV*);
 
-    unsigned int len = sizeof(intptr_t);
-    XPUSHs(sv_2mortal(newSViv(PTR2IV(code))));    /* pointer type void */
+    XPUSHs(sv_2mortal(newSViv(PTR2IV(slot->code))));    /* pointer type void */
     XPUSHs(sv_2mortal(newSViv(PTR2IV(cb_data)))); 
 
 void
@@ -1301,20 +1951,77 @@ DESTROY(self)
     SV* self;
 PREINIT:
     cb_data_t* data;
-    HV* selfhash;
     SV** svValue;
-    int intFromPerl;
+    unsigned int i;
 PPCODE:
     if( !sv_isa(self, "Ctypes::Callback") ) {
       croak( "Callback::DESTROY called on non-Callback object" );
     }
 
+    /* _cb_data is unset if new() died before it was filled in */
     svValue = hv_fetch((HV*)SvRV(self), "_cb_data", 8, 0 );
-    if(!svValue) { croak("No _cb_data ptr from Perl"); }
-    intFromPerl = SvIV(*svValue);
-    data = INT2PTR(cb_data_t*, intFromPerl);
-
-    ffi_closure_free(data->closure);
-    Safefree(data->cif->arg_types);
-    Safefree(data->cif);
-    Safefree(data);
+    if( !svValue || !SvTRUE(*svValue) )
+      XSRETURN_EMPTY;
+    data = INT2PTR(cb_data_t*, SvIV(*svValue));
+    sv_setiv(*svValue, 0);
+
+    Ct_closure_give(data->slot);
+    for( i = 0; i < data->cif->nargs; i++ )
+      SvREFCNT_dec(data->argsvs[i]);
+    Safefree(data->argsvs);
+    Ct_cb_cif_release(data->shared);
+    SvREFCNT_dec(data->coderef);
+    /* Calls still queued from other threads hold on to data */
+    data->dead = 1;
+    Ct_cb_data_release(data);
+
+#ifdef Ct_HAS_ASYNC
+
+int
+dispatch_pending(...)
+CODE:
+    /* Runs the calls other threads have made to this thread's
+       Callbacks; callable as a function or a class method */
+    PERL_UNUSED_VAR(items);
+    RETVAL = Ct_cb_dispatch(Ct_cb_queue_mine(0));
+OUTPUT:
+    RETVAL
+
+int
+pending_fd(...)
+CODE:
+    PERL_UNUSED_VAR(items);
+    RETVAL = Ct_cb_queue_mine(1)->fds[0];
+OUTPUT:
+    RETVAL
+
+#endif
+
+MODULE=Ctypes	PACKAGE=Ctypes::Callback::Native
+
+void
+_make_compare(code, desc, offset, key_offset, length)
+    char code
+    int desc
+    UV offset
+    UV key_offset
+    UV length
+  PPCODE:
+    Ct_native_cmp_t* cmp
+      = Ct_native_compare_new(code, desc, offset, key_offset, length);
+    XPUSHs(sv_2mortal(newSViv(PTR2IV(cmp->addr))));
+    XPUSHs(sv_2mortal(newSViv(PTR2IV(cmp))));
+
+void
+DESTROY(self)
+    SV* self
+  PREINIT:
+    SV** svValue;
+  PPCODE:
+    if( !sv_isa(self, "Ctypes::Callback::Native") )
+      croak( "Callback::Native::DESTROY called on non-Native object" );
+    svValue = hv_fetchs((HV*)SvRV(self), "_cb_data", 0);
+    if( !svValue || !SvTRUE(*svValue) )
+      XSRETURN_EMPTY;
+    Ct_native_compare_free(INT2PTR(Ct_native_cmp_t*, SvIV(*svValue)));
+    sv_setiv(*svValue, 0);
@@ -0,0 +1,387 @@
+/*###########################################################################
+## Name:        array_buf.c
+## Purpose:     Ctypes::Type::Array's packed element buffer: converting
+##              Perl values into and out of it many elements at a time
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_ARRAY_BUF_C
+#define _INC_ARRAY_BUF_C
+
+/* What Ct_buf_put made of a value: as Simple's _hook_store, a value
+   can be stored as given, stored after being made to fit (which gets
+   a warning, or dies under strict_input_all), or not stored at all */
+#define Ct_BUF_OK       0
+#define Ct_BUF_COERCED  1
+#define Ct_BUF_REJECTED 2
+#define Ct_BUF_WHYLEN   96
+
+/* Room for any one element */
+typedef union {
+  long double ld;
+  double d;
+#ifdef HAS_LONG_LONG
+  long long ll;
+#endif
+  char bytes[1];
+} Ct_buf_elem_t;
+
+/* The bytes of elements start .. start+count-1 of data, made safe to
+   write to if writing is set; croaks if data is shorter than that */
+char*
+Ct_buf_span(SV* data, const Ct_typedesc_t* desc, UV start, UV count,
+            int writing)
+{
+  STRLEN len;
+  char* buf = writing ? SvPV_force(data, len) : SvPV(data, len);
+  if( (start + count) * desc->size > len )
+    croak( "Ctypes::Type::Array: elements %"UVuf"..%"UVuf" are past the "
+           "end of a %"UVuf"-element buffer", start, start + count - 1,
+           (UV)(len / desc->size) );
+  return buf + start * desc->size;
+}
+
+#define Ct_BUF_PUT(type, v) { type x = (type)(v); Copy(&x, p, 1, type); }
+
+/* Convert sv to the type desc describes and write it at p. Where it
+   doesn't fit, why (Ct_BUF_WHYLEN long) says how, in _hook_store's
+   words. */
+int
+Ct_buf_put(const Ct_typedesc_t* desc, char* p, SV* sv, char* why)
+{
+  const char* s;
+  STRLEN len;
+  int ret = Ct_BUF_OK;
+  IV iv = 0;
+  UV uv = 0;
+  NV nv = 0;
+
+  SvGETMAGIC(sv);
+  if( SvROK(sv) ) {
+    my_strlcpy(why, "cannot take references", Ct_BUF_WHYLEN);
+    return Ct_BUF_REJECTED;
+  }
+  if( !SvOK(sv) )
+    ;                                   /* all goes null */
+  else if( looks_like_number(sv) ) {
+    if( desc->kind == 'f' ) {
+      nv = SvNV_nomg(sv);
+      if( nv < desc->min || nv > desc->max )
+        ret = Ct_BUF_COERCED;
+    }
+    else {
+      if( !Ct_in_range(desc, sv) )
+        ret = Ct_BUF_COERCED;
+      else if( !SvIOK(sv) && (nv = SvNV_nomg(sv)) != Perl_floor(nv) )
+        ret = Ct_BUF_COERCED;
+      if( desc->kind == 'u' )
+        iv = (IV)(uv = SvUV_nomg(sv));
+      else
+        uv = (UV)(iv = SvIV_nomg(sv));
+    }
+    if( ret != Ct_BUF_OK )
+      my_snprintf( why, Ct_BUF_WHYLEN,
+                   "numeric values must be %s%"NVgf" <= x <= %"NVgf,
+                   desc->kind == 'f' ? "" : "integers ",
+                   desc->min, desc->max );
+  }
+  else {
+    /* A character: its ordinal */
+    s = SvPV_nomg(sv, len);
+    if( SvUTF8(sv) ) {
+      uv = len ? utf8_to_uvchr_buf((const U8*)s, (const U8*)s + len, NULL) : 0;
+      len = utf8_length((const U8*)s, (const U8*)s + len);
+    }
+    else
+      uv = len ? (U8)s[0] : 0;
+    if( len != 1 ) {
+      my_strlcpy(why, "single characters only", Ct_BUF_WHYLEN);
+      ret = Ct_BUF_COERCED;
+    }
+    else if( (NV)uv > desc->max ) {
+      my_snprintf( why, Ct_BUF_WHYLEN,
+                   "character values must be integers 0 <= ord(x) <= %"NVgf,
+                   desc->max );
+      ret = Ct_BUF_COERCED;
+    }
+    iv = (IV)uv;
+    nv = (NV)uv;
+  }
+
+  switch( desc->code ) {
+    case 'c': Ct_BUF_PUT(signed char, iv)           break;
+    case 'C': Ct_BUF_PUT(unsigned char, uv)         break;
+    case 's': Ct_BUF_PUT(short, iv)                 break;
+    case 'S': Ct_BUF_PUT(unsigned short, uv)        break;
+    case 'i': Ct_BUF_PUT(int, iv)                   break;
+    case 'I': Ct_BUF_PUT(unsigned int, uv)          break;
+    case 'l': Ct_BUF_PUT(long, iv)                  break;
+    case 'L': Ct_BUF_PUT(unsigned long, uv)         break;
+#ifdef HAS_LONG_LONG
+    case 'q': Ct_BUF_PUT(long long, iv)             break;
+    case 'Q': Ct_BUF_PUT(unsigned long long, uv)    break;
+#endif
+    case 'f': Ct_BUF_PUT(float, nv)                 break;
+    case 'd': Ct_BUF_PUT(double, nv)                break;
+#ifdef HAS_LONG_DOUBLE
+    case 'D': Ct_BUF_PUT(long double, nv)           break;
+#endif
+    default:
+      croak( "Ctypes::Type::Array: can't buffer type '%c'", desc->code );
+  }
+  return ret;
+}
+
+#define Ct_BUF_GET(type, newsv) { type x; Copy(p, &x, 1, type); return newsv; }
+
+/* A new SV for the element at p. chars makes char types single
+   character strings, as c_char and c_uchar FETCH them. */
+SV*
+Ct_buf_get(const Ct_typedesc_t* desc, const char* p, int chars)
+{
+  switch( desc->code ) {
+    case 'c': Ct_BUF_GET(signed char,
+                chars ? newSVpvn((const char*)&x, 1) : newSViv(x))
+    case 'C': Ct_BUF_GET(unsigned char,
+                chars ? newSVpvn((const char*)&x, 1) : newSVuv(x))
+    case 's': Ct_BUF_GET(short, newSViv(x))
+    case 'S': Ct_BUF_GET(unsigned short, newSVuv(x))
+    case 'i': Ct_BUF_GET(int, newSViv(x))
+    case 'I': Ct_BUF_GET(unsigned int, newSVuv(x))
+    case 'l': Ct_BUF_GET(long, newSViv(x))
+    case 'L': Ct_BUF_GET(unsigned long, newSVuv(x))
+#ifdef HAS_LONG_LONG
+    case 'q': Ct_BUF_GET(long long, Ct_newSVll(x))
+    case 'Q': Ct_BUF_GET(unsigned long long, Ct_newSVull(x))
+#endif
+    case 'f': Ct_BUF_GET(float, newSVnv(x))
+    case 'd': Ct_BUF_GET(double, newSVnv(x))
+#ifdef HAS_LONG_DOUBLE
+    case 'D': Ct_BUF_GET(long double, newSVnv(x))
+#endif
+  }
+  croak( "Ctypes::Type::Array: can't buffer type '%c'", desc->code );
+  return NULL;
+}
+
+/* Elements are converted Ct_BUF_CHUNK at a time: the SVs' numbers
+   gathered into an array of IVs or NVs, then converted by a kernel
+   from simd.c straight into the buffer */
+#define Ct_BUF_CHUNK 256
+
+/* Numbers a kernel can take as they stand: no magic, no references */
+#define Ct_SV_PLAIN_IV(sv) \
+  ((SvFLAGS(sv) & (SVf_IOK|SVf_IVisUV|SVs_GMG|SVf_ROK)) == SVf_IOK)
+#define Ct_SV_PLAIN_NV(sv) \
+  ((SvFLAGS(sv) & (SVf_NOK|SVs_GMG|SVf_ROK)) == SVf_NOK)
+#define Ct_SV_PLAIN_UNDEF(sv) \
+  ((SvFLAGS(sv) & (SVf_OK|SVs_GMG|SVf_ROK)) == 0)
+
+/* Stores count SVs (which may be NULL, for undef) into the elements
+   at p, as Ct_buf_put would, but chunk by chunk. Values which don't
+   fit are coerced, and counted in *nbad; *bad and first are the index
+   and complaint of the lowest. Returns Ct_BUF_REJECTED at once if a
+   value can't be stored at all (the chunk it's in, at least, isn't
+   written), else Ct_BUF_OK. */
+int
+Ct_buf_store_many(const Ct_typedesc_t* desc, char* p, SV** svs, UV count,
+                  UV* bad, UV* nbad, char* first)
+{
+  IV ivs[Ct_BUF_CHUNK];
+  NV nvs[Ct_BUF_CHUNK];
+  char kind[Ct_BUF_CHUNK];      /* 'i'v, 'n'v or 's'low */
+  char why[Ct_BUF_WHYLEN];
+  const int size = desc->size, is_signed = desc->kind != 'u';
+  const IV lo = desc->min <= (NV)IV_MIN ? IV_MIN : (IV)desc->min;
+  const IV hi = desc->max >= (NV)IV_MAX ? IV_MAX : (IV)desc->max;
+  char* dst;
+  SV* sv;
+  UV base, i, n, done, niv, nnv, nslow;
+  int r;
+
+/* Element i of the chunk the slow way, straight into place */
+#define Ct_BUF_SLOW(i) STMT_START {                                     \
+    sv = svs[base + (i)] != NULL ? svs[base + (i)] : &PL_sv_undef;      \
+    r = Ct_buf_put(desc, dst + (i) * size, sv, why);                    \
+    if( r != Ct_BUF_OK ) {                                              \
+      if( (*nbad)++ == 0 || base + (i) < *bad ) {                       \
+        *bad = base + (i);                                              \
+        my_strlcpy(first, why, Ct_BUF_WHYLEN);                          \
+      }                                                                 \
+      if( r == Ct_BUF_REJECTED )                                        \
+        return r;                                                       \
+    }                                                                   \
+  } STMT_END
+
+  for( base = 0; base < count; base += n ) {
+    n = count - base < Ct_BUF_CHUNK ? count - base : Ct_BUF_CHUNK;
+    dst = p + base * size;
+    niv = nnv = nslow = 0;
+    for( i = 0; i < n; i++ ) {
+      sv = svs[base + i];
+      if( sv != NULL && SvROK(sv) && !SvGMAGICAL(sv) ) {
+        /* Before any of the chunk is written */
+        if( (*nbad)++ == 0 || base + i < *bad ) {
+          *bad = base + i;
+          my_strlcpy(first, "cannot take references", Ct_BUF_WHYLEN);
+        }
+        return Ct_BUF_REJECTED;
+      }
+      if( sv == NULL || Ct_SV_PLAIN_UNDEF(sv) ) {
+        ivs[i] = 0;
+        kind[i] = 'i';
+        niv++;
+      }
+      else if( Ct_SV_PLAIN_IV(sv) ) {
+        ivs[i] = SvIVX(sv);
+        kind[i] = 'i';
+        niv++;
+      }
+      else if( Ct_SV_PLAIN_NV(sv) ) {
+        nvs[i] = SvNVX(sv);
+        kind[i] = 'n';
+        nnv++;
+      }
+      else {
+        ivs[i] = 0;
+        nvs[i] = 0;
+        kind[i] = 's';
+        nslow++;
+      }
+    }
+
+    if( desc->kind == 'f' ) {
+      if( niv == n )
+        Ct_kernels->iv_to_nv(ivs, nvs, n);
+      else if( niv )
+        for( i = 0; i < n; i++ )
+          if( kind[i] == 'i' )
+            nvs[i] = (NV)ivs[i];
+      switch( desc->code ) {
+        case 'd':
+#if NVSIZE == DOUBLESIZE
+          Copy(nvs, dst, n, NV);
+#else
+          /* long double or quadmath NVs: one at a time */
+          for( i = 0; i < n; i++ ) {
+            double x = (double)nvs[i];
+            Copy(&x, dst + i * sizeof(double), 1, double);
+          }
+#endif
+          for( i = 0; i < n; i++ )
+            if( nvs[i] < desc->min || nvs[i] > desc->max )
+              Ct_BUF_SLOW(i);
+          break;
+        case 'f':
+          for( done = 0; done < n; done++ ) {
+            done += Ct_kernels->nv_to_float(nvs + done,
+                                            (float*)dst + done, n - done);
+            if( done < n )
+              Ct_BUF_SLOW(done);
+          }
+          break;
+        default:
+          for( i = 0; i < n; i++ )
+            Ct_BUF_SLOW(i);
+      }
+    }
+    else if( nnv == n && size <= 4 ) {
+      for( done = 0; done < n; done++ ) {
+        done += Ct_kernels->nv_narrow(nvs + done, dst + done * size,
+                                      n - done, size, lo, hi);
+        if( done < n )
+          Ct_BUF_SLOW(done);
+      }
+    }
+    else {
+      /* Whole NVs join the IVs; any others go the slow way */
+      for( i = 0; nnv && i < n; i++ )
+        if( kind[i] == 'n' ) {
+          if( nvs[i] >= (NV)IV_MIN && nvs[i] < (NV)IV_MAX
+              && nvs[i] == Perl_floor(nvs[i]) )
+            ivs[i] = (IV)nvs[i];
+          else {
+            ivs[i] = 0;
+            kind[i] = 's';
+            nslow++;
+          }
+        }
+      for( done = 0; done < n; done++ ) {
+        done += Ct_kernels->iv_narrow(ivs + done, dst + done * size,
+                                      n - done, size, is_signed, lo, hi);
+        if( done < n )
+          Ct_BUF_SLOW(done);
+      }
+    }
+
+    /* Now the rest over the placeholders the kernels wrote */
+    if( nslow )
+      for( i = 0; i < n; i++ )
+        if( kind[i] == 's' )
+          Ct_BUF_SLOW(i);
+  }
+#undef Ct_BUF_SLOW
+  return Ct_BUF_OK;
+}
+
+/* New SVs for count elements at p, into out */
+void
+Ct_buf_get_many(const Ct_typedesc_t* desc, const char* p, UV count,
+                int chars, SV** out)
+{
+  IV ivs[Ct_BUF_CHUNK];
+  NV nvs[Ct_BUF_CHUNK];
+  const int size = desc->size;
+  UV base, i, n;
+
+  if( chars || desc->code == 'D' ) {
+    for( i = 0; i < count; i++, p += size )
+      out[i] = Ct_buf_get(desc, p, chars);
+    return;
+  }
+  for( base = 0; base < count; base += n, p += n * size ) {
+    n = count - base < Ct_BUF_CHUNK ? count - base : Ct_BUF_CHUNK;
+    switch( desc->kind ) {
+      case 'f':
+        if( desc->code == 'f' )
+          Ct_kernels->float_to_nv((const float*)p, nvs, n);
+        else {
+#if NVSIZE == DOUBLESIZE
+          Copy(p, nvs, n, NV);
+#else
+          for( i = 0; i < n; i++ ) {
+            double x;
+            Copy(p + i * sizeof(double), &x, 1, double);
+            nvs[i] = (NV)x;
+          }
+#endif
+        }
+        for( i = 0; i < n; i++ )
+          out[base + i] = newSVnv(nvs[i]);
+        break;
+      case 'u':
+        Ct_kernels->int_widen(p, ivs, n, size, 0);
+        for( i = 0; i < n; i++ )
+          out[base + i] = newSVuv((UV)ivs[i]);
+        break;
+      default:
+        Ct_kernels->int_widen(p, ivs, n, size, 1);
+        for( i = 0; i < n; i++ )
+          out[base + i] = newSViv(ivs[i]);
+    }
+  }
+}
+
+/* The descriptor for an Array's buffer code: a scalar packcode */
+const Ct_typedesc_t*
+Ct_buf_desc(char code)
+{
+  const Ct_typedesc_t* desc = Ct_typedesc_maybe(code);
+  if( desc == NULL || strchr("cCsSiIlLqQfdD", code) == NULL )
+    croak( "Ctypes::Type::Array: can't buffer type '%c'", code );
+  return desc;
+}
+
+#endif  /* _INC_ARRAY_BUF_C */
@@ -0,0 +1,282 @@
+/*###########################################################################
+## Name:        async.c
+## Purpose:     Native worker pool for Ctypes::Function::call_async and
+##              Ctypes::parallel_map: runs already marshalled calls off
+##              the interpreter thread, signalling completion on a pipe
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_ASYNC_C
+#define _INC_ASYNC_C
+
+#if defined(I_PTHREAD) && !defined(WIN32)
+#define Ct_HAS_ASYNC
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/* One call in flight. Everything a worker reads was filled in by the
+   interpreter thread before the job was queued, and the worker only
+   writes rvalue, then the pipe, then done: no Perl data is touched
+   off the interpreter thread. */
+typedef struct _Ct_job_t {
+  call_plan_t* plan;        /* held */
+  ffi_cif cif;              /* a copy of the plan's, which can be
+                               re-prepped for argtype-less functions */
+  ffi_type** argtypes;      /* cif's own copy */
+  Ct_thunk_fn thunk;
+  void (*run)(void* data);  /* or, instead of a call, this */
+  void* data;
+  union result* argslots;
+  void** argvalues;
+  union result* rvalue;
+  int fds[2];               /* [0] becomes readable when the call is done */
+  int done;
+  pid_t pid;                /* process that queued it */
+  struct _Ct_job_t* next;
+} Ct_job_t;
+
+/* Whether job was queued by this process, not inherited over a fork
+   from a parent whose worker is the one running it */
+#define Ct_job_ours(job) ( (job)->pid == getpid() )
+
+static pthread_mutex_t Ct_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t Ct_pool_queued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t Ct_pool_finished = PTHREAD_COND_INITIALIZER;
+static Ct_job_t *Ct_pool_head = NULL, *Ct_pool_tail = NULL;
+static unsigned int Ct_pool_size = 4, Ct_pool_running = 0;
+static pid_t Ct_pool_pid = 0;
+
+/* Keep the mutex consistent across fork: no worker can hold it */
+static void Ct_pool_prefork(void)  { pthread_mutex_lock(&Ct_pool_mutex); }
+static void Ct_pool_postfork(void) { pthread_mutex_unlock(&Ct_pool_mutex); }
+
+static void*
+Ct_pool_worker(void* unused) {
+  Ct_job_t* job;
+  char byte = 1;
+  PERL_UNUSED_ARG(unused);
+
+  for(;;) {
+    pthread_mutex_lock(&Ct_pool_mutex);
+    while( Ct_pool_head == NULL )
+      pthread_cond_wait(&Ct_pool_queued, &Ct_pool_mutex);
+    job = Ct_pool_head;
+    if( (Ct_pool_head = job->next) == NULL )
+      Ct_pool_tail = NULL;
+    pthread_mutex_unlock(&Ct_pool_mutex);
+
+    if( job->run != NULL )
+      job->run(job->data);
+    else if( job->thunk != NULL )
+      job->thunk(job->plan->addr, job->rvalue, job->argvalues);
+    else
+      ffi_call(&job->cif, FFI_FN(job->plan->addr), job->rvalue, job->argvalues);
+
+    /* The pipe first: once done is set the job may be freed */
+    while( job->fds[1] >= 0
+           && write(job->fds[1], &byte, 1) < 0 && errno == EINTR )
+      ;
+    pthread_mutex_lock(&Ct_pool_mutex);
+    job->done = 1;
+    pthread_cond_broadcast(&Ct_pool_finished);
+    pthread_mutex_unlock(&Ct_pool_mutex);
+  }
+  return NULL;
+}
+
+/* Start workers until there are Ct_pool_size. Called with the mutex
+   held. Workers block every signal, so they keep going to perl. */
+static void
+Ct_pool_grow(void) {
+  pthread_t thread;
+  pthread_attr_t attr;
+  sigset_t all, old;
+
+  /* A forked child has the queue but none of the threads */
+  if( Ct_pool_pid != getpid() ) {
+    if( Ct_pool_pid == 0 )
+      pthread_atfork(Ct_pool_prefork, Ct_pool_postfork, Ct_pool_postfork);
+    Ct_pool_pid = getpid();
+    Ct_pool_running = 0;
+    Ct_pool_head = Ct_pool_tail = NULL;
+  }
+  if( Ct_pool_running >= Ct_pool_size )
+    return;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  while( Ct_pool_running < Ct_pool_size
+         && pthread_create(&thread, &attr, Ct_pool_worker, NULL) == 0 )
+    Ct_pool_running++;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+  pthread_attr_destroy(&attr);
+  debug_warn( "#[%s:%i] %u async workers", __FILE__, __LINE__, Ct_pool_running );
+}
+
+/* A job calling plan with the nargs marshalled arguments in
+   argslots and argvalues (see Ct_plan_marshal), copied so the job
+   owns them; the plan's cif must be prepped for them. Takes a
+   reference to plan and opens the job's pipe. */
+Ct_job_t*
+Ct_job_new(call_plan_t* plan, unsigned int nargs,
+           union result* argslots, void** argvalues) {
+  Ct_job_t* job;
+  unsigned int i;
+  int fds[2];
+
+  if( pipe(fds) != 0 )
+    croak("Ctypes::Function::call_async: can't make a pipe: %s",
+          Strerror(errno));
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  Newxz(job, 1, Ct_job_t);
+  job->fds[0] = fds[0];
+  job->fds[1] = fds[1];
+  job->plan = plan;
+  plan->refcnt++;
+  job->thunk = plan->thunk;
+  job->cif = plan->cif;
+  Newx(job->argtypes, nargs ? nargs : 1, ffi_type*);
+  Copy(plan->argtypes, job->argtypes, nargs, ffi_type*);
+  job->cif.arg_types = job->argtypes;
+  Newx(job->argslots, nargs ? nargs : 1, union result);
+  Copy(argslots, job->argslots, nargs, union result);
+  Newx(job->argvalues, nargs ? nargs : 1, void*);
+  for( i = 0; i < nargs; i++ )
+    /* Structs by value point at their own buffer, which stays put */
+    job->argvalues[i] = argvalues[i] == &argslots[i]
+      ? (void*)&job->argslots[i] : argvalues[i];
+  Newxz(job->rvalue, plan->rsize / sizeof(union result) + 1, union result);
+  return job;
+}
+
+/* A job which runs run(data) on the pool, with no pipe */
+Ct_job_t*
+Ct_job_new_run(void (*run)(void*), void* data) {
+  Ct_job_t* job;
+  Newxz(job, 1, Ct_job_t);
+  job->fds[0] = job->fds[1] = -1;
+  job->run = run;
+  job->data = data;
+  return job;
+}
+
+/* Queue job for the workers, starting them if need be. Returns 0,
+   with job left as done, if there aren't any. */
+int
+Ct_job_submit(Ct_job_t* job) {
+  pthread_mutex_lock(&Ct_pool_mutex);
+  Ct_pool_grow();
+  job->next = NULL;
+  job->pid = Ct_pool_pid;
+  if( Ct_pool_running == 0 ) {
+    job->done = 1;
+    pthread_mutex_unlock(&Ct_pool_mutex);
+    return 0;
+  }
+  if( Ct_pool_tail != NULL )
+    Ct_pool_tail->next = job;
+  else
+    Ct_pool_head = job;
+  Ct_pool_tail = job;
+  pthread_cond_signal(&Ct_pool_queued);
+  pthread_mutex_unlock(&Ct_pool_mutex);
+  return 1;
+}
+
+int
+Ct_job_done(Ct_job_t* job) {
+  int done;
+  if( !Ct_job_ours(job) )
+    return 0;
+  pthread_mutex_lock(&Ct_pool_mutex);
+  done = job->done;
+  pthread_mutex_unlock(&Ct_pool_mutex);
+  return done;
+}
+
+void
+Ct_job_wait(Ct_job_t* job) {
+  if( !Ct_job_ours(job) )
+    return;
+  pthread_mutex_lock(&Ct_pool_mutex);
+  while( !job->done )
+    pthread_cond_wait(&Ct_pool_finished, &Ct_pool_mutex);
+  pthread_mutex_unlock(&Ct_pool_mutex);
+}
+
+/* Set the number of workers, when n is nonzero; more are started on
+   the next submit, but none are stopped. Returns the number. */
+unsigned int
+Ct_pool_threads(unsigned int n) {
+  pthread_mutex_lock(&Ct_pool_mutex);
+  if( n )
+    Ct_pool_size = n;
+  n = Ct_pool_size;
+  pthread_mutex_unlock(&Ct_pool_mutex);
+  return n;
+}
+
+/* Waits for it first: a queued or running job can't be taken back */
+void
+Ct_job_free(Ct_job_t* job) {
+  Ct_job_wait(job);
+  if( job->fds[0] >= 0 ) {
+    close(job->fds[0]);
+    close(job->fds[1]);
+  }
+  Ct_plan_free(job->plan);
+  Safefree(job->argtypes);
+  Safefree(job->argslots);
+  Safefree(job->argvalues);
+  Safefree(job->rvalue);
+  Safefree(job);
+}
+
+/* One worker's share of a Ctypes::parallel_map: rows from to to of
+   in, each passed as plan's only argument, results stored packed in
+   out. Plain C all the way down, like any other job. */
+typedef struct _Ct_map_chunk_t {
+  call_plan_t* plan;
+  const char* in;
+  STRLEN insize;            /* bytes per input element */
+  char* out;
+  STRLEN from, to;
+  int byref;                /* pass each element's address */
+} Ct_map_chunk_t;
+
+static void
+Ct_map_run(void* data) {
+  Ct_map_chunk_t* chunk = (Ct_map_chunk_t*)data;
+  call_plan_t* plan = chunk->plan;
+  union result slot, rvalue;
+  void* argvalue;
+  const char* elem;
+  STRLEN row;
+
+  for( row = chunk->from; row < chunk->to; row++ ) {
+    elem = chunk->in + row * chunk->insize;
+    if( chunk->byref ) {
+      slot.p = (void*)elem;
+      argvalue = &slot;
+    }
+    else if( plan->argcodes[0] == 'T' )
+      argvalue = (void*)elem;
+    else {
+      Copy(elem, &slot, chunk->insize, char);
+      argvalue = &slot;
+    }
+    Ct_plan_invoke(plan, &rvalue, &argvalue);
+    Ct_store_result(plan->rcode, plan->rtype, &rvalue,
+                    chunk->out + row * plan->rtype->size);
+  }
+}
+
+#endif  /* I_PTHREAD */
+
+#endif  /* _INC_ASYNC_C */
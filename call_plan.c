@@ -0,0 +1,356 @@
+/*###########################################################################
+## Name:        call_plan.c
+## Purpose:     Compile a Ctypes::Function's signature into a reusable
+##              call plan (cif, ffi_type array, return size, address)
+## Based on:    Python's ctypes-1.0.6 (StgDictObject caching)
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_CALL_PLAN_C
+#define _INC_CALL_PLAN_C
+
+static int Ct_plan_mg_free(pTHX_ SV* sv, MAGIC* mg);
+#ifdef USE_ITHREADS
+static int Ct_plan_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param);
+#else
+#define Ct_plan_mg_dup NULL
+#endif
+
+static MGVTBL Ct_plan_vtbl = {
+  NULL, NULL, NULL, NULL, Ct_plan_mg_free, NULL, Ct_plan_mg_dup
+#ifdef MGf_LOCAL
+  , NULL
+#endif
+};
+
+/* Typecode of a restype/argtype entry: either a Ctypes::Type object,
+   whose typecode is mapped to its sizecode, or a plain one-character
+   string. Struct objects stand for the Struct passed by value, 'T'. */
+char
+Ct_typecode_of(SV* type_sv) {
+  SV** fetched;
+  if( Ct_Obj_IsDeriv(type_sv, "Ctypes::Type::Struct") )
+    return 'T';
+  if( Ct_Obj_IsDeriv(type_sv, "Ctypes::Type")
+      && SvTYPE(SvRV(type_sv)) == SVt_PVHV ) {
+    fetched = hv_fetch((HV*)SvRV(type_sv), "_typecode", 9, 0);
+    if( fetched == NULL || !SvOK(*fetched) )
+      croak("Ctypes::Function: type object has no _typecode");
+    return Ct_sizecode_of(*SvPV_nolen(*fetched));
+  }
+  if( !SvOK(type_sv) )
+    croak("Ctypes::Function: undefined type");
+  return *SvPV_nolen(type_sv);
+}
+
+void
+Ct_plan_free(call_plan_t* plan) {
+  unsigned int i;
+  int left;
+  if( plan == NULL )
+    return;
+  Ct_CLOSURES_LOCK;
+  left = --plan->refcnt;
+  Ct_CLOSURES_UNLOCK;
+  if( left > 0 )
+    return;
+  Ct_layout_free(plan->rlayout);
+  if( plan->arglayouts != NULL ) {
+    for( i = 0; i < plan->nargs; i++ )
+      Ct_layout_free(plan->arglayouts[i]);
+    Safefree(plan->arglayouts);
+  }
+  Safefree(plan->argtypes);
+  Safefree(plan->argcodes);
+  Safefree(plan);
+}
+
+void
+Ct_plan_hold(call_plan_t* plan) {
+  Ct_CLOSURES_LOCK;
+  plan->refcnt++;
+  Ct_CLOSURES_UNLOCK;
+}
+
+/* Whether plan can be called through a thunk at all: only with the
+   default ABI, and never for Structs by value */
+#define Ct_plan_thunkable(plan) \
+  ( (plan)->abi == 'c' && (plan)->rlayout == NULL && (plan)->arglayouts == NULL )
+
+/* The generated thunk for plan's signature, or a stub Ctypes::Stub
+   has already loaded for it, if there is one */
+static Ct_thunk_fn
+Ct_thunk_find(call_plan_t* plan) {
+  const Ct_thunk_t* t;
+  if( !Ct_plan_thunkable(plan) )
+    return NULL;
+  for( t = Ct_thunks; t->sig != NULL; t++ )
+    if( t->sig[0] == plan->rcode && strlen(t->sig + 1) == plan->nargs
+        && memEQ(t->sig + 1, plan->argcodes, plan->nargs) )
+      return t->thunk;
+  return Ct_stub_find(plan->abi, plan->rcode, plan->nargs, plan->argcodes);
+}
+
+/* Call plan's function: through its thunk if it has one, otherwise
+   ffi_call. rvalue must have room for plan->rsize bytes. */
+#define Ct_plan_invoke(plan, rvalue, argvalues)                     \
+  ( (plan)->thunk != NULL                                           \
+    ? (plan)->thunk((plan)->addr, (rvalue), (argvalues))            \
+    : ffi_call(&(plan)->cif, FFI_FN((plan)->addr), (rvalue), (argvalues)) )
+
+/* Which call path plan is on, for Ctypes::Function::tier */
+static const char*
+Ct_plan_tier(call_plan_t* plan) {
+  return plan->opped ? "op" : plan->thunk != NULL ? "direct" : "cif";
+}
+
+/* (Re)prepare the cif for the given argument typecodes. A no-op
+   when the plan was already prepared for exactly these types. */
+void
+Ct_plan_prep(call_plan_t* plan, unsigned int nargs, const char* codes) {
+  ffi_status status;
+  unsigned int i;
+
+  if( plan->prepped && plan->nargs == nargs
+      && (nargs == 0 || memEQ(plan->argcodes, codes, nargs)) )
+    return;
+
+  debug_warn( "#[%s:%i] Preparing cif for %i args", __FILE__, __LINE__, nargs );
+  plan->prepped = 0;
+  plan->thunk = NULL;
+  if( nargs != plan->nargs || plan->argcodes == NULL ) {
+    Renew(plan->argtypes, nargs ? nargs : 1, ffi_type*);
+    Renew(plan->argcodes, nargs + 1, char);
+  }
+  for( i = 0; i < nargs; i++ ) {
+    /* Only fixed plans have 'T' args, and their layouts */
+    plan->argtypes[i] = codes[i] == 'T' && plan->arglayouts != NULL
+      ? &plan->arglayouts[i]->type : get_ffi_type(codes[i]);
+    plan->argcodes[i] = codes[i];
+  }
+  plan->argcodes[nargs] = '\0';
+  plan->nargs = nargs;
+
+  if((status = ffi_prep_cif
+       (&plan->cif,
+	/* x86-64 uses for 'c' UNIX64 resp. WIN64, which is f not c */
+#if defined(__CYGWIN__) || defined (_WIN32)
+        plan->abi == 's' ? FFI_STDCALL :
+#endif
+		FFI_DEFAULT_ABI,
+        nargs, plan->rtype, plan->argtypes)) != FFI_OK ) {
+    croak( "Ctypes::_call error: ffi_prep_cif error %d", status );
+  }
+  plan->rsize = plan->rtype->size > sizeof(ffi_arg)
+    ? plan->rtype->size : sizeof(ffi_arg);
+  plan->thunk = Ct_thunk_find(plan);
+  debug_warn( "#[%s:%i] %s", __FILE__, __LINE__,
+              plan->thunk ? "Using a direct call thunk" : "Using ffi_call" );
+  plan->prepped = 1;
+}
+
+/* Move a hot plan to the fastest call path it can have: a stub from
+   Ctypes::Stub if it has no thunk yet. Calls Perl, so only between
+   calls. Attached op => 'auto' subs also rewrite their call sites
+   from now on (see Ct_attached_xsub). */
+void
+Ct_plan_promote(call_plan_t* plan) {
+  if( plan->thunk == NULL && plan->fixed && Ct_plan_thunkable(plan) )
+    plan->thunk = Ct_stub_want(plan->abi, plan->rcode,
+                               plan->nargs, plan->argcodes);
+  debug_warn( "#[%s:%i] Promoted after %"UVuf" calls: %s", __FILE__, __LINE__,
+              plan->calls, Ct_plan_tier(plan) );
+}
+
+/* Count n calls of plan, promoting it when it becomes hot */
+#define Ct_plan_count(plan, n)                                      \
+  STMT_START {                                                      \
+    UV Ct_before = (plan)->calls;                                   \
+    (plan)->calls += (n);                                           \
+    if( Ct_before < (plan)->promote_at                              \
+        && (plan)->calls >= (plan)->promote_at )                    \
+      Ct_plan_promote(plan);                                        \
+  } STMT_END
+
+/* Read restype, argtypes, abi and func out of a Ctypes::Function
+   and compile them. Everything that can croak is checked before
+   anything is allocated, Struct layouts included. */
+call_plan_t*
+Ct_plan_build(SV* self) {
+  HV* self_hv = (HV*)SvRV(self);
+  SV *rtype_sv = NULL, *promote_sv, **fetched;
+  AV* argtypes_av = NULL;
+  call_plan_t* plan;
+  char rcode, abi = 'c';
+  void* addr;
+  unsigned int i, nargs = 0, nstructs = 0;
+  UV promote_at;
+
+  fetched = hv_fetch(self_hv, "func", 4, 0);
+  if( fetched == NULL || !SvOK(*fetched) )
+    croak("Ctypes::Function: no function address (func) to call");
+  addr = INT2PTR(void*, SvIV(*fetched));
+
+  fetched = hv_fetch(self_hv, "abi", 3, 0);
+  if( fetched != NULL && SvOK(*fetched) )
+    abi = *SvPV_nolen(*fetched);
+
+  /* The object's own threshold, or the class's; undef or negative
+     means never */
+  fetched = hv_fetchs(self_hv, "promote_after", 0);
+  promote_sv = fetched != NULL && SvOK(*fetched)
+    ? *fetched : get_sv("Ctypes::Function::PROMOTE_AFTER", 0);
+  promote_at = promote_sv != NULL && SvOK(promote_sv) && SvIV(promote_sv) >= 0
+    ? SvUV(promote_sv) : UV_MAX;
+
+  fetched = hv_fetch(self_hv, "restype", 7, 0);
+  if( fetched != NULL && SvOK(*fetched) )
+    rtype_sv = *fetched;
+  rcode = rtype_sv != NULL ? Ct_typecode_of(rtype_sv) : 'i';
+  if( rcode == 'T' )
+    Ct_layout_free(Ct_struct_layout_of(rtype_sv)); /* just checking */
+  else
+    (void)get_ffi_type(rcode);
+
+  fetched = hv_fetch(self_hv, "argtypes", 8, 0);
+  if( fetched != NULL && SvOK(*fetched) ) {
+    if( !( SvROK(*fetched) && SvTYPE(SvRV(*fetched)) == SVt_PVAV ) )
+      croak("Ctypes::_call error: argtypes must be array reference");
+    argtypes_av = (AV*)SvRV(*fetched);
+    nargs = av_len(argtypes_av) + 1;
+  }
+
+  {
+    char codes[nargs + 1];
+    for( i = 0; i < nargs; i++ ) {
+      fetched = av_fetch(argtypes_av, i, 0);
+      if( fetched == NULL )
+  croak("[%s:%i] Function::_call error: Can't grok argtype at position %i",
+                __FILE__, __LINE__, i);
+      codes[i] = Ct_typecode_of(*fetched);
+      if( codes[i] == 'T' ) {
+        Ct_layout_free(Ct_struct_layout_of(*fetched));
+        nstructs++;
+      }
+      else
+        (void)get_ffi_type(codes[i]);
+    }
+
+    Newxz(plan, 1, call_plan_t);
+    plan->refcnt = 1;
+    plan->addr = addr;
+    plan->abi = abi;
+    plan->rcode = rcode;
+    if( rcode == 'T' ) {
+      plan->rlayout = Ct_struct_layout_of(rtype_sv);
+      plan->rtype = &plan->rlayout->type;
+    }
+    else
+      plan->rtype = get_ffi_type(rcode);
+    if( nstructs ) {
+      Newxz(plan->arglayouts, nargs, Ct_layout_t*);
+      for( i = 0; i < nargs; i++ )
+        if( codes[i] == 'T' )
+          plan->arglayouts[i] =
+            Ct_struct_layout_of(*av_fetch(argtypes_av, i, 0));
+    }
+    /* Declared with no arguments is still declared */
+    plan->fixed = argtypes_av != NULL;
+    plan->promote_at = promote_at;
+    if( plan->fixed )
+      Ct_plan_prep(plan, nargs, codes);
+    if( promote_at == 0 )
+      Ct_plan_promote(plan);
+  }
+  return plan;
+}
+
+/* Tie plan's lifetime to sv (a function object's HV or an attached
+   XSUB's CV); takes over one reference */
+void
+Ct_plan_attach(SV* sv, call_plan_t* plan) {
+  MAGIC* mg;
+  mg = sv_magicext(sv, NULL, PERL_MAGIC_ext, &Ct_plan_vtbl,
+                   (const char*)plan, 0);
+#ifdef USE_ITHREADS
+  mg->mg_flags |= MGf_DUP;
+#else
+  PERL_UNUSED_VAR(mg);
+#endif
+}
+
+/* The plan attached to sv, if any */
+call_plan_t*
+Ct_plan_of(SV* sv) {
+  MAGIC* mg = mg_findext(sv, PERL_MAGIC_ext, &Ct_plan_vtbl);
+  return mg != NULL ? (call_plan_t*)mg->mg_ptr : NULL;
+}
+
+/* The plan attached to $self, or NULL if it hasn't been compiled */
+#define Ct_plan_peek(self) Ct_plan_of(SvRV(self))
+
+/* The plan attached to $self, compiled on first use */
+call_plan_t*
+Ct_plan_fetch(SV* self) {
+  call_plan_t* plan = Ct_plan_peek(self);
+
+  if( plan != NULL )
+    return plan;
+  plan = Ct_plan_build(self);
+  Ct_plan_attach(SvRV(self), plan);
+  return plan;
+}
+
+void
+Ct_plan_clear(SV* self) {
+  if( SvROK(self) )
+    sv_unmagicext(SvRV(self), PERL_MAGIC_ext, &Ct_plan_vtbl);
+}
+
+static int
+Ct_plan_mg_free(pTHX_ SV* sv, MAGIC* mg) {
+  PERL_UNUSED_ARG(sv);
+  Ct_plan_free((call_plan_t*)mg->mg_ptr);
+  mg->mg_ptr = NULL;
+  return 0;
+}
+
+#ifdef USE_ITHREADS
+/* A new thread gets a copy of the plan: argtype-less ones are
+   re-prepped by whichever call comes along, and call counts and
+   promotion are the thread's own. The layouts are shared. */
+static int
+Ct_plan_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param) {
+  call_plan_t *from = (call_plan_t*)mg->mg_ptr, *plan;
+  unsigned int i;
+
+  PERL_UNUSED_ARG(param);
+  if( from == NULL )
+    return 0;
+  Newx(plan, 1, call_plan_t);
+  StructCopy(from, plan, call_plan_t);
+  plan->refcnt = 1;
+  plan->argtypes = NULL;
+  plan->argcodes = NULL;
+  plan->nargs = 0;
+  plan->prepped = 0;
+  plan->thunk = NULL;
+  if( plan->rlayout != NULL )
+    Ct_layout_hold(plan->rlayout);
+  if( from->arglayouts != NULL ) {
+    /* Only fixed plans have them, so from->nargs isn't changing */
+    Newx(plan->arglayouts, from->nargs, Ct_layout_t*);
+    for( i = 0; i < from->nargs; i++ )
+      if( (plan->arglayouts[i] = from->arglayouts[i]) != NULL )
+        Ct_layout_hold(plan->arglayouts[i]);
+  }
+  if( plan->fixed )
+    Ct_plan_prep(plan, from->nargs, from->argcodes);
+  mg->mg_ptr = (char*)plan;
+  return 0;
+}
+#endif
+
+#endif  /* _INC_CALL_PLAN_C */
@@ -0,0 +1,380 @@
+/*###########################################################################
+## Name:        cb_queue.c
+## Purpose:     Callbacks called from threads perl doesn't know about:
+##              queued for the thread which made them, which runs them
+##              from Ctypes::Callback::dispatch_pending or while waiting
+##              on a call_async
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_CB_QUEUE_C
+#define _INC_CB_QUEUE_C
+
+#ifdef Ct_HAS_ASYNC
+#include <poll.h>
+
+/* One call of a Callback made off its thread. vals point at the
+   arguments as _perl_cb_call passes them to Ct_cb_invoke: on the
+   caller's stack if it's waiting, else copies owned by the call. */
+typedef struct _Ct_cb_call_t {
+  cb_data_t* data;          /* held */
+  void* retval;
+  void** vals;
+  unsigned int nargs;
+  int wait;                 /* the caller is blocked until done */
+  int done;
+  struct _Ct_cb_call_t* next;
+} Ct_cb_call_t;
+
+/* Calls waiting for one interpreter's thread. Foreign threads push
+   onto head with a compare-and-swap, and the first onto an empty list
+   writes a byte to the pipe; the owner takes the whole list at once.
+   Nothing on the pushing side touches Perl, so the queue is malloc'd
+   and freed by whoever lets go of it last: the interpreter, its
+   Callbacks, or a caller still pushing. */
+typedef struct _Ct_cb_queue_t {
+  pthread_t owner;
+  Ct_cb_call_t* head;       /* Ct_CB_GONE once the interpreter is */
+  Ct_cb_call_t* batch;      /* taken, in order, still to be run */
+  int fds[2];
+  pthread_mutex_t mutex;    /* for answering waiting callers */
+  pthread_cond_t answered;
+  int gone;
+  int refcnt;
+} Ct_cb_queue_t;
+
+static Ct_cb_call_t Ct_cb_gone_mark;
+#define Ct_CB_GONE (&Ct_cb_gone_mark)
+
+/* The queue lives in PL_modglobal, so each interpreter finds its own
+   (and not one left by a thread whose pthread_t has been reused), and
+   is told when the interpreter goes away */
+#define Ct_CB_QUEUE_KEY "Ctypes::Callback::_queue"
+
+static int Ct_cb_queue_mg_free(pTHX_ SV* sv, MAGIC* mg);
+#ifdef USE_ITHREADS
+static int Ct_cb_queue_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param);
+#else
+#define Ct_cb_queue_mg_dup NULL
+#endif
+
+static MGVTBL Ct_cb_queue_vtbl = {
+  NULL, NULL, NULL, NULL, Ct_cb_queue_mg_free, NULL, Ct_cb_queue_mg_dup
+#ifdef MGf_LOCAL
+  , NULL
+#endif
+};
+
+static void Ct_cb_invoke(cb_data_t* data, void* retval, void** vals);
+
+#if defined(__ATOMIC_ACQ_REL)
+#define Ct_CAS_PTR(p, old, new) \
+  __atomic_compare_exchange_n(p, &(old), new, 0, \
+                              __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define Ct_SWAP_PTR(p, new)  __atomic_exchange_n(p, new, __ATOMIC_ACQUIRE)
+#define Ct_LOAD_PTR(p)       __atomic_load_n(p, __ATOMIC_RELAXED)
+#define Ct_ADD_INT(p, n)     __atomic_add_fetch(p, n, __ATOMIC_ACQ_REL)
+#else
+#define Ct_CAS_PTR(p, old, new) \
+  ( __sync_bool_compare_and_swap(p, old, new) || ((old) = *(p), 0) )
+#define Ct_SWAP_PTR(p, new)  __sync_lock_test_and_set(p, new)
+#define Ct_LOAD_PTR(p)       (*(volatile __typeof__(*(p))*)(p))
+#define Ct_ADD_INT(p, n)     __sync_add_and_fetch(p, n)
+#endif
+
+/* The calling interpreter's queue, made if create is set and it
+   hasn't one yet; otherwise NULL */
+Ct_cb_queue_t*
+Ct_cb_queue_mine(int create) {
+  Ct_cb_queue_t* q;
+  SV** svp = hv_fetchs(PL_modglobal, Ct_CB_QUEUE_KEY, 0);
+  MAGIC* mg;
+  SV* sv;
+  int fds[2];
+
+  if( svp != NULL && SvTYPE(*svp) >= SVt_PVMG
+      && (mg = mg_findext(*svp, PERL_MAGIC_ext, &Ct_cb_queue_vtbl)) != NULL
+      && mg->mg_ptr != NULL )
+    return (Ct_cb_queue_t*)mg->mg_ptr;
+  if( !create )
+    return NULL;
+
+  if( pipe(fds) != 0 )
+    croak("Ctypes::Callback: can't make a pipe: %s", Strerror(errno));
+  if( (q = (Ct_cb_queue_t*)calloc(1, sizeof(Ct_cb_queue_t))) == NULL ) {
+    close(fds[0]);
+    close(fds[1]);
+    croak("Ctypes::Callback: out of memory for a queue");
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+  q->owner = pthread_self();
+  q->fds[0] = fds[0];
+  q->fds[1] = fds[1];
+  q->refcnt = 1;
+  pthread_mutex_init(&q->mutex, NULL);
+  pthread_cond_init(&q->answered, NULL);
+
+  sv = newSV_type(SVt_PVMG);
+  mg = sv_magicext(sv, NULL, PERL_MAGIC_ext, &Ct_cb_queue_vtbl,
+                   (const char*)q, 0);
+#ifdef USE_ITHREADS
+  mg->mg_flags |= MGf_DUP;
+#endif
+  (void)hv_stores(PL_modglobal, Ct_CB_QUEUE_KEY, sv);
+  return q;
+}
+
+#define Ct_cb_queue_hold(q)  Ct_ADD_INT(&(q)->refcnt, 1)
+
+/* Needs no Perl: the last to let go may be a foreign thread */
+static void
+Ct_cb_queue_release(Ct_cb_queue_t* q) {
+  if( q == NULL || Ct_ADD_INT(&q->refcnt, -1) != 0 )
+    return;
+  close(q->fds[0]);
+  close(q->fds[1]);
+  pthread_mutex_destroy(&q->mutex);
+  pthread_cond_destroy(&q->answered);
+  free(q);
+}
+
+#define Ct_cb_on_owner(data) \
+  ( (data)->queue == NULL \
+    || ( pthread_equal(pthread_self(), (data)->queue->owner) \
+         && !(data)->queue->gone ) )
+
+void
+Ct_cb_data_release(cb_data_t* data) {
+  if( Ct_ADD_INT(&data->refcnt, -1) == 0 ) {
+    Ct_cb_queue_release(data->queue);
+    Safefree(data);
+  }
+}
+
+static void
+Ct_cb_call_free(Ct_cb_call_t* call) {
+  unsigned int i;
+  if( call->vals != NULL )
+    for( i = 0; i < call->nargs; i++ )
+      free(call->vals[i]);
+  free(call->vals);
+  free(call->retval);
+  free(call);
+}
+
+/* Called by _perl_cb_call off the owner's thread, with no Perl
+   context: hand the call over and, unless the Callback queues, wait
+   for the owner to run it. A call that can't be handed over, for want
+   of memory or because the owner has gone, returns zero. */
+static void
+Ct_cb_enqueue(cb_data_t* data, void* retval, void** vals) {
+  Ct_cb_queue_t* q = data->queue;
+  Ct_cb_call_t mine, *call, *old;
+  unsigned int i, nargs = data->cif->nargs;
+  size_t size, rsize = data->cif->rtype->size;
+  char byte = 1;
+  int ok = 1;
+
+  if( rsize < sizeof(ffi_arg) )
+    rsize = sizeof(ffi_arg);
+  memset(retval, 0, rsize);
+  if( !data->queued ) {
+    call = &mine;
+    call->retval = retval;
+    call->vals = vals;
+  }
+  else {
+    /* Nothing of the caller's survives its return, so copy it all:
+       the values pointed at, and the strings for 'p' */
+    if( (call = (Ct_cb_call_t*)calloc(1, sizeof(Ct_cb_call_t))) == NULL )
+      return;
+    call->nargs = nargs;
+    call->retval = calloc(1, rsize);
+    call->vals = (void**)calloc(nargs ? nargs : 1, sizeof(void*));
+    ok = call->retval != NULL && call->vals != NULL;
+    for( i = 0; ok && i < nargs; i++ ) {
+      if( data->sig[i+1] == 'p' )
+        size = vals[i] != NULL ? strlen((char*)vals[i]) + 1 : 0;
+      else
+        size = data->cif->arg_types[i]->size;
+      if( vals[i] == NULL || !size )
+        continue;
+      if( (call->vals[i] = malloc(size)) == NULL )
+        ok = 0;
+      else
+        memcpy(call->vals[i], vals[i], size);
+    }
+    if( !ok ) {
+      Ct_cb_call_free(call);
+      return;
+    }
+  }
+  call->data = data;
+  call->nargs = nargs;
+  call->wait = !data->queued;
+  call->done = 0;
+  Ct_ADD_INT(&data->refcnt, 1);
+  /* Answering the call may let go of data, and with it q */
+  Ct_cb_queue_hold(q);
+
+  old = Ct_LOAD_PTR(&q->head);
+  do {
+    if( old == Ct_CB_GONE ) {
+      /* The Callback is calling, so it still holds data too */
+      Ct_ADD_INT(&data->refcnt, -1);
+      if( !call->wait )
+        Ct_cb_call_free(call);
+      Ct_cb_queue_release(q);
+      return;
+    }
+    call->next = old;
+  } while( !Ct_CAS_PTR(&q->head, old, call) );
+  if( old == NULL )
+    while( write(q->fds[1], &byte, 1) < 0 && errno == EINTR )
+      ;
+
+  if( call->wait ) {
+    pthread_mutex_lock(&q->mutex);
+    while( !call->done )
+      pthread_cond_wait(&q->answered, &q->mutex);
+    pthread_mutex_unlock(&q->mutex);
+  }
+  Ct_cb_queue_release(q);
+}
+
+/* Done with call, whether it ran or died: answer its caller or free
+   it. A SAVEDESTRUCTOR_X, so a callback that dies can't leave its
+   caller waiting for ever. */
+static void
+Ct_cb_call_finish(pTHX_ void* ptr) {
+  Ct_cb_call_t* call = (Ct_cb_call_t*)ptr;
+  cb_data_t* data = call->data;
+  Ct_cb_queue_t* q = data->queue;
+
+  if( call->wait ) {
+    pthread_mutex_lock(&q->mutex);
+    call->done = 1;
+    pthread_cond_broadcast(&q->answered);
+    pthread_mutex_unlock(&q->mutex);
+  }
+  else
+    Ct_cb_call_free(call);
+  Ct_cb_data_release(data);
+}
+
+/* Run every call queued for this thread; returns how many. A die in
+   a callback passes through, and the rest are run next time. */
+int
+Ct_cb_dispatch(Ct_cb_queue_t* q) {
+  Ct_cb_call_t *call, *list, *next;
+  char drain[64];
+  int count = 0;
+
+  if( q == NULL )
+    return 0;
+  while( read(q->fds[0], drain, sizeof(drain)) > 0 )
+    ;
+  /* Pushed newest first: reverse onto the end of the batch */
+  list = Ct_SWAP_PTR(&q->head, (Ct_cb_call_t*)NULL);
+  for( next = NULL; list != NULL; list = call ) {
+    call = list->next;
+    list->next = next;
+    next = list;
+  }
+  if( q->batch == NULL )
+    q->batch = next;
+  else {
+    for( call = q->batch; call->next != NULL; call = call->next )
+      ;
+    call->next = next;
+  }
+
+  while( (call = q->batch) != NULL ) {
+    q->batch = call->next;
+    ENTER;
+    SAVEDESTRUCTOR_X(Ct_cb_call_finish, call);
+    if( !call->data->dead )
+      Ct_cb_invoke(call->data, call->retval, call->vals);
+    LEAVE;
+    count++;
+  }
+  debug_warn( "#[%s:%i] Dispatched %i queued callbacks",
+              __FILE__, __LINE__, count );
+  return count;
+}
+
+/* The interpreter's going: no more calls are taken, and those still
+   queued are answered with zero, as if they'd died */
+static int
+Ct_cb_queue_mg_free(pTHX_ SV* sv, MAGIC* mg) {
+  Ct_cb_queue_t* q = (Ct_cb_queue_t*)mg->mg_ptr;
+  Ct_cb_call_t *call, *next;
+
+  PERL_UNUSED_ARG(sv);
+  if( q == NULL )
+    return 0;
+  mg->mg_ptr = NULL;
+  q->gone = 1;
+  for( call = Ct_SWAP_PTR(&q->head, Ct_CB_GONE); call != NULL; call = next ) {
+    next = call->next;
+    Ct_cb_call_finish(aTHX_ call);
+  }
+  for( call = q->batch, q->batch = NULL; call != NULL; call = next ) {
+    next = call->next;
+    Ct_cb_call_finish(aTHX_ call);
+  }
+  debug_warn( "#[%s:%i] Closed the callback queue %p",
+              __FILE__, __LINE__, q );
+  Ct_cb_queue_release(q);
+  return 0;
+}
+
+#ifdef USE_ITHREADS
+/* A new thread's copy of the key is empty: it makes its own queue */
+static int
+Ct_cb_queue_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param) {
+  PERL_UNUSED_ARG(param);
+  mg->mg_ptr = NULL;
+  return 0;
+}
+#endif
+
+/* Ct_job_wait, but running callbacks the job makes meanwhile, which
+   would otherwise wait for ever */
+void
+Ct_job_wait_dispatching(Ct_job_t* job) {
+  Ct_cb_queue_t* q = Ct_cb_queue_mine(0);
+  struct pollfd fds[2];
+
+  if( q != NULL && Ct_job_ours(job) && job->fds[0] >= 0 ) {
+    fds[0].fd = job->fds[0];
+    fds[1].fd = q->fds[0];
+    while( !Ct_job_done(job) ) {
+      fds[0].events = fds[1].events = POLLIN;
+      fds[0].revents = fds[1].revents = 0;
+      if( Ct_LOAD_PTR(&q->head) == NULL && q->batch == NULL
+          && poll(fds, 2, -1) < 0 && errno != EINTR )
+        break;
+      if( fds[0].revents & POLLIN )
+        break;
+      Ct_cb_dispatch(q);
+    }
+  }
+  Ct_job_wait(job);
+}
+
+#else  /* !Ct_HAS_ASYNC */
+
+#define Ct_cb_on_owner(data) 1
+#define Ct_cb_queue_hold(q) NOOP
+#define Ct_cb_data_release(data) \
+  STMT_START { if( --(data)->refcnt == 0 ) Safefree(data); } STMT_END
+
+#endif  /* Ct_HAS_ASYNC */
+
+#endif  /* _INC_CB_QUEUE_C */
@@ -0,0 +1,156 @@
+/*###########################################################################
+## Name:        closures.c
+## Purpose:     Pooled closures and interned cifs for Ctypes::Callback,
+##              so short-lived callbacks don't churn executable memory
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_CLOSURES_C
+#define _INC_CLOSURES_C
+
+/* Closures are taken from libffi Ct_CLOSURE_BATCH at a time and never
+   given back: a destroyed Callback's closure goes on the free list and
+   is re-prepped for the next one. They have to be allocated singly,
+   since libffi may pair each with a trampoline of its own, so a batch
+   can't be one allocation carved up. Process-wide, like the stubs. */
+#define Ct_CLOSURE_BATCH 16
+
+static Ct_closure_slot_t* Ct_closures_free = NULL;
+static Ct_cb_cif_t* Ct_cb_cifs = NULL;
+
+/* A closure slot from the pool, topping it up if it's empty; NULL if
+   libffi has no more */
+Ct_closure_slot_t*
+Ct_closure_take(void) {
+  Ct_closure_slot_t* slot;
+  int i;
+
+  Ct_CLOSURES_LOCK;
+  for( i = 0; Ct_closures_free == NULL && i < Ct_CLOSURE_BATCH; i++ ) {
+    slot = (Ct_closure_slot_t*)PerlMemShared_malloc(sizeof(Ct_closure_slot_t));
+    slot->closure = ffi_closure_alloc(sizeof(ffi_closure), &slot->code);
+    if( slot->closure == NULL ) {
+      PerlMemShared_free(slot);
+      break;
+    }
+    slot->next = Ct_closures_free;
+    Ct_closures_free = slot;
+  }
+  if( (slot = Ct_closures_free) != NULL )
+    Ct_closures_free = slot->next;
+  Ct_CLOSURES_UNLOCK;
+  return slot;
+}
+
+void
+Ct_closure_give(Ct_closure_slot_t* slot) {
+  Ct_CLOSURES_LOCK;
+  slot->next = Ct_closures_free;
+  Ct_closures_free = slot;
+  Ct_CLOSURES_UNLOCK;
+}
+
+/* The shared cif for sig (return code, then argument codes), with a
+   reference taken. layouts has an entry per sig position, set for
+   each 'T'; a new entry takes references to those. Croaks, holding
+   nothing, if libffi won't prep it. */
+Ct_cb_cif_t*
+Ct_cb_cif_get(const char* sig, STRLEN siglen, Ct_layout_t** layouts) {
+  Ct_cb_cif_t* shared;
+  ffi_status status;
+  STRLEN i;
+
+  for( i = 0; i < siglen; i++ )
+    if( sig[i] != 'T' )
+      (void)get_ffi_type(sig[i]);   /* croaks on a bad one */
+
+  Ct_CLOSURES_LOCK;
+  for( shared = Ct_cb_cifs; shared != NULL; shared = shared->next ) {
+    if( strlen(shared->sig) != siglen || memNE(shared->sig, sig, siglen) )
+      continue;
+    for( i = 0; i < siglen; i++ )
+      if( sig[i] == 'T' && shared->layouts[i] != layouts[i] )
+        break;
+    if( i == siglen ) {
+      shared->refcnt++;
+      break;
+    }
+  }
+  Ct_CLOSURES_UNLOCK;
+  if( shared != NULL )
+    return shared;
+
+  shared = (Ct_cb_cif_t*)PerlMemShared_calloc(1, sizeof(Ct_cb_cif_t));
+  shared->sig = (char*)PerlMemShared_malloc(siglen + 1);
+  Copy(sig, shared->sig, siglen, char);
+  shared->sig[siglen] = '\0';
+  shared->argtypes = (ffi_type**)PerlMemShared_malloc
+    ((siglen > 1 ? siglen - 1 : 1) * sizeof(ffi_type*));
+  for( i = 1; i < siglen; i++ )
+    shared->argtypes[i-1] = sig[i] == 'T'
+      ? &layouts[i]->type : get_ffi_type(sig[i]);
+  status = ffi_prep_cif(&shared->cif,
+                        /* Might Perl XS libs use stdcall on win32? */
+                        FFI_DEFAULT_ABI, siglen - 1,
+                        sig[0] == 'T' ? &layouts[0]->type
+                                      : get_ffi_type(sig[0]),
+                        shared->argtypes);
+  if( status != FFI_OK ) {
+    PerlMemShared_free(shared->argtypes);
+    PerlMemShared_free(shared->sig);
+    PerlMemShared_free(shared);
+    croak( "Ctypes::Callback::new error: ffi_prep_cif error %d", status );
+  }
+  if( memchr(sig, 'T', siglen) != NULL ) {
+    shared->layouts = (Ct_layout_t**)PerlMemShared_calloc
+      (siglen, sizeof(Ct_layout_t*));
+    for( i = 0; i < siglen; i++ )
+      if( sig[i] == 'T' ) {
+        shared->layouts[i] = layouts[i];
+        Ct_layout_hold(layouts[i]);
+      }
+  }
+  shared->refcnt = 1;
+  debug_warn( "#[%s:%i] New callback cif for '%s'", __FILE__, __LINE__,
+              shared->sig );
+
+  /* Another thread may have made the same one meanwhile; two entries
+     for a signature are harmless */
+  Ct_CLOSURES_LOCK;
+  shared->next = Ct_cb_cifs;
+  Ct_cb_cifs = shared;
+  Ct_CLOSURES_UNLOCK;
+  return shared;
+}
+
+/* Drop a reference to shared, freeing it with the last one */
+void
+Ct_cb_cif_release(Ct_cb_cif_t* shared) {
+  Ct_cb_cif_t** link;
+  STRLEN i;
+
+  Ct_CLOSURES_LOCK;
+  if( --shared->refcnt > 0 ) {
+    Ct_CLOSURES_UNLOCK;
+    return;
+  }
+  for( link = &Ct_cb_cifs; *link != NULL; link = &(*link)->next )
+    if( *link == shared ) {
+      *link = shared->next;
+      break;
+    }
+  Ct_CLOSURES_UNLOCK;
+  /* Ct_layout_free takes the lock itself */
+  if( shared->layouts != NULL ) {
+    for( i = 0; shared->sig[i]; i++ )
+      Ct_layout_free(shared->layouts[i]);
+    PerlMemShared_free(shared->layouts);
+  }
+  PerlMemShared_free(shared->argtypes);
+  PerlMemShared_free(shared->sig);
+  PerlMemShared_free(shared);
+}
+
+#endif  /* _INC_CLOSURES_C */
@@ -16,7 +16,13 @@ Version 0.003
 
 =cut
 
-our $VERSION = '0.003';
+our $VERSION;
+BEGIN {
+  $VERSION = '0.003';
+  # Ctypes::Type builds its type tables from XS as it loads
+  require XSLoader;
+  XSLoader::load('Ctypes', $VERSION);
+}
 
 use AutoLoader;
 use Carp;
@@ -24,6 +30,7 @@ use Config;
 use Ctypes::Type;
 use Ctypes::Type::Struct;
 use Ctypes::Type::Union;
+use Ctypes::Stub;
 use DynaLoader;
 use File::Spec;
 use Getopt::Long;
@@ -38,8 +45,8 @@ our @EXPORT = ( qw|CDLL WinDLL OleDLL PerlDLL
                   |, @Ctypes::Type::_allnames );
 our @EXPORT_OK = qw|PERL|;
 
-require XSLoader;
-XSLoader::load('Ctypes', $VERSION);
+# Not done by Ctypes::Stub itself, which Makefile.PL loads too
+Ctypes::Stub::_enable_from_env();
 
 =head1 SYNOPSIS
 
@@ -244,6 +251,61 @@ sub Union {
   return Ctypes::Type::Union->new(@_);
 }
 
+=item parallel_map FUNCTION, IN, OUT, [ threads => N ]
+
+    my $scores = Array( c_double, [ (0) x $records->scalar ] );
+    Ctypes::parallel_map( $score, $records, $scores, threads => 8 );
+
+Calls FUNCTION, a L<Ctypes::Function> taking one argument, once for
+each element of the L<Array|Ctypes::Type::Array> IN, and puts the
+results in the Array OUT, whose member type must match the function's
+C<restype>. IN is split into N chunks, each called on a worker thread
+of the L<call_async|Ctypes::Function/call_async> pool (which grows to
+N threads if need be) straight from IN's packed data, with no Perl
+involved until every chunk is done. N defaults to the pool's size.
+Returns OUT.
+
+The argument is each element itself when its type matches IN's
+member type, or a Struct taken by value; if it is C<p> (a pointer)
+instead, it is each element's address, so records can be passed by
+reference. The function is called concurrently, so it must be
+thread-safe. Not available on Windows.
+
+=cut
+
+sub parallel_map {
+  my( $func, $in, $out, %opts ) = @_;
+  croak("Usage: Ctypes::parallel_map( FUNCTION, IN, OUT, [ threads => N ] )")
+    unless blessed($func) and $func->isa('Ctypes::Function')
+      and blessed($in) and $in->isa('Ctypes::Type::Array')
+      and blessed($out) and $out->isa('Ctypes::Type::Array');
+  croak("Functions with paramflags can't be mapped")
+    if $func->{paramflags};
+  my $threads = $opts{threads} || Ctypes::Function->async_threads;
+  croak("parallel_map: threads must be a positive number")
+    unless looks_like_number($threads) and $threads >= 1;
+
+  my $arg = ref($func->{argtypes}) eq 'ARRAY' ? $func->{argtypes}[0] : undef;
+  my $code = !defined $arg ? ''
+    : !ref($arg) ? $arg
+    : $arg->isa('Ctypes::Type::Struct') ? 'T' : $arg->sizecode;
+  # Pointers to elements, unless the elements are pointers themselves
+  my $first = $in->{_buffer} ? undef : $in->{_rawmembers}{VALUES}[0];
+  my $byref = $code eq 'p'
+    && !( blessed($first) && $first->isa('Ctypes::Type::Simple')
+          && $first->sizecode eq 'p' ) ? 1 : 0;
+
+  my $packed = Ctypes::Function::_parallel_map
+    ( $func, $in->member_type, $in->member_size, ${$in->data}, $byref,
+      $out->member_type, int($threads) );
+  my $data = ${$out->data};
+  croak("parallel_map: out Array too short for ", $in->scalar, " results")
+    if length($packed) > length($data);
+  substr($data, 0, length($packed)) = $packed;
+  $out->_update_($data);
+  return $out;
+}
+
 =item load_library (lib, [mode])
 
 Searches the dll/so loadpath for the given library, architecture dependently.
@@ -542,7 +604,7 @@ but this function cannot be called, since the sig is missing.
 It only checks if the symbol is define inside the library.
 You can add the sig later, as in
 
-  $func->{sig} = 'cii';
+  $func->sig('cii');
 
 or call the function like
 
@@ -1297,6 +1359,8 @@ headers)
     Represents the C signed long long datatype.
     The constructor accepts an optional integer initializer
     (No) overflow checking is done.
+    Values are kept as Perl integers (IV), not doubles, in calls,
+    returns and callbacks, where your perl's IVs are 64 bits.
 
 =item * Ctypes::c_size_t
 
@@ -1313,6 +1377,7 @@ headers)
     Represents the C unsigned long long datatype.
     The constructor accepts an optional integer initializer.
     (No) overflow checking is done.
+    Values are kept as Perl unsigned integers (UV), as for c_longlong.
 
 =item * Ctypes::c_void_p
 
@@ -4,10 +4,13 @@ use strict;
 use warnings;
 use Ctypes;
 use Ctypes::Function;
+use Carp;
 
 # Public functions defined in POD order
 sub new;
 sub ptr;
+sub dispatch_pending;   # XS
+sub pending_fd;         # XS
 
 =head1 NAME
 
@@ -40,31 +43,62 @@ TODO: Description
 
 =head1 PUBLIC METHODS
 
-=head2 new ( \&coderef, sig )
+=head2 new ( \&coderef, restype, argtypes, [ threads ] )
 
 or hash-style: new ( { code => \&coderef, sig => 'iii' } )
 
 TODO: new() documentation
 
+restype and argtypes are packstyle typecode strings, or (argtypes) an
+arrayref of typecodes and Type objects. An object of a Struct subclass
+with C<_fields_> there means that Struct is passed or returned by
+value: the Perl sub gets a new object of the class for each Struct
+argument, and must return one when it is the restype.
+
+Callbacks are cheap to make and throw away. Their closures come from
+a pool, and a Callback's goes back to it when the object is destroyed,
+along with its reference to the coderef. All Callbacks with the same
+signature share a single libffi cif.
+
 =cut
 
 sub new {
   my ($class, @args) = @_;
   # Default positional args are coderef, sig.
   # Will never make sense to pass restype or argtypes positionally
-  my @attrs = qw(coderef restype argtypes);
-  our $self  =  Ctypes::Function::_get_args(@args, @attrs);
+  my @attrs = qw(coderef restype argtypes threads);
+  my $self  =  Ctypes::Function::_get_args(@args, @attrs);
 
   # Just so we don't have to continually dereference $self
   my ($coderef, $restype, $argtypes)
       = (map { \$self->{$_}; } @attrs );
 
-  $self->{sig} = $$restype . $$argtypes; # both specified packstyle strings
+  # Packstyle strings, or arrayrefs which can also hold Type objects.
+  # Structs are passed by value: 'T' in the sig, and the Struct
+  # objects go to _make_callback for their layouts.
+  my @structs;
+  $self->{sig} = '';
+  for my $type ( $$restype,
+                 ref($$argtypes) eq 'ARRAY' ? @$$argtypes : $$argtypes ) {
+    if( !ref($type) ) {
+      $self->{sig} .= $type;
+    } elsif( $type->isa('Ctypes::Type::Struct') ) {
+      $self->{sig} .= 'T';
+      push @structs, $type;
+    } else {
+      $self->{sig} .= $type->sizecode;
+    }
+  }
 
   # Call out to XS to return two pointers
   # $self->{_executable} will be the 'useful' one returned by $obj->ptr();
-  # $self->{_writable} is needed for ffi_closure_free in DESTROY
-  ( $self->{_executable}, $self->{_cb_data} ) = _make_callback( $$coderef, $self->{sig} );
+  # $self->{_cb_data} is what DESTROY gives back to the closure pool
+  my $threads = $self->{threads} || 'wait';
+  croak("Ctypes::Callback: threads must be 'wait' or 'queue', not '$threads'")
+    unless $threads eq 'wait' or $threads eq 'queue';
+  ( $self->{_executable}, $self->{_cb_data} )
+    = _make_callback( $$coderef, $self->{sig}, $threads eq 'queue',
+                      @structs );
 
   if(!$self->{_executable}) { die( "Oh no! No executable address!"); }
   if(!$self->{_cb_data}) { die( "No callback data! Memoryleak-tastic!" ); }
@@ -72,6 +106,35 @@ sub new {
   return bless $self, $class;
 }
 
+=head3 Calls from other threads
+
+A Callback may be called from threads the C library started itself,
+or from L<Ctypes::Function/call_async>'s workers. Perl can only run it
+on the thread which made it, so such calls are queued for that
+thread, which runs them when it calls L</dispatch_pending>, or while
+it waits on a C<call_async> handle. The fourth argument, or the
+C<threads> option, says what the calling thread does meanwhile:
+
+=over
+
+=item wait
+
+The default: it blocks until the callback has been run, and gets its
+return value.
+
+=item queue
+
+It returns at once, with 0 (or a zeroed Struct) for a return value;
+the arguments are copied, strings included, for when the callback
+is run. For notifications whose return value doesn't matter.
+
+=back
+
+Something must run the queue, or waiting threads wait for ever: a C
+call which starts threads and waits for them to call back can't be
+made with an ordinary call from the Callback's thread. Make it with
+C<call_async> instead.
+
 =head2 ptr()
 
 TODO: ptr documentation
@@ -80,4 +143,22 @@ TODO: ptr documentation
 
 sub ptr { return shift->{_executable} };
 
+=head1 FUNCTIONS
+
+=head2 dispatch_pending()
+
+Runs the calls other threads have made to this thread's Callbacks,
+oldest first, and returns how many there were. If one dies, the
+error passes through and the rest are run on the next call.
+
+=head2 pending_fd()
+
+A file descriptor which becomes readable when calls are waiting for
+L</dispatch_pending>, for an event loop's I/O watcher. Don't read
+from it; C<dispatch_pending> does that.
+
+Neither is available on Windows.
+
+=cut
+
 1;
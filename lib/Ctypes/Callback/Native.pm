@@ -0,0 +1,122 @@
+package Ctypes::Callback::Native;
+
+use strict;
+use warnings;
+use Carp;
+use Ctypes;
+
+# Public functions defined in POD order
+sub compare;
+sub desc;
+sub ptr;
+
+=head1 NAME
+
+Ctypes::Callback::Native - Comparators for qsort and friends that stay in C
+
+=head1 SYNOPSIS
+
+    use Ctypes;
+    use Ctypes::Callback::Native;
+
+    # struct { char name[8]; int size; } recs[n], by size
+    my $by_size = Ctypes::Callback::Native->compare( c_int, offset => 8 );
+    $qsort->( \$recs, $n, 12, $by_size->ptr );
+
+    # largest first
+    my $biggest = Ctypes::Callback::Native->desc( c_int, offset => 8 );
+
+    # bsearch for a bare int key in the sorted records
+    my $find = Ctypes::Callback::Native->compare
+      ( c_int, offset => 8, key_offset => 0 );
+    my $key = pack( 'i', 42 );
+    my $rec = $bsearch->( \$key, \$recs, $n, 12, $find->ptr );
+
+=head1 DESCRIPTION
+
+A L<Ctypes::Callback> calls into Perl every time C calls it, which is
+most of the cost of sorting with one. Usually all the comparison does
+is compare one field of the two elements. The objects here are C
+function pointers which do just that, in C: they take two pointers to
+elements, compare the field of each at a given offset and return
+-1, 0 or 1, as C<qsort>, C<bsearch>, C<lfind>, C<tsearch> and the
+like expect.
+
+Since they never touch Perl, any thread may call them. Comparing
+fields at offset 0 (arrays of numbers or strings) uses a function
+compiled into Ctypes; other offsets go through a libffi closure from
+the same pool as Callbacks'.
+
+=head1 CLASS METHODS
+
+=head2 compare ( TYPE, [ offset => N, key_offset => N, length => N ] )
+
+A comparator for fields of TYPE at byte offset C<offset> (default 0)
+in each element. TYPE is a L<Ctypes::Type::Simple> object such as
+C<c_int> or C<c_double>, or its sizecode; a C<c_void_p> compares the
+addresses themselves. It may also be one of:
+
+=over
+
+=item string
+
+The field is a C<char*>, and the strings it points to are compared
+with C<strcmp>. NULL pointers come first.
+
+=item chars
+
+The field is an inline C<char> array of C<length> bytes, compared
+with C<strncmp>.
+
+=back
+
+C<key_offset> is where the field is in the comparator's first
+argument, when that isn't laid out like the second: C<bsearch> passes
+its key first, so C<< key_offset => 0 >> searches with a key which is
+a bare value of TYPE.
+
+=head2 desc ( TYPE, [ OPTIONS ] )
+
+The same as L</compare>, but sorting largest first.
+
+=cut
+
+my %special = ( string => 'z', chars => 'a' );
+
+sub compare {
+  my $class = shift;
+  my $type = shift;
+  croak("Usage: $class->compare( TYPE, [ offset => N, ... ] )")
+    if !defined $type or @_ % 2;
+  my %opts = @_;
+  my $code = ref($type) ? $type->sizecode
+           : exists $special{$type} ? $special{$type}
+           : $type;
+  croak("Ctypes::Callback::Native: unknown type '$code'")
+    if length($code) != 1;
+  my $offset = $opts{offset} || 0;
+  my $key_offset = defined $opts{key_offset} ? $opts{key_offset} : $offset;
+  my $self = { type => $type, offset => $offset, key_offset => $key_offset,
+               length => $opts{length} || 0, desc => $opts{desc} ? 1 : 0 };
+  ( $self->{_executable}, $self->{_cb_data} )
+    = _make_compare( $code, $self->{desc}, $offset, $key_offset,
+                     $self->{length} );
+  return bless $self, $class;
+}
+
+sub desc {
+  my( $class, $type, @opts ) = @_;
+  return $class->compare( $type, @opts, desc => 1 );
+}
+
+=head1 METHODS
+
+=head2 ptr()
+
+The comparator's address, to pass wherever C wants the function.
+
+=cut
+
+sub ptr { return shift->{_executable} };
+
+1;
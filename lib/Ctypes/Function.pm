@@ -10,6 +10,13 @@ use Carp;
 # Public functions defined in POD order
 sub new;
 sub update;
+sub attach;
+sub call_many;
+sub call_async;
+sub async_threads;
+sub tier;              # XS
+sub calls;             # XS
+sub promote_after;
 sub sig;
 sub abi_default;
 
@@ -36,6 +43,10 @@ Version 0.002
                                        restype  => 'i' } );
     $result = $toupper->(ord("y"));
 
+    # or install it as a plain sub, skipping call() altogether
+    $toupper->attach('mylib::toupper');
+    $result = mylib::toupper(ord("y"));
+
 =head1 DESCRIPTION
 
 Ctypes::Function objects abstracts the raw Ctypes::call() API.
@@ -47,17 +58,20 @@ See L<Ctypes::DLL>.
 
 =cut
 
-# TODO:
-# - namespace install feature from P5NCI
-
 ################################
 #   PRIVATE FUNCTIONS & DATA   #
 ################################
 
 # Private functions defined alphabetically
 sub AUTOLOAD;
+sub _attach;           # XS
 sub _call;             # XS
+sub _call_many;        # XS
+sub _call_async;       # XS
+sub _async_threads;    # XS
 sub _call_overload;
+sub _clear_plan;       # XS
+sub _thunked;          # XS
 sub _form_sig;
 sub _get_args;
 
@@ -71,6 +85,8 @@ sub PF_INDEF0 () { 4; }
 my $_setable = { name => 1, sig => 1, abi => 1,
 		 restype => 1, argtypes => 1, lib => 1,
 		 errcheck => 1, callable => 1, ArgumentError => 1};
+# Changing any of these invalidates the compiled call plan
+my $_replan = { sig => 1, abi => 1, restype => 1, argtypes => 1, func => 1 };
 # For abi_default():
 my $_default_abi = ($^O eq 'MSWin32' ? 's' : 'c' );
 
@@ -84,6 +100,7 @@ sub AUTOLOAD {
       my $self = shift;
       if($_setable->{$mem}) {
         if(@_) {
+          _clear_plan($self) if $_replan->{$mem};
           return $self->{$mem} = $_[0];
         }
         if( defined $self->{$mem} ) {
@@ -310,7 +327,7 @@ sub call {
 # Do conversions of args we can't understand...
   for(@callargs) {
     my $converted;
-    if( ref($_) and blessed($_) and ref($_) !~ /Ctypes::Type/ ) {
+    if( ref($_) and blessed($_) and !$_->isa('Ctypes::Type') ) {
       if( $_->can("_as_param_") ) {
         $converted = $_->_as_param_();
         if( ref($converted) and ref($converted) !~ /Ctypes::Type/ ) {
@@ -352,7 +369,10 @@ sub _form_sig {
   my @sig_parts;
   $sig_parts[0] = $self->{abi} or abi_default();
   if( ref($self->{restype}) ) {
-    if( ref($self->{restype}) =~ /Ctypes::Type/ ) {
+    if( blessed($self->{restype})
+        and $self->{restype}->isa('Ctypes::Type::Struct') ) {
+      $sig_parts[1] = 'T';  # by value
+    } elsif( ref($self->{restype}) =~ /Ctypes::Type/ ) {
       $sig_parts[1] = $self->{restype}->sizecode;
     } else {
       return undef; # Can't take typecodes for non Type objects
@@ -363,9 +383,10 @@ sub _form_sig {
   }
   if(defined $self->{argtypes}) {
     for(my $i = 0; $i<=$#{$self->{argtypes}} ; $i++) {
-      $sig_parts[$i+2] = ref($self->{argtypes}[$i])
-        ? $self->{argtypes}[$i]->sizecode
-        : $self->{argtypes}[$i]; # Assume valid; _check_valid_types'd in new()
+      my $type = $self->{argtypes}[$i];
+      $sig_parts[$i+2] = !ref($type) ? $type # Assume valid; _check_valid_types'd in new()
+        : $type->isa('Ctypes::Type::Struct') ? 'T'
+        : $type->sizecode;
     }
   }
   return join('',@sig_parts);
@@ -531,6 +552,20 @@ of arguments the function takes. These can be specified as type-codes
 ('i', 'd', etc.)  or with L<Ctypes>'s Type objects (c_int, c_double,
 etc.).
 
+An object of a L<Struct|Ctypes::Type::Struct> subclass with
+C<_fields_>, here or as the C<restype>, means the Struct is passed
+(or returned) by value, the way C<div()> returns a C<div_t>:
+
+  my $div = Ctypes::Function->new
+    ( { lib => 'c', name => 'div', argtypes => 'ii',
+        restype => Div_t->new } );
+  my $qr = $div->(7, 2);     # a new Div_t; $qr->{quot} is 3
+
+Arguments must then be objects of that class. libffi is given the
+class's layout, compiled once (see L<Ctypes::Type::Struct>); classes
+whose fields it can't describe croak when the Function is first called.
+C<call_many> doesn't take Structs by value.
+
 =item func
 
 An opaque reference to the function which the object represents. Can be
@@ -627,6 +662,26 @@ C<update> provides a quick way of changing many attributes of a function
 all at once. Only the function's C<lib> and C<func> references cannot
 be updated (because that wouldn't make any sense).
 
+The first call to a function compiles its signature into a call plan
+(libffi's C<ffi_cif> and type array) which is reused by every later call.
+C<update>, C<sig>, C<argtypes> and the C<restype> and C<abi> mutators
+discard it, so the next call recompiles. Assigning to the object's
+hash directly (C<< $func->{restype} = 'C' >>) doesn't, and after the
+first call goes unnoticed: use the methods, or follow such
+assignments with C<< $func->update >>, which with no arguments just
+discards the plan.
+
+Common signatures (C<i(i)>, C<d(dd)>, C<p(pL)> and so on, with the
+C<c> abi) also get a direct call: a C function, generated when Ctypes
+was built, which calls through a function pointer of exactly that
+type instead of going through C<ffi_call>. The list is set with
+C<perl Makefile.PL THUNKS=ii,dd,ppL,...> (return type first, in
+sizecodes); C<THUNKS=> builds without any. Because they call without
+a variadic prototype, don't use signatures with C<f> or C<d>
+arguments from the list for variadic functions like C<printf>.
+L<Ctypes::Stub> can build direct calls for other signatures at run
+time; it does so for a function once it is hot (see L</tier>).
+
 =cut
 
 sub update {
@@ -634,6 +689,7 @@ sub update {
   my @args = @_;
   my @want = qw(name sig restype abi argtypes);
   my $update_self = _get_args(@args, @want);
+  _clear_plan($self);
   for(@want) {
     if(defined $update_self->{$_}) {
       $self->{$_} = $update_self->{$_};
@@ -642,6 +698,186 @@ sub update {
   return $self;
 }
 
+=head2 attach( [ name ], [ { op => 1 | 'auto' } ] )
+
+Installs the function as a named Perl sub, by default C<name> in the
+caller's package. A name without C<::> is also put in the caller's
+package. Returns a reference to the new sub.
+
+The sub is a native XSUB bound to the function's compiled call plan, so
+calls to it go straight to argument conversion and C<ffi_call> without
+passing through C<call()>. Arguments must be plain scalars or
+Ctypes::Type objects. Functions with C<paramflags> can't be attached.
+
+The installed sub keeps the signature the function had when it was
+attached; changing the Function object afterwards doesn't affect it.
+
+With C<< op => 1 >>, calls to the sub compiled from then on skip
+Perl's sub call machinery altogether: each C<name(...)> call is
+compiled into a custom op which hands the arguments on the Perl stack
+straight to the call plan. There is no call frame, so the function
+doesn't show up in C<caller()> or stack traces. To benefit, attach in
+a C<BEGIN> block, before the calling code is compiled:
+
+    BEGIN { Ctypes::Function->new({ lib => 'c', name => 'labs',
+              argtypes => 'l', restype => 'l' })->attach({ op => 1 }) }
+    my $x = labs(-5);
+
+Calls made with C<&name>, through references or under the debugger
+still go through an ordinary sub call. So do calls compiled before the
+sub was redefined to something else. On perls older than 5.14 the
+option does nothing.
+
+With C<< op => 'auto' >> calls compiled from then on are made into the
+same op, but run as ordinary sub calls until the function is hot (see
+L</tier>), and skip the sub call after that. Ops are never changed
+once compiled, so as with C<< op => 1 >>, attach in a C<BEGIN> block.
+
+=cut
+
+sub attach {
+  my $self = shift;
+  my $name = ref($_[0]) eq 'HASH' ? undef : shift;
+  my $opts = ref($_[0]) eq 'HASH' ? shift : {};
+  croak("Usage: \$funcobj->attach( [ name ], [ { op => 1 | 'auto' } ] )") if @_;
+  croak("Object method") unless blessed($self)
+    and $self->isa('Ctypes::Function');
+  croak("Functions with paramflags can't be attached")
+    if $self->{paramflags};
+  $name = $self->{name} unless defined $name;
+  croak("attach needs a name for an anonymous function")
+    unless defined $name;
+  $name = caller() . "::" . $name unless $name =~ /::/;
+  my $op = !$opts->{op} ? 0 : $opts->{op} eq 'auto' ? 2 : 1;
+  return _attach($self, $name, $op);
+}
+
+=head2 call_many( COLUMNS, [ { out => $array } ] )
+
+    my $rounded = $lround->call_many( \@values );
+    $hypot->call_many( \@x, $y_array, { out => $results } );
+
+Calls the function once per row of its arguments, in a single trip
+into XS. Each column is an array reference holding one argument
+position's values, or a L<Ctypes::Type::Array>, whose packed data is
+read directly. All columns must be the same length. The compiled call
+plan is shared by every row.
+
+Returns an array reference of the results, which is empty for C<void>
+functions. If an C<out> Array is given, the results are written into
+it as native values instead, and it is returned; its member type must
+match C<restype> and it must have room for every row.
+
+As with L</attach>, functions with C<paramflags> aren't supported.
+
+=cut
+
+sub call_many {
+  my $self = shift;
+  my $opts = ref($_[-1]) eq 'HASH' ? pop : {};
+  croak("Object method") unless blessed($self)
+    and $self->isa('Ctypes::Function');
+  croak("Functions with paramflags can't be batched")
+    if $self->{paramflags};
+  my $out = $opts->{out};
+  return _call_many($self, '', @_) if !defined $out;
+
+  croak("call_many: out must be a Ctypes::Type::Array")
+    unless blessed($out) and $out->isa('Ctypes::Type::Array');
+  my $packed = _call_many($self, $out->member_type, @_);
+  my $data = ${$out->data};
+  croak("call_many: out Array too short for ", length($packed)
+        / $out->member_size, " results")
+    if length($packed) > length($data);
+  substr($data, 0, length($packed)) = $packed;
+  $out->_update_($data);
+  return $out;
+}
+
+=head2 call_async( ARGS )
+
+    my $call = $fsync->call_async( $fd );
+    ...                                   # carry on meanwhile
+    my $status = $call->result;           # waits if need be
+
+    # or from an event loop
+    my $w; $w = AnyEvent->io( fh => $call->fd, poll => 'r', cb => sub {
+      undef $w; handle( $call->result );
+    } );
+
+Calls the function on one of a pool of native worker threads, so a
+call that blocks (C<fsync>, C<getaddrinfo>, compressing a big buffer)
+doesn't hold up the Perl program. The arguments are converted as
+usual, on the calling thread, before C<call_async> returns; the
+worker only runs the call, and the return value is converted when you
+ask for it. Returns a Ctypes::Function::Async handle with these
+methods:
+
+=over
+
+=item fd
+
+A file descriptor which becomes readable when the call has finished,
+and stays readable: hand it to an event loop's I/O watcher (open it
+with C<< open(my $fh, '<&=', $call->fd) >> if the loop wants a
+handle, but don't read from it).
+
+=item ready
+
+True once the call has finished.
+
+=item wait
+
+Blocks until the call has finished.
+
+=item result
+
+Waits, then returns the function's return value (undef for C<void>).
+
+=back
+
+The handle keeps the argument SVs (and anything made from them)
+alive until it is destroyed, and destroying it waits for the call to
+finish. Strings and buffers passed by pointer are used in place, so
+don't change them while the call is running. If the function calls
+a L<Ctypes::Callback>, the call is run on the Perl thread by C<wait>
+or C<result> (an event loop can watch
+L<Ctypes::Callback/pending_fd> as well). As with L</attach>,
+functions with C<paramflags> aren't supported, and C<errcheck> isn't
+run.
+
+The pool is started on first use and is shared by the whole process;
+L</async_threads> sets its size. Not available on Windows, where
+C<call_async> croaks.
+
+=cut
+
+sub call_async {
+  my $self = shift;
+  croak("Object method") unless blessed($self)
+    and $self->isa('Ctypes::Function');
+  croak("Functions with paramflags can't be called asynchronously")
+    if $self->{paramflags};
+  my( $job, $held ) = _call_async($self, @_);
+  return bless { _job => $job, _held => $held, func => $self },
+    'Ctypes::Function::Async';
+}
+
+=head2 async_threads( [ N ] )
+
+Class method getting or setting the number of worker threads for
+L</call_async> (4 by default). More are started if it's raised after
+the pool is running, but it can't be shrunk.
+
+=cut
+
+sub async_threads {
+  shift if defined $_[0] and $_[0] eq __PACKAGE__;
+  croak("Usage: Ctypes::Function->async_threads( [ N ] )")
+    if @_ > 1 or ( @_ and !( looks_like_number($_[0]) and $_[0] >= 1 ) );
+  return _async_threads(@_ ? int($_[0]) : 0);
+}
+
 =head2 sig('cii')
 
 A self-explanatory get/set method, only listed here to point out that
@@ -659,6 +895,7 @@ sub sig {
   die("Too many arguments") if @_;
   die("Object method") if ref($self) ne 'Ctypes::Function';
   if(defined $arg) {
+    _clear_plan($self);
     $self->{abi} = substr($arg, 0, 1);
     $self->{restype} = substr($arg, 1, 1);
     $self->{argtypes} = [ split(//, substr($arg, 2)) ];
@@ -685,6 +922,7 @@ sub argtypes : lvalue method {
   croak("Usage: \$funcobj->argtypes") if ref($self) ne 'Ctypes::Function';
   my $new_argtypes;
   if(@_) {
+    _clear_plan($self);
     # if we got an offset...
     if(looks_like_number($_[1])) {
       croak("Usage: argtypes( \$arrayref, <offset> )") if exists $_[2];
@@ -707,6 +945,77 @@ sub argtypes : lvalue method {
 
 
 
+=head2 tier
+
+=head2 calls
+
+    Ctypes::Function->promote_after(500);
+    ...
+    printf "%s: %s after %d calls\n", $f->name, $f->tier, $f->calls;
+
+Each function counts its calls. When the count reaches the
+L</promote_after> threshold the function is I<promoted>: its call
+plan moves to the fastest path it can take, and stays there until
+the plan is discarded (see L</update>). C<tier> says which path that
+is:
+
+=over
+
+=item none
+
+Not called yet; there is no call plan.
+
+=item cif
+
+The compiled plan is called through libffi's C<ffi_call>.
+
+=item direct
+
+Calls go straight through a function pointer of the right type: a
+thunk built with Ctypes, or once the function is hot, a stub from
+L<Ctypes::Stub> if that is enabled.
+
+=item op
+
+Some calls to the L<attached|/attach> sub run as a custom op, either
+because it was attached with C<< op => 1 >> or because it was attached
+with C<< op => 'auto' >> and became hot.
+
+=back
+
+C<calls> returns the count, which includes the calls of attached subs
+and rows of L</call_many>. With threads the count is approximate.
+
+=head2 promote_after( [ N ] )
+
+Get or set the number of calls after which a function is promoted.
+Called as a class method, sets the default for all functions,
+C<$Ctypes::Function::PROMOTE_AFTER> (1000); on an object it
+overrides that for the one function, and undef goes back to the
+default. 0 promotes as soon as the call plan is compiled, and a
+negative number never. The threshold is read when the plan is
+compiled, so setting it on an object discards its plan.
+
+=cut
+
+our $PROMOTE_AFTER = 1000;
+
+sub promote_after {
+  my $self = shift;
+  croak("Usage: promote_after( [ N ] )") if @_ > 1
+    or ( defined $_[0] and !looks_like_number($_[0]) );
+  if( !blessed($self) ) {
+    $PROMOTE_AFTER = $_[0] if @_;
+    return $PROMOTE_AFTER;
+  }
+  if( @_ ) {
+    _clear_plan($self);
+    $self->{promote_after} = $_[0];
+  }
+  return defined $self->{promote_after}
+    ? $self->{promote_after} : $PROMOTE_AFTER;
+}
+
 =head2 abi_default( [ 'c' | $^O ] )
 
 Also hash-style: abi_default( [ { abi => <char> | os => $^O } ] )
@@ -0,0 +1,273 @@
+package Ctypes::Stub;
+use strict;
+use warnings;
+use Carp;
+use Config;
+use Digest::MD5 qw|md5_hex|;
+use DynaLoader;
+use File::Path qw|mkpath|;
+use File::Spec;
+
+# Loaded by Makefile.PL too, to generate Ctypes_call_thunks.h, so
+# nothing here may need the XS half of Ctypes until a stub is loaded,
+# nor do anything just by being loaded.
+
+=head1 NAME
+
+Ctypes::Stub - Direct-call stubs for any signature, compiled at run time
+
+=head1 SYNOPSIS
+
+    use Ctypes;
+    Ctypes::Stub->enable;                 # or PERL_CTYPES_STUBS=1
+    my $strtol = Ctypes::Function->new
+      ( { lib => 'c', name => 'strtol', argtypes => 'ppi', restype => 'l' } );
+    $strtol->("42", 0, 10);               # first use builds ct_c_lppi.so
+
+=head1 DESCRIPTION
+
+Signatures in Makefile.PL's C<THUNKS> list are called through a
+direct call compiled into Ctypes itself. With stubs enabled, a
+function whose argtypes are set but whose signature isn't in that list
+gets one too: the first time its call plan is compiled, Ctypes writes
+the same few lines of C for the signature, builds them into a shared
+library with the compiler and flags perl was built with, loads it and
+uses it for every function with that signature from then on.
+
+The libraries are kept in a cache directory, one per signature and
+abi, so later processes only have to load them. Since loading one
+runs its code, the directory is made readable by its owner only, and
+neither it nor a library in it is used unless it belongs to the
+effective user and can't be written by anyone else. Each is named for, and
+carries, a hash of its source and of what it was built with (compiler,
+flags, architecture, libffi's C<ffi_arg>): one built for anything else
+is never loaded, and a new one is built alongside it. If anything goes
+wrong (no compiler, say) the function is called through libffi as
+usual, with a warning.
+
+Only the default C<c> abi gets stubs, and never Structs passed by
+value. Functions without argtypes don't trigger a build, but use
+stubs already loaded for their signature.
+
+=head1 CLASS METHODS
+
+=over
+
+=item enable [ dir => DIR ]
+
+Turns stub building on, caching them in DIR. The default is
+F<perl-ctypes/ARCHNAME> under C<$XDG_CACHE_HOME> or F<~/.cache>;
+with neither C<XDG_CACHE_HOME> nor C<HOME> set there's no default,
+rather than one in a shared temporary directory. Croaks if DIR can't
+be made, or isn't safe to load code from (see above). Setting the
+environment variable C<PERL_CTYPES_STUBS> to 1, or to a directory,
+enables them when Ctypes is loaded, or warns why it can't.
+
+=item disable
+
+Stops building and loading more stubs. Those already loaded stay in
+use.
+
+=item dir
+
+The cache directory, or undef while stubs are disabled.
+
+=back
+
+=cut
+
+# Stubs are built while this is set; read by the XS when a plan is
+# compiled (see stubs.c)
+our $DIR;
+my %tried;
+
+sub enable {
+  my $class = shift;
+  croak("Usage: Ctypes::Stub->enable( [ dir => DIR ] )") if @_ % 2;
+  my %opts = @_;
+  my $dir = $opts{dir} || _default_dir();
+  croak("Ctypes::Stub: no cache directory: set HOME or XDG_CACHE_HOME, "
+        . "or pass dir") unless defined $dir;
+  eval { mkpath( $dir, 0, 0700 ) unless -d $dir; };
+  croak("Ctypes::Stub: can't create $dir: $@") if $@ or !-d $dir;
+  croak("Ctypes::Stub: $dir must belong to you, and be writable by "
+        . "nobody else") unless _trusted($dir);
+  %tried = ();
+  return $DIR = $dir;
+}
+
+sub disable { undef $DIR; return; }
+
+sub dir { return $DIR; }
+
+# PERL_CTYPES_STUBS, when Ctypes is loaded
+sub _enable_from_env {
+  my $env = $ENV{PERL_CTYPES_STUBS} or return;
+  eval { __PACKAGE__->enable( $env eq '1' ? () : ( dir => $env ) ) };
+  carp("PERL_CTYPES_STUBS ignored: $@") if $@;
+}
+
+# Never a shared temporary directory: anyone could put a library there
+sub _default_dir {
+  my $base = $ENV{XDG_CACHE_HOME}
+    || ( $ENV{HOME} && File::Spec->catdir( $ENV{HOME}, '.cache' ) )
+    or return undef;
+  return File::Spec->catdir( $base, 'perl-ctypes', $Config{archname} );
+}
+
+# PATH
+# Whether PATH is the effective user's and writable by nobody else, so
+# what's loaded from it is what we built. Directories are judged by
+# what they point to; libraries mustn't be symlinks at all. Windows
+# doesn't report ownership or permissions that way.
+sub _trusted {
+  my $path = shift;
+  my @st;
+  if( -d $path ) {
+    @st = stat _;
+  } else {
+    @st = lstat $path or return 0;
+    return 0 if -l _;
+  }
+  return 1 if $^O eq 'MSWin32';
+  return $st[4] == $> && !( $st[2] & 022 );
+}
+
+# sizecode => C type
+my %ctype = ( c => 'signed char', C => 'unsigned char', s => 'short',
+              S => 'unsigned short', i => 'int', I => 'unsigned int',
+              l => 'long', L => 'unsigned long', q => 'long long',
+              Q => 'unsigned long long', f => 'float', d => 'double',
+              D => 'long double', p => 'void*', v => 'void' );
+
+# SIG NAME ARG SARG
+# C source of a thunk called NAME for SIG (return sizecode, then
+# argument sizecodes), without a storage class. Integer returns
+# smaller than ffi_arg are widened to ARG, or SARG if signed, as
+# libffi does.
+sub _thunk_source {
+  my( $sig, $name, $arg, $sarg ) = @_;
+  my( $ret, @args ) = split //, $sig;
+  croak("Bad thunk signature '$sig'")
+    if !defined $ret or !exists $ctype{$ret}
+       or grep { !exists $ctype{$_} or $_ eq 'v' } @args;
+  my $proto = join(', ', map { $ctype{$_} } @args) || 'void';
+  my $call = "(($ctype{$ret} (*)($proto))fn)("
+    . join(', ', map { "*($ctype{$args[$_]}*)args[$_]" } 0..$#args) . ")";
+  my $body;
+  if( $ret eq 'v' ) {
+    $body = "  $call;\n  (void)rvalue;";
+  } elsif( $ret =~ /[cCsSiIlLqQ]/ ) {
+    my $wide = $ret =~ /[csilq]/ ? $sarg : $arg;
+    $body = "  $ctype{$ret} r = $call;\n"
+      . "  if( sizeof(r) < sizeof($arg) ) *($wide*)rvalue = ($wide)r;\n"
+      . "  else *($ctype{$ret}*)rvalue = r;";
+  } else {
+    $body = "  *($ctype{$ret}*)rvalue = $call;";
+  }
+  $body .= "\n  (void)args;" unless @args;
+  return "void\n$name(void* fn, void* rvalue, void** args)\n{\n$body\n}\n";
+}
+
+# C's name for libffi's ffi_arg, the size of which only the XS knows
+sub _ffi_arg {
+  my $size = Ctypes::Stub::_ffi_arg_size();
+  for( [ int => 'intsize' ], [ long => 'longsize' ],
+       [ 'long long' => 'longlongsize' ] ) {
+    return $_->[0] if ( $Config{ $_->[1] } || 0 ) == $size;
+  }
+  croak("no C integer type is as big as ffi_arg ($size bytes)");
+}
+
+# ABI SIG
+# The C source of the stub for SIG, and a hash of it and everything
+# else a built stub depends on
+sub _source {
+  my( $abi, $sig ) = @_;
+  my $arg = _ffi_arg();
+  my $src = "/* Ctypes::Stub for '$sig', abi $abi */\n"
+    . _thunk_source( $sig, 'ct_stub', "unsigned $arg", "signed $arg" );
+  my $key = md5_hex( join "\0", $abi, $sig, $src,
+                     @Config{qw|archname cc ccflags cccdlflags ld lddlflags|} );
+  return ( $src . "const char ct_stub_key[] = \"$key\";\n", $key );
+}
+
+# ABI SIG
+# The cache file for a stub. Sizecodes differ only by case, so
+# capitals are spelled out for case-insensitive filesystems.
+sub _path {
+  my( $abi, $sig ) = @_;
+  ( my $name = $sig ) =~ s/([A-Z])/_\l$1/g;
+  my $key = ( _source( $abi, $sig ) )[1];
+  return File::Spec->catfile( $DIR,
+    "ct_${abi}_$name-" . substr( $key, 0, 12 ) . ".$Config{dlext}" );
+}
+
+# ABI SIG
+# Called from the XS (Ct_stub_want) when a plan with no thunk is
+# compiled. Loads the stub for SIG, building it first if it isn't
+# cached, and registers it. Returns whether that worked.
+sub _load {
+  my( $abi, $sig ) = @_;
+  return 0 if !$DIR or $abi ne 'c' or $tried{"$abi$sig"}++;
+  my( $src, $key ) = _source( $abi, $sig );
+  my $path = _path( $abi, $sig );
+  if( !_trusted($DIR) ) {
+    carp("Ctypes::Stub: $DIR is no longer safe to load from, using libffi");
+    return 0;
+  }
+  # A library we can't trust is built over
+  my $addr = -f $path && _trusted($path) ? _open( $path, $key ) : 0;
+  if( !$addr ) {
+    $addr = eval { _build( $src, $path ); _open( $path, $key ) };
+    if( !$addr ) {
+      carp( "Ctypes::Stub: no stub for '$sig', using libffi: ",
+            $@ || DynaLoader::dl_error() || 'unknown error' );
+      return 0;
+    }
+  }
+  Ctypes::Stub::_register( $abi, $sig, $addr );
+  return 1;
+}
+
+# PATH KEY
+# The stub in PATH, if it was built from the source hashed as KEY
+sub _open {
+  my( $path, $key ) = @_;
+  my $lib = DynaLoader::dl_load_file( $path, 0 ) or return 0;
+  my $keyaddr = DynaLoader::dl_find_symbol( $lib, 'ct_stub_key' );
+  if( !$keyaddr or unpack( 'p', pack( $Config{ptrsize} == 8 ? 'Q' : 'L',
+                                      $keyaddr ) ) ne $key ) {
+    DynaLoader::dl_unload_file($lib);
+    return 0;
+  }
+  return DynaLoader::dl_find_symbol( $lib, 'ct_stub' ) || 0;
+}
+
+# SOURCE PATH
+# Compile and link the stub next to PATH, then move it into place so
+# other processes never load a half-written one.
+sub _build {
+  my( $source, $path ) = @_;
+  my $tmp = "$path.$$";
+  my( $src, $obj ) = ( "$tmp.c", "$tmp$Config{_o}" );
+  open( my $fh, '>', $src ) or croak("Can't write $src: $!");
+  print $fh $source;
+  close $fh or croak("Can't write $src: $!");
+  my @cc = ( split(' ', $Config{cc}), split(' ', $Config{ccflags}),
+             split(' ', $Config{cccdlflags}), '-c', '-o', $obj, $src );
+  my @ld = ( split(' ', $Config{ld}), split(' ', $Config{lddlflags}),
+             '-o', $tmp, $obj );
+  # Writable by nobody else whatever the umask, or it won't be loaded
+  my $umask = umask 022;
+  my $ok = system(@cc) == 0 && system(@ld) == 0;
+  umask $umask;
+  unlink $src, $obj;
+  if( !$ok or !rename( $tmp, $path ) ) {
+    unlink $tmp;
+    croak("building $path failed");
+  }
+  return $path;
+}
+
+1;
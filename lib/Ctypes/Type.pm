@@ -25,27 +25,11 @@ Ctypes::Type - Abstract base class for Ctypes Data Type objects
 =cut
 
 
-# typecode => name
-#   sizecode //= packcode
-#   packcode //= typecode
+# typecode => { name, sizecode, packcode, size, align }
+# Both tables are generated from the type descriptors in util.c, which
+# are also what sizeof(), argument conversion and validation read.
 
-our $_perltypes =
-{
-  v => { name => 'c_void' },
-  b => { name => 'c_byte' },
-  C => { name => 'c_char' },
-  c => { name => 'c_byte' }, # same as b, but compatible to pack-style c
-  s => { name => 'c_short' },
-  S => { name => 'c_ushort', sizecode => 's' },
-  i => { name => 'c_int' },
-  I => { name => 'c_uint', sizecode => 'i' },
-  l => { name => 'c_long' },
-  L => { name => 'c_ulong', sizecode => 'l' },
-  f => { name => 'c_float' },
-  d => { name => 'c_double' },
-  D => { name => 'c_longdouble' },
-  p => { name => 'c_void_p' },
-};
+our $_perltypes = _types_table(1);
 
 # c_char c_wchar c_byte c_ubyte c_short c_ushort c_int c_uint c_long c_ulong
 # c_longlong c_ulonglong c_float c_double c_longdouble c_char_p c_wchar_p
@@ -54,32 +38,10 @@ our $_perltypes =
 # implemented as aliases:
 # c_int8 c_int16 c_int32 c_int64 c_uint8 c_uint16 c_uint32 c_uint64
 
-our $_pytypes =
-{
-  b => { name => 'c_byte',  packcode => 'c' },
-  B => { name => 'c_ubyte', packcode => 'C', sizecode => 'c' },
-  X => { name => 'c_bstr' },        # a?
-  c => { name => 'c_char' },        # single character, c signed, possibly a multi-char (?)
-  C => { name => 'c_uchar' },
-  s => { name => 'c_char_p' },      # null terminated string, A?
-  w => { name => 'c_wchar' },       # U
-  z => { name => 'c_wchar_p' },     # U*
-  h => { name => 'c_short', packcode => 's' },
-  H => { name => 'c_ushort', packcode => 'S' },
-  i => { name => 'c_int' },                   # Alias to c_long where equal; i
-  I => { name => 'c_uint', sizecode => 'i' }, # Alias to c_ulong where equal; I
-  l => { name => 'c_long' },
-  L => { name => 'c_ulong', sizecode => 'l' },
-  f => { name => 'c_float' },
-  d => { name => 'c_double' },
-  g => { name => 'c_longdouble', packcode => 'D' }, # Alias to c_double where equal, D
-  #q => { name => 'c_longlong' },
-  #Q => { name => 'c_ulonglong' },
-  v => { name => 'c_bool', packcode => 'c' },        # ?
-  O => { name => 'c_void', packcode => 'a', sizecode => 'v' }
-};
+our $_pytypes = _types_table(0);
 
 our $_types = $Ctypes::USE_PERLTYPES ? $_perltypes : $_pytypes;
+_select_types($Ctypes::USE_PERLTYPES ? 1 : 0);
 sub _types () { return $_types; }
 sub strict_input_all;
 
@@ -165,6 +127,12 @@ sub _needsfree : lvalue {
   $_[0]->{_needsfree} = $_[1] if defined $_[1]; $_[0]->{_needsfree};
 }
 
+# Owned objects pull their bytes from their owner with this.
+# INDEX LENGTH; Structs override it to read their buffer in place.
+sub _fetch_bytes {
+  return substr( ${$_[0]->data}, $_[1], $_[2] );
+}
+
 #
 # Create global c_<type> functions, classes, and reverse lookup by name => tc
 #
@@ -322,17 +290,14 @@ sub typecode { $_[0]->{_typecode} }
 #sub packcode { $_[0]->{_typecode} }
 #sub sizecode { $_[0]->{_typecode} }
 
-=item validate
+=item validate VALUE, TYPECODE
 
-Calls the _hook_store() callback method, which checks types and limits on write.
+Checks VALUE against the limits of TYPECODE. Returns an error message
+(undef if VALUE is fine) and the converted value. Implemented in XS,
+which is loaded before this module.
 
 =cut
 
-sub validate {
-  my $self = shift;
-  $self->_hook_store(@_);
-}
-
 =back
 
 =head1 CLASS FUNCTIONS
@@ -364,12 +329,13 @@ for how to do this to individual objects
 
 =item sub is_a_number
 
+True if the argument holds a numeric value (not merely a string that
+looks like one). Implemented in XS.
+
 =back
 
 =cut
 
-sub is_a_number { looks_like_number(shift) }
-
 =head1 SEE ALSO
 
 L<Ctypes::Type::Simple>
@@ -3,12 +3,13 @@ use strict;
 use warnings;
 use Carp;
 use Ctypes::Util qw|_debug|;
-use Scalar::Util qw|looks_like_number|;
+use Scalar::Util qw|blessed looks_like_number weaken|;
 use overload '@{}'    => \&_array_overload,
              '${}'    => \&_scalar_overload,
              fallback => 'TRUE';
 
 our @ISA = qw|Ctypes::Type|;
+our @CARP_NOT = qw|Ctypes::Type::Array::members|;
 
 =head1 NAME
 
@@ -72,6 +73,15 @@ sub _arg_to_type {
   return $out;
 }
 
+# The value of an object given for an element of a buffered Array
+sub _arg_value {
+  my( $arg, $type ) = @_;
+  my $val = blessed($arg) ? _arg_to_type( $arg, $type ) : undef;
+  croak( "Cannot put " . ref($arg) . " into Array of ", $type->name )
+    if not defined $val;
+  return ${$val};
+}
+
 # Scenario A: We've been told what type to make the array
 #   Cast all inputs to that type.
 sub _get_members_typed {
@@ -163,6 +173,170 @@ sub _get_members_untyped {
   return $members;
 }
 
+# Arrays of numbers and characters keep their elements in _data
+# alone, packed by the XS _buf_* functions with this packcode; other
+# Arrays hold an object per element. Undef if TYPE can't be buffered.
+sub _buffer_code {
+  my $type = shift;
+  return undef unless blessed($type) and $type->isa('Ctypes::Type::Simple');
+  my $code = $type->packcode;
+  return $code =~ /^[cCsSiIlLqQfdD]$/ ? $code : undef;
+}
+
+sub _new_buffered {
+  my( $class, $deftype, $length ) = @_;
+  my $name = $deftype->name;
+  $name =~ s/^c_//;
+  my $self = $class->_new( {
+    _name         => lc($name) . '_Array',
+    _typecode     => 'p',
+    _sizecode     => 'p',
+    _can_resize   => 1,
+    _endianness   => '',
+    _length       => $length,
+    _member_type  => $deftype->typecode,
+    _member_size  => $deftype->size,
+    _buffer       => _buffer_code($deftype),
+    _chars        => $deftype->isa('Ctypes::Type::c_char')
+                       || $deftype->isa('Ctypes::Type::c_uchar') ? 1 : 0,
+  } );
+  $self->{_size} = $deftype->size * $length;
+  $self->{_data} = "\0" x $self->{_size};
+  $self->{_rawmembers} =
+    tie @{$self->{_members}}, 'Ctypes::Type::Array::members', $self;
+  return $self;
+}
+
+# Arrays of Structs with class layouts can keep just _data too, each
+# element a Struct view of its part of it made when it's asked for
+sub _new_records {
+  my( $class, $record, $length ) = @_;
+  my $size = Ctypes::Type::Struct::_Layout::of($record)->{_size};
+  my $name = $record;
+  $name =~ s/.*:://;
+  my $self = $class->_new( {
+    _name         => lc($name) . '_struct_Array',
+    _typecode     => 'p',
+    _sizecode     => 'p',
+    _can_resize   => 0,
+    _endianness   => '',
+    _length       => $length,
+    _member_type  => 'p',
+    _member_size  => $size,
+    _records      => $record,
+  } );
+  $self->{_size} = $size * $length;
+  $self->{_data} = "\0" x $self->{_size};
+  $self->{_rawmembers} =
+    tie @{$self->{_members}}, 'Ctypes::Type::Array::members', $self;
+  return $self;
+}
+
+# The Struct class TYPE is or names, if it has _fields_
+sub _record_class {
+  my $type = shift;
+  my $class = blessed($type) ? ref($type) : $type;
+  return undef if not defined $class or ref($class)
+                  or not $class->isa('Ctypes::Type::Struct');
+  no strict 'refs';
+  return defined ${"${class}::_fields_"} ? $class : undef;
+}
+
+sub _record {
+  my( $self, $index ) = @_;
+  my $record = $self->{_records}->_view_build;
+  $record->_view( \$self->{_data}, $index * $self->{_member_size},
+                  $self->{_member_size} );
+  return $record;
+}
+
+# An Array of COUNT TYPEs, or as many as fit in AVAILABLE bytes, for
+# view and from_address to point at memory
+sub _new_view {
+  my( $class, $type, $count, $available ) = @_;
+  my $record = _record_class($type);
+  croak( "Arrays can only view numbers, characters or Structs with ",
+         "_fields_" )
+    unless defined $record or defined _buffer_code($type);
+  my $size = defined $record
+    ? Ctypes::Type::Struct::_Layout::of($record)->{_size} : $type->size;
+  if( not defined $count ) {
+    croak("Nothing to view") if $available < 0;
+    $count = int( $available / $size );
+  }
+  my $self = defined $record ? $class->_new_records( $record, $count )
+                             : $class->_new_buffered( $type, $count );
+  $self->{_view} = 1;
+  $self->{_can_resize} = 0;
+  # Views hold on to the memory they view until they go, so their tie
+  # mustn't keep them: its FETCH and STORE die once the Array is gone
+  weaken( $self->{_rawmembers}->{object} );
+  return $self;
+}
+
+# Put VALUES (a scalar or arrayref) into the buffer from element START,
+# complaining about ones which don't fit as Simple's STORE would.
+# Objects among them are turned into their values only when _buf_store
+# turns them down, so plain numbers never take a pass through Perl.
+sub _store_values {
+  my( $self, $start, $values ) = @_;
+  my( $bad, $why, $count, $fatal ) =
+    _buf_store( $self->{_data}, $self->{_buffer}, $start, $values,
+                Ctypes::Type::strict_input_all() );
+  if( $fatal and ref($values) eq 'ARRAY'
+      and ref($values->[$bad]) and $why eq 'cannot take references' ) {
+    my $type = Ctypes::Type::Simple->new( $self->{_member_type} );
+    $values = [ map { ref($_) ? _arg_value($_, $type) : $_ } @$values ];
+    ( $bad, $why, $count, $fatal ) =
+      _buf_store( $self->{_data}, $self->{_buffer}, $start, $values,
+                  Ctypes::Type::strict_input_all() );
+  }
+  if( defined $bad ) {
+    my $got = ref($values) eq 'ARRAY' ? $values->[$bad] : $values;
+    my $msg = $self->{_name} . ": " . $why . " (got "
+      . ( defined $got ? $got : 'undef' ) . " at index " . ($start + $bad)
+      . ( $count > 1 ? ", and " . ($count - 1) . " more" : '' ) . ")";
+    $fatal ? croak($msg) : carp($msg);
+  }
+  $self->_update_upstream;
+  return 1;
+}
+
+# Owners take all of our data at our _index: Unions, for one, take
+# what they're given as the whole of a member
+sub _update_upstream {
+  my $self = shift;
+  return 1 unless $self->{_owner};
+  return $self->{_owner}->_update_( $self->{_data}, $self->{_index} )
+    || croak( $self->{_name}, ": Error updating member in owner object ",
+              $self->{_owner}->{_name} );
+}
+
+sub _resize {
+  my( $self, $length ) = @_;
+  croak("Max index ", $self->{_length} - 1, "; not allowed to resize!")
+    unless $self->{_can_resize} and not $self->{_view};
+  return if $length <= $self->{_length};
+  $self->{_data} .= "\0" x ( ($length - $self->{_length})
+                             * $self->{_member_size} );
+  $self->{_length} = $length;
+  $self->{_size} = $length * $self->{_member_size};
+}
+
+# START and COUNT as slice takes them, resolved against our length
+sub _range {
+  my( $self, $start, $count ) = @_;
+  my $length = $self->{_length};
+  $start = 0 unless defined $start;
+  $start += $length if $start < 0;
+  croak("Index $start out of range for ", $self->{_name})
+    if $start < 0 or $start > $length;
+  $count = $length - $start
+    if not defined $count or $start + $count > $length;
+  $count = 0 if $count < 0;
+  return ( $start, $count );
+}
+
 sub _array_overload {
   return shift->{_members};
 }
@@ -213,6 +387,21 @@ sub new {
     $in = Ctypes::Util::_make_arrayref(@_);
   }
 
+  # Numbers (or characters) straight into the buffer
+  if( !defined $deftype and @$in and !grep { ref } @$in ) {
+    my $lcd = Ctypes::Util::_check_type_needed(@$in);
+    croak "no lcd of @$in" unless $lcd;
+    $deftype = Ctypes::Type::Simple->new($lcd);
+    undef $deftype unless defined _buffer_code($deftype);
+  }
+  if( defined _buffer_code($deftype) ) {
+    croak("Could not create Array from arguments supplied: see warnings")
+      unless @$in;
+    my $self = $class->_new_buffered( $deftype, scalar @$in );
+    $self->_store_values( 0, $in );
+    return $self;
+  }
+
   my $inputs_typed = defined $deftype ?
     _get_members_typed($deftype, $in) :
     _get_members_untyped( $in );
@@ -243,11 +432,144 @@ sub new {
   return $self;
 }
 
+=item view TYPE, SCALARREF, [ COUNT, OFFSET ]
+
+=item from_address TYPE, ADDRESS, COUNT
+
+Class methods making an Array which is a view of memory that's already
+there, rather than a copy of it: COUNT elements from byte OFFSET
+(default 0) of the string SCALARREF refers to, or at ADDRESS, such as a
+pointer returned by a C function. COUNT defaults to as many elements
+as fit in the rest of the string.
+
+TYPE is a L<Simple|Ctypes::Type::Simple> type such as C<c_int>, for an
+Array of numbers or characters, or a Struct subclass with C<_fields_>
+(its name, or an instance). In an Array of Structs, each element is
+made when it's asked for, as a Struct view of its own part of the
+memory (see L<Ctypes::Type::Struct/from_buffer>, which also says what
+becomes of the string's buffer).
+
+    my $samples = Ctypes::Type::Array->view( c_short, \$pcm );
+    my $points = Ctypes::Type::Array->view( 'POINT', \$bytes );
+    $points->[2]->values->{x} = 10;     # written into $bytes
+
+Views can't be resized. L</copy> gives an ordinary Array with its own
+copy of the data.
+
+=cut
+
+sub view {
+  my( $class, $type, $buffer, $count, $offset ) = @_;
+  croak( "Usage: $class->view( TYPE, SCALARREF, [ COUNT, OFFSET ] )" )
+    unless defined $type and ref($buffer) eq 'SCALAR';
+  $offset ||= 0;
+  my $self = $class->_new_view( $type, $count,
+                                length($$buffer) - $offset );
+  $self->_view( $buffer, $offset, $self->{_size} );
+  return $self;
+}
+
+sub from_address {
+  my( $class, $type, $address, $count ) = @_;
+  croak( "Usage: $class->from_address( TYPE, ADDRESS, COUNT )" )
+    unless defined $type and defined $address
+           and looks_like_number($address) and defined $count;
+  my $self = $class->_new_view( $type, $count );
+  $self->_view_address( $address, $self->{_size} );
+  return $self;
+}
+
+=item mmap PATH, TYPE, [ mode => 'r' | 'rw', advise => PATTERN ]
+
+Class method mapping the file at PATH into memory and returning a view
+of it (see L</view>) as an Array of as many TYPEs as fit in the file,
+usually records of a Struct class:
+
+    my $trades = Ctypes::Type::Array->mmap( 'trades.bin', 'TRADE',
+                                            advise => 'sequential' );
+    for my $i ( 0 .. $#$trades ) {
+      my $trade = $trades->[$i];      # a view at $i * TRADE size
+      ...
+    }
+
+Elements are only made when they're asked for, each a view of its own
+record, so indexing costs the same whatever the size of the file, and
+no more of it is read than is used. With C<mode> 'r' (the default) the
+Array and its elements are read-only; with 'rw', assignments to them
+are writes to the file, which other processes mapping it see. The
+file is unmapped when the Array and the last element taken from it
+are gone. To go through many records, L</cursor> is quicker still.
+
+C<advise> is passed on to L</advise>.
+
+=item advise PATTERN
+
+Tells the system how a view's memory is going to be read, with
+C<madvise>: 'sequential' (read ahead aggressively, drop pages soon
+after), 'random' (don't read ahead), 'willneed' (start reading it all
+in now) or 'normal'. Returns true if the advice was taken. Mostly of
+use for L</mmap>ed files.
+
+=cut
+
+sub mmap {
+  my( $class, $path, $type, %opts ) = @_;
+  croak( "Usage: $class->mmap( PATH, TYPE, [ mode => 'r' | 'rw' ] )" )
+    unless defined $path and defined $type;
+  my $mode = defined $opts{mode} ? $opts{mode} : 'r';
+  croak( "mmap mode must be 'r' or 'rw'" ) unless $mode =~ /^rw?$/;
+  my $map = _mmap( $path, $mode eq 'rw' ? 1 : 0 );
+  my $self = $class->_new_view( $type, undef, length $$map );
+  $self->_view( $map, 0, $self->{_size} );
+  $self->advise( $opts{advise} ) if defined $opts{advise};
+  return $self;
+}
+
+sub advise {
+  my( $self, $pattern ) = @_;
+  croak( "Usage: advise( PATTERN )" ) unless defined $pattern;
+  return _madvise( $self->{_data}, $pattern );
+}
+
+=item cursor [ INDEX ]
+
+For Arrays of Structs: a single Struct view which moves along the
+Array, rather than one made for each record. It starts before the
+first record, or at INDEX; L<next|Ctypes::Type::Struct/next> and
+L<seek|Ctypes::Type::Struct/seek> move it by pointing it at another
+record's bytes, so a scan makes no objects however many records there
+are, and reading a field reads the Array's memory where it is:
+
+    my $c = $trades->cursor;
+    while( $c->next ) {
+      $total += $$c->{qty};
+    }
+
+Don't hold on to values of Struct fields across moves expecting them
+to stay put: they're the cursor's, and follow it. Take L</member>
+for a record of your own.
+
+=cut
+
+sub cursor {
+  my( $self, $index ) = @_;
+  croak( "Only Arrays of Structs have cursors" ) unless $self->{_records};
+  croak( "Nothing for a cursor to move over" ) unless $self->{_length};
+  my $cursor = $self->{_records}->_view_build;
+  $cursor->_view( \$self->{_data}, 0, $self->{_member_size} );
+  $cursor->{_cursor} = $self;
+  $cursor->{_position} = -1;
+  $cursor->seek($index) if defined $index;
+  return $cursor;
+}
+
 =item can_resize 1 I<or> 0
 
 Get/setter for the property flagging whether or not the Array is
-allowed to expand. Defaults to 0. Unlike in C, you can't read off
-the end of an Array object into random memory.
+allowed to expand: storing past the end of an Array of numbers or
+characters grows it, unless it's a view of memory which can't grow.
+Unlike in C, you can't read off the end of an Array object into
+random memory.
 
 =item member_type
 
@@ -336,6 +658,20 @@ Return a copy of the object.
 
 sub copy {
   my $self = shift;
+  if( $self->{_buffer} ) {
+    $self->_update_ if $self->{_owner};
+    my $copy = ref($self)->_new_buffered
+      ( Ctypes::Type::Simple->new( $self->{_member_type} ),
+        $self->{_length} );
+    $copy->{_data} = $self->{_data};
+    return $copy;
+  }
+  if( $self->{_records} ) {
+    my $copy = ref($self)->_new_records( $self->{_records},
+                                         $self->{_length} );
+    $copy->{_data} = $self->{_data};
+    return $copy;
+  }
   my @arr;
   for( 0..$#$self ) {
     $arr[$_] = $self->{_rawmembers}->{VALUES}->[$_];
@@ -346,6 +682,7 @@ sub copy {
 sub data {
   my $self = shift;
   _debug( 4, "In ", $self->{_name}, "'s _DATA(), from ", join(", ",(caller(1))[0..3]), "\n"  );
+  return \$self->{_data} if $self->{_buffer} or $self->{_records};
 if( defined $self->{_data}
       and $self->_datasafe == 1 ) {
     _debug( 5, "    _data already defined and safe\n"  );
@@ -380,6 +717,107 @@ dereferencing @{} braces around the whole thing.
 
 sub scalar { return scalar @{ $_[0]->{_members} } }
 
+=item member INDEX
+
+The element at INDEX as an object: for Arrays of L<Simple|Ctypes::Type::Simple>
+types, a new one which reads and writes the Array's data in place.
+Arrays of numbers and characters keep only their packed data, and make
+element objects only when they're asked for like this; C<$$array[i]>
+gives the element's value.
+
+=cut
+
+sub member {
+  my( $self, $index ) = @_;
+  croak("Usage: member( INDEX )")
+    unless defined $index and $index =~ /^-?\d+$/;
+  $index += $self->{_length} if $index < 0;
+  croak("Index $index out of range for ", $self->{_name})
+    if $index < 0 or $index >= $self->{_length};
+  return $self->_record($index) if $self->{_records};
+  return $self->{_rawmembers}{VALUES}[$index] unless $self->{_buffer};
+  my $obj = Ctypes::Type::Simple->new( $self->{_member_type} );
+  $obj->{_owner} = $self;
+  $obj->{_index} = $index * $self->{_member_size};
+  $obj->_update_;
+  return $obj;
+}
+
+=item set_from ARRAYREF, [ START ]
+
+Assign the values in ARRAYREF to the elements from index START (default
+0) on, in one go. Values which don't fit the Array's type are warned
+about (or die, under L<strict_input_all|Ctypes::Type/strict_input_all>)
+just as when assigning them one at a time. Returns the Array.
+
+=item to_list
+
+All the elements' values.
+
+=item slice START, [ COUNT ]
+
+The values of COUNT elements (default, all the rest) from index START,
+which counts back from the end if it is negative.
+
+=item fill VALUE, [ START, COUNT ]
+
+Set COUNT elements (default, all the rest) from index START (default
+0) to VALUE. Returns the Array.
+
+For Arrays of numbers and characters these work on the packed data
+directly, never making an object per element, so they are the way to
+move large amounts of data in and out.
+
+=cut
+
+sub set_from {
+  my( $self, $values, $start ) = @_;
+  croak("Usage: set_from( ARRAYREF, [ START ] )")
+    unless ref($values) eq 'ARRAY';
+  ( $start ) = $self->_range( $start, 0 );
+  if( !$self->{_buffer} ) {
+    $self->{_members}[ $start + $_ ] = $values->[$_] for 0 .. $#$values;
+    return $self;
+  }
+  $self->_resize( $start + @$values )
+    if $start + @$values > $self->{_length};
+  $self->_store_values( $start, $values );
+  return $self;
+}
+
+sub to_list { return $_[0]->slice(0) }
+
+sub slice {
+  my $self = shift;
+  my( $start, $count ) = $self->_range(@_);
+  return map { $self->_record($_) } $start .. $start + $count - 1
+    if $self->{_records};
+  return @{$self->{_members}}[ $start .. $start + $count - 1 ]
+    unless $self->{_buffer};
+  $self->_update_ if $self->{_owner};
+  return _buf_fetch( $self->{_data}, $self->{_buffer}, $start, $count,
+                     $self->{_chars} );
+}
+
+sub fill {
+  my( $self, $value ) = ( shift, shift );
+  my( $start, $count ) = $self->_range(@_);
+  if( !$self->{_buffer} ) {
+    $self->{_members}[$_] = $value for $start .. $start + $count - 1;
+    return $self;
+  }
+  my( $bad, $why, undef, $fatal ) =
+    _buf_fill( $self->{_data}, $self->{_buffer}, $start, $count, $value,
+               Ctypes::Type::strict_input_all() );
+  if( defined $bad ) {
+    my $msg = $self->{_name} . ": $why (got "
+      . ( defined $value ? $value : 'undef' ) . ")";
+    $fatal ? croak($msg) : carp($msg);
+  }
+  $self->_update_upstream if $count;
+  return $self;
+}
+
 =back
 
 =head1 SEE ALSO
@@ -392,8 +830,15 @@ L<Ctypes>
 
 sub _as_param_ { return $_[0]->data(@_) }
 
+sub _fetch_bytes {
+  my( $self, $index, $length ) = @_;
+  $self->_update_ if $self->{_buffer} and $self->{_owner};
+  return substr( ${$self->data}, $index, $length );
+}
+
 sub _update_ {
   my($self, $arg, $index) = @_;
+  return $self->_update_buffer( $arg, $index ) if $self->{_buffer};
   _debug( 4, "In ", $self->{_name}, "'s _UPDATE_, from ", join(", ",(caller(0))[0..3]), "\n"  );
   _debug( 4, "  self is: ", $self, "\n"  );
   _debug( 4, "  current data looks like:\n", unpack('b*',$self->{_data}), "\n"  );
@@ -402,9 +847,8 @@ sub _update_ {
   _debug( 4, "  and index is: $index\n") if $index;
   if( not defined $arg ) {
     if( $self->{_owner} ) {
-    $self->{_data} = substr( ${$self->{_owner}->data},
-                             $self->{_index},
-                             $self->{_size} );
+    $self->{_data} = $self->{_owner}->_fetch_bytes( $self->{_index},
+                                                    $self->{_size} );
     }
   } else {
     if( $index ) {
@@ -453,6 +897,28 @@ sub _update_ {
   return 1;
 }
 
+# Nothing but _data to keep up to date: reread it from an owner, or
+# write ARG into it at byte INDEX and pass it on up
+sub _update_buffer {
+  my( $self, $arg, $index ) = @_;
+  if( not defined $arg ) {
+    $self->{_data} = $self->{_owner}->_fetch_bytes( $self->{_index},
+                                                    $self->{_size} )
+      if $self->{_owner};
+    return 1;
+  }
+  if( defined $index ) {
+    my $pad = $index + length($arg) - length($self->{_data});
+    $self->{_data} .= "\0" x $pad if $pad > 0;
+    substr( $self->{_data}, $index, length($arg) ) = $arg;
+  } elsif( $self->{_view} ) {
+    substr( $self->{_data}, 0, length($arg) ) = $arg;
+  } else {
+    $self->{_data} = $arg;
+  }
+  return $self->_update_upstream;
+}
+
 sub _datasafe {
   my( $self, $arg ) = @_;
   if( defined $arg and $arg != 1 and $arg != 0 ) {
@@ -471,6 +937,7 @@ use warnings;
 use Carp;
 use Ctypes::Type::Array;
 use Ctypes::Util qw|_debug|;
+use Scalar::Util qw|blessed|;
 
 sub TIEARRAY {
   my $class = shift;
@@ -481,9 +948,32 @@ sub TIEARRAY {
   return bless $self => $class;
 }
 
+# The Array, unless it was a view and is gone
+sub _object {
+  return $_[0]->{object}
+    || croak( "Array view used after the Array was destroyed" );
+}
+
 sub STORE {
   my( $self, $index, $arg ) = @_;
+  my $object = _object($self);
   _debug( 4, "In ", $self->{object}{_name}, "'s STORE, from ", join(", ",(caller(1))[0..3]), "\n"  );
+  if( $object->{_buffer} ) {
+    $object->_resize( $index + 1 ) if $index >= $object->{_length};
+    $arg = Ctypes::Type::Array::_arg_value( $arg,
+             Ctypes::Type::Simple->new( $object->{_member_type} ) )
+      if ref $arg;
+    return $object->_store_values( $index, $arg );
+  }
+  if( $object->{_records} ) {
+    croak("Max index ", $object->{_length} - 1, "; not allowed to resize!")
+      if $index >= $object->{_length};
+    croak( "Cannot put ", ( ref($arg) || $arg ), " into ", $object->{_name} )
+      unless blessed($arg) and $arg->isa( $object->{_records} );
+    my $size = $object->{_member_size};
+    substr( $object->{_data}, $index * $size, $size ) = ${$arg->data};
+    return $arg;
+  }
 
   if( $index > ($self->{object}{_length} - 1)
       and $self->{object}{_can_resize} = 0 ) {
@@ -551,7 +1041,18 @@ sub STORE {
 
 sub FETCH {
   my($self, $index) = @_;
+  my $object = _object($self);
   _debug( 4, "In ", $self->{object}{_name}, "'s FETCH, looking for [ $index ], called from ", join(", ",(caller(1))[0..3]), "\n"  );
+  if( $object->{_buffer} ) {
+    return undef if $index >= $object->{_length};
+    $object->_update_ if $object->{_owner};
+    return ( Ctypes::Type::Array::_buf_fetch( $object->{_data},
+               $object->{_buffer}, $index, 1, $object->{_chars} ) )[0];
+  }
+  if( $object->{_records} ) {
+    return undef if $index >= $object->{_length};
+    return $object->_record($index);
+  }
   if( defined $self->{object}{_owner}
       or $self->{object}{_datasafe} == 0 ) {
     _debug( 5, "    Can't trust data, updating...\n"  );
@@ -571,10 +1072,32 @@ sub FETCH {
   }
 }
 
-sub CLEAR { $_[0]->{VALUES} = [] }
-sub EXISTS { exists $_[0]->{VALUES}->[$_[1]] }
+# Buffered Arrays are as long as their buffer: clearing one zeroes it
+sub CLEAR {
+  my $object = _object($_[0]);
+  if( $object->{_buffer} ) {
+    $object->fill(0) if $object->{_length};
+    return;
+  }
+  if( $object->{_records} ) {
+    substr( $object->{_data}, 0 ) = "\0" x length $object->{_data};
+    return;
+  }
+  $_[0]->{VALUES} = [];
+}
+sub EXISTS {
+  my $object = _object($_[0]);
+  return $_[1] < $object->{_length}
+    if $object->{_buffer} or $object->{_records};
+  exists $_[0]->{VALUES}->[$_[1]];
+}
 sub EXTEND { }
-sub FETCHSIZE { scalar @{$_[0]->{VALUES}} }
+sub FETCHSIZE {
+  my $object = _object($_[0]);
+  return $object->{_length}
+    if $object->{_buffer} or $object->{_records};
+  scalar @{$_[0]->{VALUES}};
+}
 
 1;
 __END__
@@ -50,6 +50,26 @@ sub new {
   return bless $self => $class;
 }
 
+# A Field over bytes already in its Struct's buffer (see Struct's
+# layouts): the value object is pointed at them, nothing is written.
+sub _attach {
+  my $class = ref($_[0]) || $_[0];  shift;
+  my( $key, $val, $offset, $obj ) = ( shift, shift, shift, shift );
+  my $self  = {
+                _obj         => $obj,
+                _index       => $offset,
+                _key         => $key,
+                _contents    => undef,
+                _rawcontents => undef,
+              };
+  $self->{_rawcontents} = tie $self->{_contents},
+    'Ctypes::Type::Field::contents', $self;
+  $self->{_rawcontents}->{VALUE} = $val;
+  $val->_set_owner( $obj );
+  $val->_set_index( $offset );
+  return bless $self => $class;
+}
+
 #
 # Accessor generation - DIFFERENT to most!
 #
@@ -292,16 +292,10 @@ sub _update_ {
     if( $self->{_owner} ) {
 #    if ( $self->{_owner} and not $self->{_datasafe} == 1 ) {
       _debug( 5, "    Have owner, getting updated data...\n"  );
-      my $owners_data = ${$self->{_owner}->data};
-      _debug( 5, "    Here's where I think I am in my pwner's data:\n"  );
-      _debug( 5, " " x ($self->{_index} * 8), "v\n"  );
-      _debug( 5, "12345678" x length($owners_data), "\n"  );
-      _debug( 5, unpack('b*', $owners_data), "\n"  );
       _debug( 5, "    My index is ", $self->{_index}, "\n"  );
       _debug( 5, "    My size is ", $self->size, "\n"  );
-      $self->{_data} = substr( $owners_data,
-                               $self->{_index},
-                               $self->size );
+      $self->{_data} = $self->{_owner}->_fetch_bytes( $self->{_index},
+                                                      $self->size );
       _debug( 5, "    My data is now:\n", unpack('b*', $self->{_data}), "\n"  );
       _debug( 5, "    Which is ", unpack($self->packcode,$self->{_data}), " as a number");
       $self->{_rawvalue}->[1] = unpack($self->packcode, $self->{_data});
@@ -672,8 +666,13 @@ use Config;
 #sub sizecode{'q'};
 #sub packcode{'q'};
 sub typecode{'q'};
-sub _minmax { (-hex("8".("F" x (2*$Config{longlongsize}))),
-                hex("8".("F" x (2*$Config{longlongsize})))) }
+# Exact integer limits where Perl's IVs hold a long long
+sub _minmax {
+  return ( -2**(8*$Config{longlongsize}-1), 2**(8*$Config{longlongsize}-1) )
+    if $Config{ivsize} < $Config{longlongsize};
+  my $max = ~0 >> 1;
+  return ( -$max - 1, $max );
+}
 
 package Ctypes::Type::c_ulonglong;
 use base 'Ctypes::Type::Simple';
@@ -681,7 +680,11 @@ use Config;
 #sub sizecode{'Q'};
 #sub packcode{'Q'};
 sub typecode{'Q'};
-sub _minmax { (0, hex("F" x (2*$Config{longlongsize}))) }
+sub _minmax {
+  return ( 0, 2**(8*$Config{longlongsize}) )
+    if $Config{ivsize} < $Config{longlongsize};
+  return ( 0, ~0 );
+}
 
 package Ctypes::Type::c_bool;
 use base 'Ctypes::Type::Simple';
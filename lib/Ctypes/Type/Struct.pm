@@ -1,7 +1,7 @@
 package Ctypes::Type::Struct;
 use strict;
 use warnings;
-use Scalar::Util qw|blessed looks_like_number|;
+use Scalar::Util qw|blessed looks_like_number refaddr weaken|;
 use Ctypes::Util qw|_debug|;
 use Ctypes::Type::Field;
 use Carp;
@@ -62,10 +62,11 @@ sub _process_fields {
   for( 0 .. (( $#$fields - 1 ) / 2) ) {
     $key = shift @{$fields};
     $val = shift @{$fields};
-    if( not exists $self->{_fields}->{_hash}->{$key} ) {
+    my $field = $self->{_fields}->_named($key);
+    if( not defined $field ) {
       $self->{_fields}->_add_field($key, $val);
     } else {
-      $self->{_fields}->{_hash}->{$key}->{_contents} = $val;
+      $field->{_contents} = $val;
     }
   }
 }
@@ -136,6 +137,20 @@ Structs is not yet implemented.
 
 =back
 
+Subclasses of Struct list their fields in a package variable,
+C<_fields_>, in the same key => value form:
+
+    package POINT;
+    our @ISA = qw|Ctypes::Type::Struct|;
+    our $_fields_ = [ x => c_int, y => c_int ];
+
+The first time such a class is instantiated, its C<_fields_> are
+compiled into a layout (offsets, sizes, alignment, initial contents and
+a native description of the Struct for libffi) which all its instances
+then share. C<_fields_> is only read that once. A new instance is just
+a copy of the layout's initial buffer; the objects for its fields are
+made the first time each field is used.
+
 =cut
 
 sub new {
@@ -148,64 +163,18 @@ sub new {
   # educated guess at whether Struct was instantiated directly, or
   # via a subclass.
   # Q: What are some of the ways the following logic fails?
-  my( $progeny, $extra_fields ) = undef;
+  my( $progeny, $layout ) = undef;
   my $caller = caller;
   _debug( 5, "    caller is ", $caller, "\n" ) if $caller;
   if( $caller->isa('Ctypes::Type::Struct') ) {
     no strict 'refs';
     $progeny = $caller;
     if( defined ${"${caller}::_fields_"} ) {
-      my $_fields_ = ${"${caller}::_fields_"};
-      for( 0..$#$_fields_ ) {
-      # Can't just set = as shift() extra_fields later affects every instance
-        if( blessed( $_fields_->[$_] )
-            and $_fields_->[$_]->isa('Ctypes::Type') ) {
-          $extra_fields->[$_] = $_fields_->[$_]->copy;
-        } else {
-          $extra_fields->[$_] = $_fields_->[$_];
-        }
-      }
-      _debug( 5, "    Got these extra fields:\n" );
-      _debug( 5, join( "\n\t", @$extra_fields ) );
-      if( scalar @$extra_fields % 2 ) {
-        croak( "_fields_ must be key => value pairs!" );
-      }
+      $layout = Ctypes::Type::Struct::_Layout::of($caller);
     }
   }
 
-  # Get fields, populate with named/unnamed args
-  my $self = {
-               _fields     => undef,
-               _values     => undef,
-               _typecode_  => 'p',
-               _subclass   => $progeny,
-               _alignment  => 0,
-               _data       => '', };
-#
-# Need to do this to get a blessed Type before the following
-# two lines, so ::_Fields and ::_Values keep a reference to
-# the object, not the as-yet-unblessed hash.
-#
-  $self = $class->_new( $self );
-  $self->{_fields} = new Ctypes::Type::Struct::_Fields($self);
-  $self->{_values} = new Ctypes::Type::Struct::_Values($self);
-  #bless $self => $class;
-  #my $base = Ctypes::Type->_new;
-  #for( keys(%$base) ) {
-  #  $self->{$_} = $base->{$_};
-  #}
-  $self->{_name} = $progeny ? $progeny . '_Struct' : 'Struct';
-  $self->{_name} =~ s/.*:://;
-
-  if( $extra_fields ) {
-    my( $key, $val );
-    for( 0 .. (( $#$extra_fields - 1 ) / 2) ) {
-      $key = shift @{$extra_fields};
-      $val = shift @{$extra_fields};
-      _debug( 5, "    Adding extra field '$key'...\n" );
-      $self->{_fields}->_add_field( $key, $val );
-    }
-  }
+  my $self = _build( $class, $progeny, $layout );
 
   my $in = undef;
   if( ref($_[0]) eq 'HASH' ) {
@@ -227,11 +196,12 @@ sub new {
     $self->_process_fields($in);
   } else {
     if( ( !$progeny
-          or scalar @{$self->{_fields}} == 0 )
+          or $self->{_fields}->_count == 0 )
         and defined $_[0] ) {
       croak( "Don't know what to do with args without fields" );
     }
-    for( 0 .. $#{$self->{_fields}->{_array}} ) {
+    for( 0 .. $self->{_fields}->_count - 1 ) {
+      last unless @_;
       my $arg = shift;
       _debug( 5, "  Assigning $arg to ", $_, "\n" );
       $self->{_values}->[$_] = $arg;
@@ -242,6 +212,152 @@ sub new {
   return $self;
 }
 
+=item from_buffer SCALARREF, [ OFFSET ]
+
+=item from_address ADDRESS
+
+Class methods of Struct subclasses with C<_fields_>, making a Struct
+which is a view of memory that's already there, rather than a copy of
+it: from byte OFFSET (default 0) of the string SCALARREF refers to, or
+at ADDRESS, such as a pointer returned by a C function.
+
+    my $hdr = HEADER->from_buffer( \$packet );
+    print $$hdr->{length};          # read from $packet itself
+    $$hdr->{flags} = 1;             # written into $packet
+
+The string's buffer is never freed or moved while any view of it is
+alive, whatever becomes of the string: if it is assigned to or grows,
+it gets a new buffer of its own and the views keep the old one.
+Read-only strings, such as literals, can't be viewed: copy one into a
+variable first. Memory at ADDRESS is C's, and must outlive the Struct.
+
+=cut
+
+sub from_buffer {
+  my( $class, $buffer, $offset ) = @_;
+  croak( "Usage: $class->from_buffer( SCALARREF, [ OFFSET ] )" )
+    unless ref($buffer) eq 'SCALAR';
+  my $self = $class->_view_build;
+  $self->_view( $buffer, $offset || 0, $self->{_size} );
+  return $self;
+}
+
+sub from_address {
+  my( $class, $address ) = @_;
+  croak( "Usage: $class->from_address( ADDRESS )" )
+    unless defined $address and looks_like_number($address);
+  my $self = $class->_view_build;
+  $self->_view_address( $address, $self->{_size} );
+  return $self;
+}
+
+=item next
+
+=item seek INDEX
+
+=item position
+
+For cursors over Arrays of Structs (see L<Ctypes::Type::Array/cursor>).
+C<next> moves the cursor on to the next record and returns it, or
+returns false when there are no more. C<seek> moves it to the record
+at INDEX, which counts back from the end if it is negative, and returns
+it. C<position> is the index of the record it's at: -1 before the
+first, and the Array's length after the last.
+
+=cut
+
+sub next {
+  my $self = shift;
+  my $array = $self->{_cursor} or croak( "Only cursors can move" );
+  my $index = $self->{_position} + 1;
+  if( $index >= $array->{_length} ) {
+    $self->{_position} = $array->{_length};
+    return undef;
+  }
+  $self->_view_move( $array->{_data}, $index * $array->{_member_size} );
+  $self->{_position} = $index;
+  return $self;
+}
+
+sub seek {
+  my( $self, $index ) = @_;
+  my $array = $self->{_cursor} or croak( "Only cursors can move" );
+  croak( "Usage: seek( INDEX )" )
+    unless defined $index and $index =~ /^-?\d+$/;
+  $index += $array->{_length} if $index < 0;
+  croak( "Index $index out of range for ", $array->{_name} )
+    if $index < 0 or $index >= $array->{_length};
+  $self->_view_move( $array->{_data}, $index * $array->{_member_size} );
+  $self->{_position} = $index;
+  return $self;
+}
+
+sub position {
+  my $self = shift;
+  croak( "Only cursors have a position" ) unless $self->{_cursor};
+  return $self->{_position};
+}
+
+# A CLASS object with no data yet, for views
+sub _view_build {
+  my $class = shift;
+  croak( "Views need a Struct class with _fields_" )
+    if ref($class) or $class eq __PACKAGE__
+       or not defined do { no strict 'refs'; ${"${class}::_fields_"} };
+  my $self = _build( $class, $class,
+                     Ctypes::Type::Struct::_Layout::of($class) );
+  $self->{_view} = 1;
+  _weaken_parts($self);
+  return $self;
+}
+
+# A view holds on to the memory it views until it goes, so what's made
+# for it refers back to it only weakly: nothing but its users keep it.
+sub _weaken_parts {
+  my $self = shift;
+  weaken( $self->{_fields}->{_obj} );
+  weaken( $self->{_values}->{_obj} );
+}
+
+# A CLASS object over BYTES, for Structs coming back from C by value
+# (function returns, callback arguments). CLASS BYTES
+sub _from_bytes {
+  my( $class, $bytes ) = @_;
+  my $self = _build( $class, $class,
+                     Ctypes::Type::Struct::_Layout::of($class) );
+  $self->{_data} = $bytes;
+  return $self;
+}
+
+# The bare object: no fields, or those of LAYOUT over a copy of its
+# initial buffer. CLASS PROGENY LAYOUT
+sub _build {
+  my( $class, $progeny, $layout ) = @_;
+  my $self = {
+               _fields     => undef,
+               _values     => undef,
+               _typecode   => 'p',
+               _subclass   => $progeny,
+               _alignment  => 0,
+               _layout     => $layout,
+               _data       => '', };
+  if( $layout ) {
+    $self->{_data} = $layout->{_data};
+    $self->{_size} = $layout->{_size};
+  }
+#
+# Need to do this to get a blessed Type before the following
+# two lines, so ::_Fields and ::_Values keep a reference to
+# the object, not the as-yet-unblessed hash.
+#
+  $self = $class->_new( $self );
+  $self->{_fields} = Ctypes::Type::Struct::_Fields->new($self);
+  $self->{_values} = Ctypes::Type::Struct::_Values->new($self);
+  $self->{_name} = $progeny ? $progeny . '_Struct' : 'Struct';
+  $self->{_name} =~ s/.*:://;
+  return $self;
+}
+
 sub _as_param_ { return $_[0]->data(@_) }
 
 =item copy
@@ -255,92 +371,97 @@ sub copy {
   $self;
 }
 
+=item data
+
+Returns a reference to the Struct's native data. A Struct which isn't
+part of another Struct owns its buffer, and C<data> returns a
+reference to that buffer itself: nothing is copied, writes through the
+reference are seen by the fields straight away, as are writes made by
+any C function the Struct is passed to. A Struct nested in
+another one has no buffer of its own (its fields live in the
+outermost Struct's buffer), so C<data> returns a copy of its bytes.
+
+=cut
+
 sub data {
   my $self = shift;
   _debug( 4, "In ", $self->{_name}, "'s _DATA(), from ", join(", ",(caller(1))[0..3]), "\n");
-  my @data;
-  if( defined $self->{_data}
-      and $self->{_datasafe} == 1 ) {
-    _debug( 5, "    _data already defined and safe\n");
-    _debug( 4, "    returning ", unpack('b*',$self->{_data}), "\n");
-    return \$self->{_data};
-  }
 # TODO This is where a check for an endianness property would come in.
-#  if( $self->{_endianness} ne 'b' ) {
-    for(@{$self->{_fields}->{_rawarray}}) {
-      push @data, $_->{_data};
-    }
-    $self->{_data} = join('',@data);
-    _debug( 5, "    returning ", unpack('b*',$self->{_data}), "\n"  );
-    _debug( 5, "  ", $self->{_name}, "'s _data returning ok...\n"  );
-    $self->_datasafe(0);
-    return \$self->{_data};
-#  } else {
-  # <insert code for other / swapped endianness here>
-#  }
+  my( $base, $offset ) = $self->_base;
+  return \$self->{_data} if refaddr($base) == refaddr($self);
+  my $data = substr( $base->{_data}, $offset, $self->{_size} );
+  _debug( 5, "    view at $offset returning ", unpack('b*',$data), "\n" );
+  return \$data;
 }
 
+# Structs nested in other Structs are views: their bytes exist only in
+# the outermost Struct's _data. Returns that Struct and our offset into
+# its buffer.
+sub _base {
+  my $self = shift;
+  my( $base, $offset ) = ( $self, 0 );
+  while( defined $base->{_owner}
+         and $base->{_owner}->isa('Ctypes::Type::Struct') ) {
+    $offset += $base->{_index};
+    $base = $base->{_owner};
+  }
+  return ( $base, $offset );
+}
+
+sub _fetch_bytes {
+  my( $self, $index, $length ) = @_;
+  my( $base, $offset ) = $self->_base;
+  $base->_update_ if defined $base->{_owner};
+  return substr( $base->{_data}, $offset + $index, $length );
+}
+
+#
+# Writes go straight into the buffer at our offset, so updating a
+# member costs the size of the member, not of every Struct above it.
+# With no arg, the only thing that can be stale is a buffer whose
+# Struct lives in some other type of object (e.g. an Array), which we
+# reread from that owner.
+#
 sub _update_ {
   my($self, $arg, $index) = @_;
   _debug( 5, "In ", $self->{_name}, "'s _UPDATE_, from ", join(", ",(caller(0))[0..3]), "\n"  );
-  _debug( 5, "  self is: ", $self, "\n"  );
-  _debug( 5, "  current data looks like:\n", unpack('b*',$self->{_data}), "\n"  );
   _debug( 5, "  arg is: ", $arg) if $arg;
   _debug( 5, $arg ? (",  which is\n", unpack('b*',$arg), "\n  to you and me\n") : ('')  );
   _debug( 5, "  and index is: $index\n") if defined $index;
+  my( $base, $offset ) = $self->_base;
   if( not defined $arg ) {
-    _debug( 5, "    Arg wasn't defined!\n"  );
-    if( $self->{_owner} ) {
-    _debug( 5, "      Getting data from owner...\n"  );
-    $self->{_data} = substr( ${$self->{_owner}->data},
-                             $self->{_index},
-                             $self->{_size} );
+    if( $base->{_owner} ) {
+      _debug( 5, "      Getting data from owner...\n"  );
+      $base->{_data} = $base->{_owner}->_fetch_bytes( $base->{_index},
+                                                      $base->{_size} );
     }
+    return 1;
+  }
+  if( refaddr($base) == refaddr($self) and not defined $index
+      and not $self->{_view} ) {
+    $self->{_data} = $arg; # if data given with no index, replaces all
   } else {
-    if( defined $index ) {
-      _debug( 5, "     Got an index...\n"  );
-      my $pad = $index + length($arg) - length($self->{_data});
-      if( $pad > 0 ) {
-        _debug( 5, "    pad was $pad\n"  );
-        $self->{_data} .= "\0" x $pad;
-      }
-      _debug( 5, "    Setting chunk of self->data\n"  );
-      substr( $self->{_data},
-              $index,
-              length($arg)
-            ) = $arg;
-    } else {
-      $self->{_data} = $arg; # if data given with no index, replaces all
+    $index = 0 unless defined $index;
+    my $pad = $offset + $index + length($arg) - length($base->{_data});
+    if( $pad > 0 ) {
+      _debug( 5, "    pad was $pad\n"  );
+      $base->{_data} .= "\0" x $pad;
     }
+    substr( $base->{_data}, $offset + $index, length($arg) ) = $arg;
   }
+  $base->{_size} = length($base->{_data})
+    if refaddr($base) == refaddr($self);
 
-  # Have to send all data upstream even if only 1 member updated
-  # ... or do we? Send our _index, plus #bytes updated member starts at?
-  # Could C::B::C help with this???
-  if( defined $arg and $self->{_owner} ) {
+  if( $base->{_owner} ) {
     _debug( 5, "    Need to update my owner...\n"  );
-    my $success = undef;
-    _debug( 5, "  Sending data back upstream:\n") if $arg;
-    _debug( 5, "    Index is ", $self->{_index}, "\n") if $arg;
-    $success =
-      $self->{_owner}->_update_(
-        $self->{_data},
-        $self->{_index}
-      );
-    if(!$success) {
-      croak($self->{_name},
+    if( !$base->{_owner}->_update_( $base->{_data}, $base->{_index} ) ) {
+      croak($base->{_name},
             ": Error updating member in owner object ",
-              $self->{_owner}->{_name});
+              $base->{_owner}->{_name});
     }
   }
   $self->{_datasafe} = 1;
-  if( defined $arg or $self->{_owner} ) { # otherwise nothing's changed
-    $self->_set_owned_unsafe;
-  }
-  _debug( 5, "  data NOW looks like:\n", unpack('b*',$self->{_data}), "\n"  );
-  _debug( 5, "    updating size...\n"  );
-  $self->{_size} = length($self->{_data});
-  _debug( 5, "    ", $self->{_name}, "'s _Update_ returning ok\n"  );
+  _debug( 5, "  data NOW looks like:\n", unpack('b*',$base->{_data}), "\n"  );
   return 1;
 }
 
@@ -426,7 +547,7 @@ following two lines are equivalent:
 # Accessor generation
 #
 my %access = (
-  typecode      => ['_typecode_'],
+  typecode      => ['_typecode'],
   align         => [
                     '_alignment',
                     sub {if($_[0] =~ /^(1|2|4|8|16|32|64)$/){return 1}else{return 0}},
@@ -494,7 +615,7 @@ use warnings;
 use strict;
 use Carp;
 use Ctypes::Util qw|_debug|;
-use Scalar::Util qw|blessed looks_like_number|;
+use Scalar::Util qw|blessed looks_like_number weaken|;
 use overload
   '@{}'    => \&_array_overload,
   '%{}'    => \&_hash_overload,
@@ -503,7 +624,7 @@ use Ctypes::Util qw|_debug|;
 use Ctypes::Type::Field;
 
 sub _array_overload {
-  return $_[0]->{_array};
+  return $_[0]->_all->{_array};
 }
 
 sub _hash_overload {
@@ -512,6 +633,7 @@ sub _hash_overload {
     return $_[0];
   }
   my( $self, $key ) = ( shift, shift );
+  $self->_all;
   my $class = ref($self);
   bless $self => 'overload::dummy';
   _debug( 5, "_Fields' HashOverload\n" );
@@ -529,25 +651,92 @@ sub new {
                _array       => [],
                _size        => 0,
                _allowchange => 1,
+               _layout      => $obj->{_layout},
              };
   bless $self => $class;
   return $self;
 }
 
+# Number of fields, whether or not their objects exist yet
+sub _count {
+  my $self = shift;
+  return $self->{_layout} ? scalar @{$self->{_layout}->{_names}}
+                          : scalar @{$self->{_array}};
+}
+
+# The Fields of a Struct with a class layout are only made when first
+# asked for; until then a field is just bytes in the Struct's buffer.
+sub _field {
+  my( $self, $i ) = @_;
+  return $self->{_array}->[$i]
+    if not $self->{_layout} or defined $self->{_array}->[$i];
+  my $layout = $self->{_layout};
+  return undef if $i < 0 or $i > $#{$layout->{_names}};
+  my $key = $layout->{_names}->[$i];
+  _debug( 5, "    Making field '$key' of ", $self->{_obj}->{_name}, "\n" );
+  my $field = Ctypes::Type::Field->_attach( $key, $layout->_instance($i),
+                                            $layout->{_offsets}->[$i],
+                                            $self->{_obj} );
+  if( $self->{_obj}->{_view} ) {
+    my $value = $field->{_rawcontents}->{VALUE};
+    weaken( $field->{_obj} );
+    weaken( $value->{_owner} );
+    Ctypes::Type::Struct::_weaken_parts($value)
+      if $value->isa('Ctypes::Type::Struct');
+  }
+  $self->{_array}->[$i] = $field;
+  $self->{_hash}->{$key} = $field;
+  return $field;
+}
+
+sub _named {
+  my( $self, $key ) = @_;
+  return $self->{_hash}->{$key} if exists $self->{_hash}->{$key};
+  return undef unless $self->{_layout}
+                  and exists $self->{_layout}->{_index}->{$key};
+  return $self->_field( $self->{_layout}->{_index}->{$key} );
+}
+
+sub _all {
+  my $self = shift;
+  if( $self->{_layout} ) {
+    $self->_field($_) for 0 .. $#{$self->{_layout}->{_names}};
+  }
+  return $self;
+}
+
+# Where a field starts when it follows one ending at END, for a Struct
+# with alignment ALIGN
+sub _next_offset {
+  my( $end, $align ) = @_;
+  $align = 1 if not $align;
+  _debug( 5, "    alignment is $align\n"  );
+  my $offoff = abs( $end - $align ) % $align;
+  if( $offoff ) { # how much the 'off'set is 'off' by.
+    _debug( 5, "  offoff was $offoff off!\n"  );
+    $end += $offoff;
+  }
+  return $end;
+}
+
 sub _add_field {
   my( $self, $key, $val ) = ( shift, shift, shift );
   _debug( 5, "In ", $self->{_obj}->{_name}, "'s _add_field(), from ", join(", ",(caller(1))[0..3]), "\n"  );
   _debug( 5, "    key is $key\n"  );
   _debug( 5, "    value is $val\n"  );
-  if( exists $self->{_hash}->{$key} ) {
+  if( defined $self->_named($key) ) {
     croak( "Trying to add already extant key!" );
   }
+  if( $self->{_layout} ) {
+    # No longer laid out like the rest of its class
+    $self->_all;
+    delete $self->{_layout};
+    delete $self->{_obj}->{_layout};
+  }
 
   my $offset = 0;
   my $newfieldindex = 0;
   $newfieldindex = scalar @{$self->{_array}};
-  my $align = $self->{_obj}->{_alignment};
-  $align = 1 if $align == 0;
 
   if( $newfieldindex > 0 ) {
     _debug( 5, "    Already stuff in array\n"  );
@@ -555,14 +744,9 @@ sub _add_field {
     _debug( 5, "    lastindex is $lastindex\n"  );
     _debug( 5, "    lastindex index: ", $self->{_array}->[$lastindex]->index, "\n"  );
     _debug( 5, "    lastindex size: ", $self->{_array}->[$lastindex]->size, "\n"  );
-    $offset = $self->{_array}->[$lastindex]->index
-              + $self->{_array}->[$lastindex]->size;
-    _debug( 5, "    alignment is $align\n"  );
-    my $offoff = abs( $offset - $align ) % $align;
-    if( $offoff ) { # how much the 'off'set is 'off' by.
-      _debug( 5, "  offoff was $offoff off!\n"  );
-      $offset += $offoff;
-    }
+    $offset = _next_offset( $self->{_array}->[$lastindex]->index
+                            + $self->{_array}->[$lastindex]->size,
+                            $self->{_obj}->{_alignment} );
   }
   _debug( 5, "    offset will be ", $offset, "\n"  );
   _debug( 5, "  Creating Field...\n"  );
@@ -576,6 +760,150 @@ sub _add_field {
   return $self->{_hash}->{$key};
 }
 
+package Ctypes::Type::Struct::_Layout;
+use warnings;
+use strict;
+use Carp;
+use Ctypes::Util qw|_debug|;
+use Scalar::Util qw|blessed|;
+
+#
+# Everything instances of a Struct subclass share: field names,
+# offsets, sizes and prototype objects, the total size and the
+# initial contents of the buffer, and (in XS magic, from _compile)
+# the ffi_type libffi needs to pass the Struct by value.
+#
+my %layouts;
+
+sub of {
+  my $for = shift;
+  return $layouts{$for} ||= __PACKAGE__->new($for);
+}
+
+sub new {
+  my( $class, $for ) = @_;
+  _debug( 4, "Compiling layout for $for\n" );
+  my $_fields_ = do { no strict 'refs'; ${"${for}::_fields_"} };
+  if( ref($_fields_) ne 'ARRAY' or scalar @$_fields_ % 2 ) {
+    croak( "_fields_ must be key => value pairs!" );
+  }
+  my $self = bless {
+                     _class    => $for,
+                     _names    => [],
+                     _index    => {},
+                     _offsets  => [],
+                     _sizes    => [],
+                     _protos   => [],
+                     _align    => 0,
+                     _size     => 0,
+                     _data     => '',
+                     _byvalue  => 0,
+                   } => $class;
+  my @spec;
+  my $end = 0;
+  my $native = !$for->isa('Ctypes::Type::Union'); # libffi has no unions
+  for( my $i = 0; $i < $#$_fields_; $i += 2 ) {
+    my( $key, $proto ) = @{$_fields_}[$i, $i + 1];
+    croak( "$for: field '$key' given twice" )
+      if exists $self->{_index}->{$key};
+    if( not defined $proto ) {
+      croak( "Fields must be initialised with a Ctypes object" );
+    } elsif( not ref($proto) ) {
+      $proto = Ctypes::Type::Simple->new(
+        Ctypes::Util::_check_type_needed( $proto ), $proto );
+    } elsif( not ( blessed($proto) and $proto->isa('Ctypes::Type') ) ) {
+      croak( "Structs can only hold Ctypes objects" );
+    }
+    my $offset = $i ? Ctypes::Type::Struct::_Fields::_next_offset(
+                        $end, $self->{_align} )
+                    : 0;
+    my $datum = ${$proto->data};
+    # A field takes its C size, even where its packed data is shorter
+    # (Simple longs pack to 32 bits)
+    my $width = $proto->size > length($datum) ? $proto->size
+                                              : length($datum);
+    my $pad = $offset + $width - length($self->{_data});
+    $self->{_data} .= "\0" x $pad if $pad > 0;
+    substr( $self->{_data}, $offset, length($datum) ) = $datum;
+    $end = $offset + $proto->size;
+
+    push @{$self->{_names}}, $key;
+    push @{$self->{_offsets}}, $offset;
+    push @{$self->{_sizes}}, $proto->size;
+    push @{$self->{_protos}}, $proto;
+    $self->{_index}->{$key} = $#{$self->{_names}};
+    if( $native ) {
+      my @elements = _elements( $proto, $offset );
+      @elements ? push( @spec, @elements ) : ( $native = 0 );
+    }
+  }
+  $self->{_size} = length($self->{_data});
+  if( $native ) {
+    $self->{_byvalue} = $self->_compile( $self->{_size}, \@spec );
+    $self->{_native} = 1;
+  }
+  return $self;
+}
+
+# The scalar members of a field for libffi, as [ sizecode or nested
+# layout, offset ] pairs. Empty if libffi can't describe it.
+sub _elements {
+  my( $proto, $offset ) = @_;
+  if( $proto->isa('Ctypes::Type::Struct') ) {
+    my $layout = $proto->{_layout};
+    return $layout && $layout->{_native} ? [ $layout, $offset ] : ();
+  }
+  if( $proto->isa('Ctypes::Type::Array') ) {
+    return map { [ $proto->{_buffer}, $offset + $_ * $proto->{_member_size} ] }
+      0 .. $proto->{_length} - 1
+      if $proto->{_buffer};
+    my @elements;
+    my $members = $proto->{_rawmembers}->{VALUES};
+    for( 0 .. $#$members ) {
+      my @e = _elements( $members->[$_],
+                         $offset + $_ * $proto->{_member_size} );
+      return () unless @e;
+      push @elements, @e;
+    }
+    return @elements;
+  }
+  return [ 'p', $offset ] if $proto->isa('Ctypes::Type::Pointer');
+  return [ $proto->sizecode, $offset ]
+    if $proto->isa('Ctypes::Type::Simple');
+  return ();
+}
+
+# A fresh value object for field I of a new instance
+sub _instance {
+  my( $self, $i ) = @_;
+  my $proto = $self->{_protos}->[$i];
+  if( $proto->isa('Ctypes::Type::Struct') and $proto->{_layout} ) {
+    my $layout = $proto->{_layout};
+    return Ctypes::Type::Struct::_build( $layout->{_class},
+                                         $layout->{_class}, $layout );
+  }
+  return $proto->copy;
+}
+
+# For cursors, which read their numbers and characters straight from
+# the memory they're over rather than through field objects: a sub
+# unpacking field I from a buffer, or false if it isn't one of those
+sub _reader {
+  my( $self, $i ) = @_;
+  return undef unless defined $i and $i >= 0 and $i <= $#{$self->{_names}};
+  return $self->{_readers}->[$i] if defined $self->{_readers}->[$i];
+  my $proto = $self->{_protos}->[$i];
+  my $code = Ctypes::Type::Array::_buffer_code($proto);
+  return $self->{_readers}->[$i] = 0 unless $code;
+  # Characters come back as themselves, as from Arrays of them
+  $code = 'a' if $proto->isa('Ctypes::Type::c_char')
+                 or $proto->isa('Ctypes::Type::c_uchar');
+  # and longs as C's, which unpack's plain l and L aren't
+  $code .= '!' if $code =~ /^[lL]$/;
+  my $template = "x$self->{_offsets}->[$i] $code";
+  return $self->{_readers}->[$i] = sub { unpack( $template, $_[0] ) };
+}
+
 package Ctypes::Type::Struct::_Values;
 use warnings;
 use strict;
@@ -654,18 +982,25 @@ sub STORE {
   _debug( 5, "In _Fields::_array::STORE\n"  );
   _debug( 5, "    index is $index\n"  );
   _debug( 5, "    val is $val\n"  );
-  $self->{_fields}->{_array}->[$index]->{_contents} = $val;
-  return $self->{_fields}->{_array}->[$index]->{_contents};
+  my $field = $self->{_fields}->_field($index) or return undef;
+  $field->{_contents} = $val;
+  return $field->{_contents};
 }
 
 sub FETCH {
   my( $self, $index ) = (shift, shift);
+  my $fields = $self->{_fields};
+  if( $fields->{_obj}->{_cursor}
+      and my $read = $fields->{_layout}->_reader($index) ) {
+    return $read->( $fields->{_obj}->{_data} );
+  }
   _debug( 5, "In _array::FETCH, index $index, from ", join(", ",(caller(1))[0..3]), "\n"  );
-  return $self->{_fields}->{_array}->[$index]->{_contents};
+  my $field = $self->{_fields}->_field($index) or return undef;
+  return $field->{_contents};
 }
 
-sub FETCHSIZE { return scalar @{ $_[0]->{_fields}->{_array} } }
-sub EXISTS { exists $_[0]->{_fields}->{_array}->[$_[1]] }
+sub FETCHSIZE { return $_[0]->{_fields}->_count }
+sub EXISTS { $_[1] < $_[0]->{_fields}->_count }
 
 package Ctypes::Type::Struct::_Fields::_hash;
 use warnings;
@@ -692,27 +1027,34 @@ sub STORE {
   _debug( 5, "In _Fields::_hash::STORE\n"  );
   _debug( 5, "    key is $key\n"  );
   _debug( 5, "    val is $val\n"  );
-  $self->{_fields}->{_hash}->{$key}->{_contents} = $val;
-  return $self->{_fields}->{$key};
+  my $field = $self->{_fields}->_named($key) or return undef;
+  $field->{_contents} = $val;
+  return $field->{_contents};
 }
 
 sub FETCH {
   my( $self, $key ) = (shift, shift);
+  my $fields = $self->{_fields};
+  if( $fields->{_obj}->{_cursor}
+      and my $read = $fields->{_layout}->_reader(
+                       $fields->{_layout}->{_index}->{$key} ) ) {
+    return $read->( $fields->{_obj}->{_data} );
+  }
   _debug( 5, "In _hash::FETCH, key $key, from ", join(", ",(caller(1))[0..3]), "\n"  );
-  _debug( 5, "    ", ref($self->{_fields}->{_hash}->{$key}), "\n"  );
-  return $self->{_fields}->{_hash}->{$key}->{_contents};
+  my $field = $self->{_fields}->_named($key) or return undef;
+  return $field->{_contents};
 }
 
 sub FIRSTKEY {
-  my $a = scalar keys %{$_[0]->{_fields}->{_hash}};
+  my $a = scalar keys %{$_[0]->{_fields}->_all->{_hash}};
   each %{$_[0]->{_fields}->{_hash}}
 }
 
 sub NEXTKEY { each %{$_[0]->{_fields}->{_hash}} }
-sub EXISTS { exists $_[0]->{_fields}->{_hash}->{$_[1]} }
+sub EXISTS { defined $_[0]->{_fields}->_named($_[1]) }
 sub DELETE { croak( "XXX Cannot delete Struct fields" ) }
 sub CLEAR { croak( "XXX Cannot clear Struct fields" ) }
-sub SCALAR { scalar %{$_[0]->{_fields}->{_hash}} }
+sub SCALAR { scalar %{$_[0]->{_fields}->_all->{_hash}} }
 
 #  package Ctypes::Type::Struct::_Fields::_Finder;
 #  use warnings;
@@ -2,6 +2,7 @@ package Ctypes::Type::Union;
 use strict;
 use warnings;
 use Ctypes::Util qw|_debug|;
+use Scalar::Util qw|refaddr|;
 use base qw|Ctypes::Type::Struct|;
 
 use Carp;
@@ -64,85 +65,50 @@ sub _set_whichmem {
   $_[0]->{_whichmem} = $_[1] if defined $_[1]; return $_[0]->{_whichmem};
 }
 
-sub _as_param_ { return $_[0]->data(@_) }
-
-sub data {
-  my $self = shift;
-  print "In ", $self->{_name}, "'s _DATA(), from ", join(", ",(caller(1))[0..3]), "\n" if $Debug;
-  my @data;
-  if( defined $self->{_data}
-      and $self->{_datasafe} == 1 ) {
-    print "    _data already defined and safe\n" if $Debug;
-    print "    returning ", unpack('b*',$self->{_data}), "\n" if $Debug;
-    return \$self->{_data};
-  }
-  # TODO This is where a check for an endianness property would come in.
-  #  if( $self->{_endianness} ne 'b' ) {
-    for(@{$self->{_fields}->{_rawarray}}) {
-      push @data, $_->{_data};
-    }
-    $self->{_data} = join('',@data);
-    print "    returning ", unpack('b*',$self->{_data}), "\n" if $Debug;
-    print "  ", $self->{_name}, "'s _data returning ok...\n" if $Debug;
-    $self->_datasafe(0);
-    return \$self->{_data};
-#  } else {
-  # <insert code for other / swapped endianness here>
-#  }
-}
-
+# data() and _as_param_ are inherited from Struct
 
+#
+# All members sit at offset 0, so an update always rewrites the whole
+# Union, padded out to its current length.
+#
 sub _update_ {
   my($self, $arg) = @_;
   print "In ", $self->name, "'s _UPDATE_, from ", join(", ",(caller(0))[0..3]), "\n" if $Debug;
   print "  self is: ", $self, "\n" if $Debug;
-  print "  current data looks like:\n", unpack('b*',$self->{_data}), "\n" if $Debug;
   print "  arg is: $arg" if $arg and $Debug;
   print $arg ? (",  which is\n", unpack('b*',$arg), "\n  to you and me\n") : ('') if $Debug;
-  if( defined $arg ) {
-    my $pad = length($self->{_data}) - length($arg);
-    if( $pad > 0 ) {
-      print "    Current data was $pad bytes longer than arg.\n    Padding arg...\n" if $Debug;
-      $arg .= "\0" x $pad;
-    } elsif ( $pad < 0 ) {
-      print "    Arg was longer; updating size...\n" if $Debug;
-      $self->{_size} = length($arg);
-    }
-    print "    Setting self->data\n" if $Debug;
-    $self->{_data} = $arg; # if data given with no index, replaces all
-  } else {
-    print "    Arg wasn't defined!\n" if $Debug;
-    if( $self->{_owner} ) {
-      print "      Getting data from owner...\n" if $Debug;
-      $self->{_data} = substr( ${$self->owner->data},
-                               $self->index,
-                               $self->size );
+  if( not defined $arg ) {
+    if( not $self->{_owner} ) {
+      carp( $self->{_name}, "'s _update_ changed nothing!" );
+      return 1;
     }
+    return $self->SUPER::_update_;
+  }
+  my $pad = length($self->{_data}) - length($arg);
+  if( $pad > 0 ) {
+    print "    Current data was $pad bytes longer than arg.\n    Padding arg...\n" if $Debug;
+    $arg .= "\0" x $pad;
+  } elsif ( $pad < 0 ) {
+    print "    Arg was longer; updating size...\n" if $Debug;
+    $self->{_size} = length($arg);
   }
+  my( $base ) = $self->_base;
+  if( refaddr($base) != refaddr($self) ) {
+    print "    Writing into buffer of ", $base->{_name}, "\n" if $Debug;
+    return $self->SUPER::_update_( $arg, 0 );
+  }
+  print "    Setting self->data\n" if $Debug;
+  $self->{_data} = $arg; # if data given with no index, replaces all
 
-  # Have to send all data upstream even if only 1 member updated
-  # ... or do we? Send our _index, plus #bytes updated member starts at?
-  # Could C::B::C help with this???
-  if( defined $arg and $self->{_owner} ) {
-    my $success = undef;
-    print "    Must send data back upstream, at index ", $self->{_index}, "\n" if $arg and $Debug;
-    $success =
-      $self->{_owner}->_update_(
-        $self->{_data},
-        $self->{_index}
-      );
-    if(!$success) {
+  if( $self->{_owner} ) {
+    print "    Must send data back upstream, at index ", $self->{_index}, "\n" if $Debug;
+    if( !$self->{_owner}->_update_( $self->{_data}, $self->{_index} ) ) {
       croak($self->{_name},
             ": Error updating member in owner object ",
               $self->{_owner}->{_name});
     }
   }
   $self->{_datasafe} = 1;
-  if( defined $arg or $self->{_owner} ) { # otherwise nothing's changed
-    $self->_set_owned_unsafe;
-  } else {
-    carp( $self->{_name}, "'s _update_ changed nothing!" );
-  }
   print "  Data NOW looks like:\n    ", unpack('b*',$self->{_data}), "\n" if $Debug;
   print "    ", $self->{_name}, "'s _Update_ returning ok\n" if $Debug;
   return 1;
@@ -241,6 +241,8 @@ sub _check_invalid_types ($) {
         carp("No unblessed references as types");
         return $i;
       } else {
+        # Structs are passed by value; the call plan checks their layout
+        next if $_->isa('Ctypes::Type::Struct');
         if( !$_->can("_as_param_")
             and not defined($_->{_as_param_}) ) {
           carp("types must have _as_param_ method or attribute");
@@ -0,0 +1,175 @@
+/*###########################################################################
+## Name:        native_cb.c
+## Purpose:     Ctypes::Callback::Native: comparators for qsort, bsearch
+##              and friends which run in C and never call back into Perl
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_NATIVE_CB_C
+#define _INC_NATIVE_CB_C
+
+/* Compare a field of two elements. code is a scalar sizecode (p
+   compares addresses), or 'z' for a char* to compare with strcmp, or
+   'a' for an inline char[length] to compare with strncmp. Only
+   closures.c's pool and libffi are involved, so any thread may call
+   one. */
+typedef struct _Ct_native_cmp_t {
+  char code;
+  int desc;
+  size_t offset;            /* of the field in the second argument */
+  size_t key_offset;        /* and in the first, which bsearch's key is */
+  size_t length;
+  void* addr;               /* the function */
+  Ct_closure_slot_t* slot;  /* NULL if it's one of the Ct_cmp0 ones */
+  Ct_cb_cif_t* shared;
+} Ct_native_cmp_t;
+
+/* Fields may be anywhere in a packed buffer, so read them by copying */
+#define Ct_CMP_AS(type) {                 \
+    type x, y;                            \
+    Copy(a, &x, 1, type);                 \
+    Copy(b, &y, 1, type);                 \
+    return (x > y) - (x < y);             \
+  }
+
+/* -1, 0 or 1 as the fields at a and b compare */
+static inline int
+Ct_cmp_fields(char code, size_t length, const char* a, const char* b) {
+  int r;
+  switch( code ) {
+    case 'c': Ct_CMP_AS(signed char)
+    case 'C': Ct_CMP_AS(unsigned char)
+    case 's': Ct_CMP_AS(short)
+    case 'S': Ct_CMP_AS(unsigned short)
+    case 'i': Ct_CMP_AS(int)
+    case 'I': Ct_CMP_AS(unsigned int)
+    case 'l': Ct_CMP_AS(long)
+    case 'L': Ct_CMP_AS(unsigned long)
+#ifdef HAS_LONG_LONG
+    case 'q': Ct_CMP_AS(long long)
+    case 'Q': Ct_CMP_AS(unsigned long long)
+#endif
+    case 'f': Ct_CMP_AS(float)
+    case 'd': Ct_CMP_AS(double)
+    case 'D': Ct_CMP_AS(long double)
+    case 'p': Ct_CMP_AS(uintptr_t)
+    case 'z': {
+      const char *x, *y;
+      Copy(a, &x, 1, const char*);
+      Copy(b, &y, 1, const char*);
+      /* NULLs first */
+      r = x == y ? 0 : x == NULL ? -1 : y == NULL ? 1 : strcmp(x, y);
+      return (r > 0) - (r < 0);
+    }
+    case 'a':
+      r = strncmp(a, b, length);
+      return (r > 0) - (r < 0);
+  }
+  return 0;
+}
+
+/* Fields at offset 0 of both arguments, the usual case for arrays of
+   scalars, need no closure: plain functions, one per type and order */
+#define Ct_CMP0(code, name)                                             \
+  static int Ct_cmp0_##name(const void* a, const void* b)               \
+    { return Ct_cmp_fields(code, 0, (const char*)a, (const char*)b); }  \
+  static int Ct_cmp0_##name##_desc(const void* a, const void* b)        \
+    { return -Ct_cmp_fields(code, 0, (const char*)a, (const char*)b); }
+Ct_CMP0('c', c)  Ct_CMP0('C', uc)
+Ct_CMP0('s', s)  Ct_CMP0('S', us)
+Ct_CMP0('i', i)  Ct_CMP0('I', ui)
+Ct_CMP0('l', l)  Ct_CMP0('L', ul)
+#ifdef HAS_LONG_LONG
+Ct_CMP0('q', q)  Ct_CMP0('Q', uq)
+#endif
+Ct_CMP0('f', f)  Ct_CMP0('d', d)  Ct_CMP0('D', ld)
+Ct_CMP0('p', p)  Ct_CMP0('z', z)
+
+typedef int (*Ct_cmp_fn)(const void*, const void*);
+#define Ct_CMP0_ENTRY(code, name) \
+  case code: return desc ? Ct_cmp0_##name##_desc : Ct_cmp0_##name;
+
+static Ct_cmp_fn
+Ct_cmp0_find(char code, int desc) {
+  switch( code ) {
+    Ct_CMP0_ENTRY('c', c)  Ct_CMP0_ENTRY('C', uc)
+    Ct_CMP0_ENTRY('s', s)  Ct_CMP0_ENTRY('S', us)
+    Ct_CMP0_ENTRY('i', i)  Ct_CMP0_ENTRY('I', ui)
+    Ct_CMP0_ENTRY('l', l)  Ct_CMP0_ENTRY('L', ul)
+#ifdef HAS_LONG_LONG
+    Ct_CMP0_ENTRY('q', q)  Ct_CMP0_ENTRY('Q', uq)
+#endif
+    Ct_CMP0_ENTRY('f', f)  Ct_CMP0_ENTRY('d', d)  Ct_CMP0_ENTRY('D', ld)
+    Ct_CMP0_ENTRY('p', p)  Ct_CMP0_ENTRY('z', z)
+  }
+  return NULL;
+}
+
+static void
+Ct_native_compare(ffi_cif* cif, void* retval, void** args, void* udata) {
+  const Ct_native_cmp_t* cmp = (const Ct_native_cmp_t*)udata;
+  int r = Ct_cmp_fields(cmp->code, cmp->length,
+                        *(const char**)args[0] + cmp->key_offset,
+                        *(const char**)args[1] + cmp->offset);
+  PERL_UNUSED_ARG(cif);
+  *(ffi_sarg*)retval = cmp->desc ? -r : r;
+}
+
+/* A comparator for fields of type code, as described above; croaks
+   before allocating anything if code is no good */
+Ct_native_cmp_t*
+Ct_native_compare_new(char code, int desc, size_t offset,
+                      size_t key_offset, size_t length) {
+  Ct_native_cmp_t* cmp;
+  Ct_layout_t* no_layouts[3] = { NULL, NULL, NULL };
+  ffi_status status;
+
+  if( strchr("cCsSiIlLqQfdDpza", code) == NULL || code == '\0' )
+    croak("Ctypes::Callback::Native: can't compare type '%c'", code);
+#ifndef HAS_LONG_LONG
+  if( code == 'q' || code == 'Q' )
+    croak("Ctypes::Callback::Native: no long long on this platform");
+#endif
+  if( code == 'a' && length == 0 )
+    croak("Ctypes::Callback::Native: chars need a length");
+
+  Newxz(cmp, 1, Ct_native_cmp_t);
+  cmp->code = code;
+  cmp->desc = desc;
+  cmp->offset = offset;
+  cmp->key_offset = key_offset;
+  cmp->length = length;
+  if( offset == 0 && key_offset == 0
+      && (cmp->addr = (void*)Ct_cmp0_find(code, desc)) != NULL )
+    return cmp;
+  /* int (*)(const void*, const void*): shared with any Perl
+     callback of the same signature */
+  cmp->shared = Ct_cb_cif_get("ipp", 3, no_layouts);
+  if( (cmp->slot = Ct_closure_take()) == NULL
+      || (status = ffi_prep_closure_loc(cmp->slot->closure, &cmp->shared->cif,
+                                        &Ct_native_compare, cmp,
+                                        cmp->slot->code)) != FFI_OK ) {
+    if( cmp->slot != NULL )
+      Ct_closure_give(cmp->slot);
+    Ct_cb_cif_release(cmp->shared);
+    Safefree(cmp);
+    croak("Ctypes::Callback::Native: can't make a closure");
+  }
+  cmp->addr = cmp->slot->code;
+  debug_warn( "#[%s:%i] Native comparator '%c' at %i%s", __FILE__, __LINE__,
+              code, (int)offset, desc ? ", descending" : "" );
+  return cmp;
+}
+
+void
+Ct_native_compare_free(Ct_native_cmp_t* cmp) {
+  if( cmp->slot != NULL ) {
+    Ct_closure_give(cmp->slot);
+    Ct_cb_cif_release(cmp->shared);
+  }
+  Safefree(cmp);
+}
+
+#endif  /* _INC_NATIVE_CB_C */
@@ -63,6 +63,50 @@ Ct_IsCoderef(SV* arg) {
     return 0;
 }
 
+/* The native data of a built-in Ctypes::Type object (Simple, Array,
+   Pointer, Struct), read straight out of the object so ConvArg doesn't
+   have to call _as_param_. Returns NULL if the object's class has its
+   own _as_param_, or if its _data can't be trusted without running
+   Perl code; callers then fall back to the method call. */
+SV*
+Ct_Obj_NativeData(SV* obj) {
+  HV *hv, *stash;
+  GV* gv;
+  CV* cv;
+  SV **data, **flag;
+  const char* impl;
+
+  if( SvTYPE(SvRV(obj)) != SVt_PVHV )
+    return NULL;
+  hv = (HV*)SvRV(obj);
+  stash = SvSTASH((SV*)hv);
+  gv = gv_fetchmethod_autoload(stash, "_as_param_", 0);
+  if( gv == NULL || !isGV(gv) || (cv = GvCV(gv)) == NULL
+      || CvSTASH(cv) == NULL )
+    return NULL;
+  impl = HvNAME(CvSTASH(cv));
+  if( impl == NULL || strnNE(impl, "Ctypes::Type::", 14) )
+    return NULL;
+
+  data = hv_fetchs(hv, "_data", 0);
+  if( data == NULL || !SvPOK(*data) )
+    return NULL;
+  if( strEQ(impl + 14, "Simple") ) {
+    /* Simples without an owner repack _data on every store */
+    flag = hv_fetchs(hv, "_owner", 0);
+    return ( flag == NULL || !SvOK(*flag) ) ? *data : NULL;
+  }
+  if( strEQ(impl + 14, "Struct") ) {
+    /* Only the outermost Struct holds the buffer; nested ones are
+       views into it, and their own _data is stale */
+    flag = hv_fetchs(hv, "_owner", 0);
+    if( flag != NULL && SvOK(*flag) )
+      return NULL;
+  }
+  flag = hv_fetchs(hv, "_datasafe", 0);
+  return ( flag != NULL && SvTRUE(*flag) ) ? *data : NULL;
+}
+
 SV*
 Ct_AVref_GET_ITEM(SV* tuple, int i) {
   if( SvROK(tuple) && SvTYPE(SvRV(tuple)) == SVt_PVAV ) {
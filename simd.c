@@ -0,0 +1,399 @@
+/*###########################################################################
+## Name:        simd.c
+## Purpose:     Conversion kernels between staged IVs / NVs and packed
+##              native buffers: scalar, SSE2 and AVX2 versions, the
+##              best the CPU has chosen at load time
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_SIMD_C
+#define _INC_SIMD_C
+
+#if defined(__x86_64__) && IVSIZE == 8 && NVSIZE == 8 \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define Ct_HAS_X86_SIMD
+#include <immintrin.h>
+#define Ct_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+/* Each converts n elements, src to dst. Those which check ranges stop
+   at the first element which fails, returning how many were done, so
+   the caller can deal with that one the slow way and carry on. Sizes
+   are of the native integers, 1, 2, 4 or 8 bytes. */
+typedef struct _Ct_kernels_t {
+  const char* name;
+  /* IVs to integers, checking lo <= x <= hi */
+  size_t (*iv_narrow)(const IV* src, char* dst, size_t n, int size,
+                      int is_signed, IV lo, IV hi);
+  /* NVs to integers of up to 4 bytes: whole numbers in lo .. hi */
+  size_t (*nv_narrow)(const NV* src, char* dst, size_t n, int size,
+                      IV lo, IV hi);
+  /* IVs to doubles; never fails */
+  void (*iv_to_nv)(const IV* src, NV* dst, size_t n);
+  /* doubles to floats, checking |x| <= FLT_MAX */
+  size_t (*nv_to_float)(const NV* src, float* dst, size_t n);
+  /* floats to doubles */
+  void (*float_to_nv)(const float* src, NV* dst, size_t n);
+  /* integers to IVs (or, unsigned, UVs) */
+  void (*int_widen)(const char* src, IV* dst, size_t n, int size,
+                    int is_signed);
+} Ct_kernels_t;
+
+/* ---------------------------------------------------------------- */
+/* Scalar: every platform, and the tail of every vector loop        */
+
+static size_t
+Ct_k_iv_narrow_scalar(const IV* src, char* dst, size_t n, int size,
+                      int is_signed, IV lo, IV hi) {
+  size_t i;
+  PERL_UNUSED_ARG(is_signed);
+  for( i = 0; i < n; i++ ) {
+    IV x = src[i];
+    if( x < lo || x > hi )
+      break;
+    switch( size ) {
+      case 1: ((U8*)dst)[i] = (U8)x;   break;
+      case 2: ((U16*)dst)[i] = (U16)x; break;
+      case 4: ((U32*)dst)[i] = (U32)x; break;
+      default: ((IV*)dst)[i] = x;
+    }
+  }
+  return i;
+}
+
+static size_t
+Ct_k_nv_narrow_scalar(const NV* src, char* dst, size_t n, int size,
+                      IV lo, IV hi) {
+  size_t i;
+  for( i = 0; i < n; i++ ) {
+    NV x = src[i];
+    IV v;
+    if( !(x >= (NV)lo && x <= (NV)hi) || x != Perl_floor(x) )
+      break;
+    v = (IV)x;
+    switch( size ) {
+      case 1: ((U8*)dst)[i] = (U8)v;   break;
+      case 2: ((U16*)dst)[i] = (U16)v; break;
+      default: ((U32*)dst)[i] = (U32)v;
+    }
+  }
+  return i;
+}
+
+static void
+Ct_k_iv_to_nv_scalar(const IV* src, NV* dst, size_t n) {
+  size_t i;
+  for( i = 0; i < n; i++ )
+    dst[i] = (NV)src[i];
+}
+
+static size_t
+Ct_k_nv_to_float_scalar(const NV* src, float* dst, size_t n) {
+  size_t i;
+  for( i = 0; i < n; i++ ) {
+    if( src[i] > FLT_MAX || src[i] < -FLT_MAX )
+      break;
+    dst[i] = (float)src[i];
+  }
+  return i;
+}
+
+static void
+Ct_k_float_to_nv_scalar(const float* src, NV* dst, size_t n) {
+  size_t i;
+  for( i = 0; i < n; i++ )
+    dst[i] = (NV)src[i];
+}
+
+static void
+Ct_k_int_widen_scalar(const char* src, IV* dst, size_t n, int size,
+                      int is_signed) {
+  size_t i;
+  switch( size * 2 + (is_signed ? 1 : 0) ) {
+    case 3:  for( i = 0; i < n; i++ ) dst[i] = ((const I8*)src)[i];  break;
+    case 2:  for( i = 0; i < n; i++ ) dst[i] = ((const U8*)src)[i];  break;
+    case 5:  for( i = 0; i < n; i++ ) dst[i] = ((const I16*)src)[i]; break;
+    case 4:  for( i = 0; i < n; i++ ) dst[i] = ((const U16*)src)[i]; break;
+    case 9:  for( i = 0; i < n; i++ ) dst[i] = ((const I32*)src)[i]; break;
+    case 8:  for( i = 0; i < n; i++ ) dst[i] = ((const U32*)src)[i]; break;
+    default: Copy(src, dst, n * size, char);
+  }
+}
+
+static const Ct_kernels_t Ct_kernels_scalar = {
+  "scalar",
+  Ct_k_iv_narrow_scalar, Ct_k_nv_narrow_scalar, Ct_k_iv_to_nv_scalar,
+  Ct_k_nv_to_float_scalar, Ct_k_float_to_nv_scalar, Ct_k_int_widen_scalar
+};
+
+#ifdef Ct_HAS_X86_SIMD
+
+/* ---------------------------------------------------------------- */
+/* SSE2: always there on x86_64. It has no 64-bit compares, so the  */
+/* IV kernels only take values which fit in 32 bits.                */
+
+/* Mask of 2 IVs which are 32-bit values sign extended */
+#define Ct_SSE2_FITS_I32(x)                                             \
+  _mm_cmpeq_epi32(_mm_shuffle_epi32(x, _MM_SHUFFLE(3,3,1,1)),           \
+    _mm_srai_epi32(_mm_shuffle_epi32(x, _MM_SHUFFLE(2,2,0,0)), 31))
+
+Ct_TARGET("sse2") static size_t
+Ct_k_nv_narrow_sse2(const NV* src, char* dst, size_t n, int size,
+                    IV lo, IV hi) {
+  size_t i = 0;
+  if( lo >= I32_MIN && hi <= I32_MAX ) {
+    for( ; i + 2 <= n; i += 2 ) {
+      __m128d x = _mm_loadu_pd(src + i);
+      __m128i v = _mm_cvttpd_epi32(x);
+      /* whole numbers in range survive the round trip */
+      int ok = _mm_movemask_pd(_mm_cmpeq_pd(_mm_cvtepi32_pd(v), x)) == 3;
+      I32 a = _mm_cvtsi128_si32(v), b = _mm_cvtsi128_si32(_mm_srli_si128(v, 4));
+      if( !ok || a < lo || a > hi || b < lo || b > hi )
+        break;
+      switch( size ) {
+        case 1: ((U8*)dst)[i] = (U8)a;   ((U8*)dst)[i+1] = (U8)b;   break;
+        case 2: ((U16*)dst)[i] = (U16)a; ((U16*)dst)[i+1] = (U16)b; break;
+        default: _mm_storel_epi64((__m128i*)(dst + i * 4), v);
+      }
+    }
+  }
+  return i + Ct_k_nv_narrow_scalar(src + i, dst + i * size, n - i, size,
+                                   lo, hi);
+}
+
+Ct_TARGET("sse2") static void
+Ct_k_iv_to_nv_sse2(const IV* src, NV* dst, size_t n) {
+  size_t i;
+  for( i = 0; i + 2 <= n; i += 2 ) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+    if( _mm_movemask_epi8(Ct_SSE2_FITS_I32(x)) != 0xFFFF )
+      break;
+    _mm_storeu_pd(dst + i, _mm_cvtepi32_pd(
+      _mm_shuffle_epi32(x, _MM_SHUFFLE(3,1,2,0))));
+  }
+  Ct_k_iv_to_nv_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("sse2") static size_t
+Ct_k_nv_to_float_sse2(const NV* src, float* dst, size_t n) {
+  const __m128d fmax = _mm_set1_pd(FLT_MAX);
+  const __m128d abs = _mm_castsi128_pd(_mm_set1_epi64x(IV_MAX));
+  size_t i;
+  for( i = 0; i + 2 <= n; i += 2 ) {
+    __m128d x = _mm_loadu_pd(src + i);
+    if( _mm_movemask_pd(_mm_cmpgt_pd(_mm_and_pd(x, abs), fmax)) )
+      break;
+    _mm_storel_pi((__m64*)(dst + i), _mm_cvtpd_ps(x));
+  }
+  return i + Ct_k_nv_to_float_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("sse2") static void
+Ct_k_float_to_nv_sse2(const float* src, NV* dst, size_t n) {
+  size_t i;
+  for( i = 0; i + 2 <= n; i += 2 )
+    _mm_storeu_pd(dst + i, _mm_cvtps_pd(
+      _mm_castpd_ps(_mm_load_sd((const double*)(src + i)))));
+  Ct_k_float_to_nv_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("sse2") static void
+Ct_k_int_widen_sse2(const char* src, IV* dst, size_t n, int size,
+                    int is_signed) {
+  size_t i = 0;
+  if( size == 4 ) {
+    for( ; i + 2 <= n; i += 2 ) {
+      __m128i x = _mm_loadl_epi64((const __m128i*)(src + i * 4));
+      __m128i hi = is_signed ? _mm_srai_epi32(x, 31) : _mm_setzero_si128();
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi32(x, hi));
+    }
+  }
+  Ct_k_int_widen_scalar(src + i * size, dst + i, n - i, size, is_signed);
+}
+
+static const Ct_kernels_t Ct_kernels_sse2 = {
+  "sse2",
+  Ct_k_iv_narrow_scalar, Ct_k_nv_narrow_sse2, Ct_k_iv_to_nv_sse2,
+  Ct_k_nv_to_float_sse2, Ct_k_float_to_nv_sse2, Ct_k_int_widen_sse2
+};
+
+/* ---------------------------------------------------------------- */
+/* AVX2: four 64-bit lanes, with 64-bit compares                    */
+
+Ct_TARGET("avx2") static size_t
+Ct_k_iv_narrow_avx2(const IV* src, char* dst, size_t n, int size,
+                    int is_signed, IV lo, IV hi) {
+  const __m256i vlo = _mm256_set1_epi64x(lo), vhi = _mm256_set1_epi64x(hi);
+  const __m256i evens = _mm256_setr_epi32(0, 2, 4, 6, 0, 0, 0, 0);
+  size_t i;
+  int four;
+  for( i = 0; i + 4 <= n; i += 4 ) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i out = _mm256_or_si256(_mm256_cmpgt_epi64(vlo, x),
+                                  _mm256_cmpgt_epi64(x, vhi));
+    __m128i v;
+    if( !_mm256_testz_si256(out, out) )
+      break;
+    if( size == 8 ) {
+      _mm256_storeu_si256((__m256i*)(dst + i * 8), x);
+      continue;
+    }
+    /* In range, so narrowing is just taking the low bits */
+    v = _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(x, evens));
+    if( size == 4 ) {
+      _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+      continue;
+    }
+    v = is_signed ? _mm_packs_epi32(v, v) : _mm_packus_epi32(v, v);
+    if( size == 2 ) {
+      _mm_storel_epi64((__m128i*)(dst + i * 2), v);
+      continue;
+    }
+    v = is_signed ? _mm_packs_epi16(v, v) : _mm_packus_epi16(v, v);
+    four = _mm_cvtsi128_si32(v);
+    Copy(&four, dst + i, 1, int);
+  }
+  return i + Ct_k_iv_narrow_scalar(src + i, dst + i * size, n - i, size,
+                                   is_signed, lo, hi);
+}
+
+Ct_TARGET("avx2") static size_t
+Ct_k_nv_narrow_avx2(const NV* src, char* dst, size_t n, int size,
+                    IV lo, IV hi) {
+  size_t i = 0;
+  int four;
+  if( lo >= I32_MIN && hi <= I32_MAX ) {
+    const __m128i vlo = _mm_set1_epi32((I32)lo), vhi = _mm_set1_epi32((I32)hi);
+    for( ; i + 4 <= n; i += 4 ) {
+      __m256d x = _mm256_loadu_pd(src + i);
+      __m128i v = _mm256_cvttpd_epi32(x);
+      __m128i out = _mm_or_si128(_mm_cmpgt_epi32(vlo, v),
+                                 _mm_cmpgt_epi32(v, vhi));
+      /* whole numbers in range survive the round trip */
+      if( _mm256_movemask_pd(_mm256_cmp_pd(_mm256_cvtepi32_pd(v), x,
+                                           _CMP_EQ_OQ)) != 0xF
+          || !_mm_testz_si128(out, out) )
+        break;
+      if( size == 4 )
+        _mm_storeu_si128((__m128i*)(dst + i * 4), v);
+      else if( size == 2 )
+        _mm_storel_epi64((__m128i*)(dst + i * 2), lo < 0
+          ? _mm_packs_epi32(v, v) : _mm_packus_epi32(v, v));
+      else {
+        v = lo < 0 ? _mm_packs_epi32(v, v) : _mm_packus_epi32(v, v);
+        v = lo < 0 ? _mm_packs_epi16(v, v) : _mm_packus_epi16(v, v);
+        four = _mm_cvtsi128_si32(v);
+        Copy(&four, dst + i, 1, int);
+      }
+    }
+  }
+  return i + Ct_k_nv_narrow_scalar(src + i, dst + i * size, n - i, size,
+                                   lo, hi);
+}
+
+/* Exact for |x| < 2**51: adding 1.5 * 2**52 puts x in the mantissa */
+Ct_TARGET("avx2") static void
+Ct_k_iv_to_nv_avx2(const IV* src, NV* dst, size_t n) {
+  const __m256i magic = _mm256_set1_epi64x(0x4338000000000000LL);
+  const __m256i vlo = _mm256_set1_epi64x(-(1LL << 51) - 1);
+  const __m256i vhi = _mm256_set1_epi64x(1LL << 51);
+  size_t i;
+  for( i = 0; i + 4 <= n; i += 4 ) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+    __m256i ok = _mm256_and_si256(_mm256_cmpgt_epi64(x, vlo),
+                                  _mm256_cmpgt_epi64(vhi, x));
+    if( _mm256_movemask_pd(_mm256_castsi256_pd(ok)) != 0xF )
+      break;
+    _mm256_storeu_pd(dst + i, _mm256_sub_pd(
+      _mm256_castsi256_pd(_mm256_add_epi64(x, magic)),
+      _mm256_castsi256_pd(magic)));
+  }
+  Ct_k_iv_to_nv_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("avx2") static size_t
+Ct_k_nv_to_float_avx2(const NV* src, float* dst, size_t n) {
+  const __m256d fmax = _mm256_set1_pd(FLT_MAX);
+  const __m256d abs = _mm256_castsi256_pd(_mm256_set1_epi64x(IV_MAX));
+  size_t i;
+  for( i = 0; i + 4 <= n; i += 4 ) {
+    __m256d x = _mm256_loadu_pd(src + i);
+    if( _mm256_movemask_pd(_mm256_cmp_pd(_mm256_and_pd(x, abs), fmax,
+                                         _CMP_GT_OQ)) )
+      break;
+    _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(x));
+  }
+  return i + Ct_k_nv_to_float_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("avx2") static void
+Ct_k_float_to_nv_avx2(const float* src, NV* dst, size_t n) {
+  size_t i;
+  for( i = 0; i + 4 <= n; i += 4 )
+    _mm256_storeu_pd(dst + i, _mm256_cvtps_pd(_mm_loadu_ps(src + i)));
+  Ct_k_float_to_nv_scalar(src + i, dst + i, n - i);
+}
+
+Ct_TARGET("avx2") static void
+Ct_k_int_widen_avx2(const char* src, IV* dst, size_t n, int size,
+                    int is_signed) {
+  size_t i = 0;
+  __m128i x;
+  __m256i w;
+  if( size == 8 ) {
+    Copy(src, dst, n, IV);
+    return;
+  }
+  for( ; i + 4 <= n; i += 4 ) {
+    switch( size ) {
+      case 4:
+        x = _mm_loadu_si128((const __m128i*)(src + i * 4));
+        w = is_signed ? _mm256_cvtepi32_epi64(x) : _mm256_cvtepu32_epi64(x);
+        break;
+      case 2:
+        x = _mm_loadl_epi64((const __m128i*)(src + i * 2));
+        w = is_signed ? _mm256_cvtepi16_epi64(x) : _mm256_cvtepu16_epi64(x);
+        break;
+      default: {
+        int four;
+        Copy(src + i, &four, 1, int);
+        x = _mm_cvtsi32_si128(four);
+      }
+        w = is_signed ? _mm256_cvtepi8_epi64(x) : _mm256_cvtepu8_epi64(x);
+    }
+    _mm256_storeu_si256((__m256i*)(dst + i), w);
+  }
+  Ct_k_int_widen_scalar(src + i * size, dst + i, n - i, size, is_signed);
+}
+
+static const Ct_kernels_t Ct_kernels_avx2 = {
+  "avx2",
+  Ct_k_iv_narrow_avx2, Ct_k_nv_narrow_avx2, Ct_k_iv_to_nv_avx2,
+  Ct_k_nv_to_float_avx2, Ct_k_float_to_nv_avx2, Ct_k_int_widen_avx2
+};
+
+#endif  /* Ct_HAS_X86_SIMD */
+
+static const Ct_kernels_t* Ct_kernels = &Ct_kernels_scalar;
+
+/* The kernels for level ("scalar", "sse2" or "avx2"), or with NULL
+   the best this CPU runs; NULL if it can't run those asked for */
+const Ct_kernels_t*
+Ct_kernels_for(const char* level) {
+#ifdef Ct_HAS_X86_SIMD
+  __builtin_cpu_init();
+  if( (level == NULL || strEQ(level, "avx2"))
+      && __builtin_cpu_supports("avx2") )
+    return &Ct_kernels_avx2;
+  if( (level == NULL || strEQ(level, "sse2"))
+      && __builtin_cpu_supports("sse2") )
+    return &Ct_kernels_sse2;
+#endif
+  if( level == NULL || strEQ(level, "scalar") )
+    return &Ct_kernels_scalar;
+  return NULL;
+}
+
+#endif  /* _INC_SIMD_C */
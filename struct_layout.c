@@ -0,0 +1,251 @@
+/*###########################################################################
+## Name:        struct_layout.c
+## Purpose:     Native side of Struct class layouts: an FFI_TYPE_STRUCT
+##              ffi_type describing the fields, built once per class
+## Based on:    Python's ctypes-1.0.6 (StgDictObject's ffi_type_pointer)
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_STRUCT_LAYOUT_C
+#define _INC_STRUCT_LAYOUT_C
+
+#define Ct_ALIGN_UP(x, a) ( ((x) + (a) - 1) / (a) * (a) )
+
+static int Ct_layout_mg_free(pTHX_ SV* sv, MAGIC* mg);
+#ifdef USE_ITHREADS
+static int Ct_layout_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param);
+#else
+#define Ct_layout_mg_dup NULL
+#endif
+
+static MGVTBL Ct_layout_vtbl = {
+  NULL, NULL, NULL, NULL, Ct_layout_mg_free, NULL, Ct_layout_mg_dup
+#ifdef MGf_LOCAL
+  , NULL
+#endif
+};
+
+/* Layouts are shared between threads, so their refcounts only
+   change under the lock */
+void
+Ct_layout_hold(Ct_layout_t* layout) {
+  Ct_CLOSURES_LOCK;
+  layout->refcnt++;
+  Ct_CLOSURES_UNLOCK;
+}
+
+void
+Ct_layout_free(Ct_layout_t* layout) {
+  unsigned int i;
+  int left;
+  if( layout == NULL )
+    return;
+  Ct_CLOSURES_LOCK;
+  left = --layout->refcnt;
+  Ct_CLOSURES_UNLOCK;
+  if( left > 0 )
+    return;
+  for( i = 0; i < layout->nnested; i++ )
+    Ct_layout_free(layout->nested[i]);
+  Safefree(layout->nested);
+  Safefree(layout->elements);
+  Safefree(layout->klass);
+  Safefree(layout);
+}
+
+/* The compiled layout of a _Layout object, or NULL if it has none
+   (its Struct has fields libffi can't describe) */
+Ct_layout_t*
+Ct_layout_fetch(SV* sv) {
+  MAGIC* mg;
+  if( !SvROK(sv) )
+    return NULL;
+  mg = mg_findext(SvRV(sv), PERL_MAGIC_ext, &Ct_layout_vtbl);
+  return mg != NULL ? (Ct_layout_t*)mg->mg_ptr : NULL;
+}
+
+/* One [ element, offset ] entry of a layout spec. The element is a
+   sizecode or a nested _Layout object; returns its ffi_type, and the
+   nested layout in *nested if it is one */
+static ffi_type*
+Ct_layout_element(AV* spec, I32 i, Ct_layout_t** nested, size_t* offset) {
+  SV** fetched;
+  AV* pair;
+  char code;
+
+  fetched = av_fetch(spec, i, 0);
+  if( fetched == NULL || !SvROK(*fetched)
+      || SvTYPE(SvRV(*fetched)) != SVt_PVAV
+      || av_len((AV*)SvRV(*fetched)) != 1 )
+    croak("Struct layout: element %i must be [ type, offset ]", (int)i);
+  pair = (AV*)SvRV(*fetched);
+  *offset = SvUV(*av_fetch(pair, 1, 0));
+  fetched = av_fetch(pair, 0, 0);
+  *nested = NULL;
+  if( SvROK(*fetched) ) {
+    if( (*nested = Ct_layout_fetch(*fetched)) == NULL )
+      croak("Struct layout: element %i is a Struct with no native layout",
+            (int)i);
+    return &(*nested)->type;
+  }
+  code = *SvPV_nolen(*fetched);
+  if( code == 'v' )
+    croak("Struct layout: element %i can't be void", (int)i);
+  return Ct_typedesc(code)->ffi;
+}
+
+/* Describe a Struct of SIZE bytes to libffi. Each element's offset is
+   checked against where a C compiler would put it; if they all agree
+   the Struct can be passed by value. Everything that can croak is
+   checked before anything is allocated. */
+Ct_layout_t*
+Ct_layout_compile(size_t size, AV* spec) {
+  Ct_layout_t *layout, *nested;
+  ffi_type* t;
+  size_t offset, natural = 0;
+  unsigned short align = 1;
+  I32 i, n = av_len(spec) + 1;
+
+  for( i = 0; i < n; i++ )
+    (void)Ct_layout_element(spec, i, &nested, &offset);
+
+  Newxz(layout, 1, Ct_layout_t);
+  Newx(layout->elements, n + 1, ffi_type*);
+  Newx(layout->nested, n ? n : 1, Ct_layout_t*);
+  layout->refcnt = 1;
+  layout->byvalue = n > 0;
+  for( i = 0; i < n; i++ ) {
+    t = Ct_layout_element(spec, i, &nested, &offset);
+    if( nested != NULL ) {
+      Ct_layout_hold(nested);
+      layout->nested[layout->nnested++] = nested;
+      if( !nested->byvalue )
+        layout->byvalue = 0;
+    }
+    natural = Ct_ALIGN_UP(natural, t->alignment);
+    if( natural != offset )
+      layout->byvalue = 0;
+    natural += t->size;
+    if( t->alignment > align )
+      align = t->alignment;
+    layout->elements[i] = t;
+  }
+  layout->elements[n] = NULL;
+  if( Ct_ALIGN_UP(natural, align) != size )
+    layout->byvalue = 0;
+  debug_warn( "#[%s:%i] Struct layout: %i elements, size %i, align %i, %s",
+              __FILE__, __LINE__, (int)n, (int)size, align,
+              layout->byvalue ? "by value ok" : "not by value" );
+
+  /* Preset, so ffi_prep_cif won't recompute them with its own padding */
+  layout->type.size = size;
+  layout->type.alignment = align;
+  layout->type.type = FFI_TYPE_STRUCT;
+  layout->type.elements = layout->elements;
+  return layout;
+}
+
+/* The layout of a Struct used as a by-value type: an instance of a
+   Struct subclass with _fields_ that libffi can describe. Returns it
+   with a reference taken for the caller. */
+Ct_layout_t*
+Ct_struct_layout_of(SV* type_sv) {
+  SV** fetched;
+  Ct_layout_t* layout;
+
+  fetched = SvTYPE(SvRV(type_sv)) == SVt_PVHV
+    ? hv_fetchs((HV*)SvRV(type_sv), "_layout", 0) : NULL;
+  if( fetched == NULL || !SvROK(*fetched) )
+    croak("Ctypes: only Struct subclasses with _fields_ can be passed by value");
+  layout = Ct_layout_fetch(*fetched);
+  if( layout == NULL || !layout->byvalue )
+    croak("Ctypes: %s can't be passed by value (libffi can't describe "
+          "its layout)", sv_reftype(SvRV(type_sv), 1));
+  Ct_layout_hold(layout);
+  return layout;
+}
+
+/* The bytes of obj, which must be an instance of layout's Struct
+   class. Outermost Structs are read in place. */
+char*
+Ct_struct_data(SV* obj, Ct_layout_t* layout) {
+  SV **fetched, *data = NULL;
+
+  if( Ct_Obj_IsDeriv(obj, "Ctypes::Type::Struct")
+      && SvTYPE(SvRV(obj)) == SVt_PVHV
+      && (fetched = hv_fetchs((HV*)SvRV(obj), "_layout", 0)) != NULL
+      && Ct_layout_fetch(*fetched) == layout ) {
+    data = Ct_Obj_NativeData(obj);
+    if( data == NULL ) {
+      data = Ct_CallPerlObjMethod(obj, "data", NULL);
+      if( data != NULL ) {
+        sv_2mortal(data);
+        if( SvROK(data) )
+          data = SvRV(data);
+      }
+    }
+  }
+  if( data == NULL || !SvPOK(data) || SvCUR(data) < layout->type.size )
+    croak("Ctypes: expected a %s object to pass by value", layout->klass);
+  return SvPVX(data);
+}
+
+/* A new layout->klass object holding a copy of bytes */
+SV*
+Ct_struct_from_bytes(Ct_layout_t* layout, const void* bytes) {
+  SV* result;
+  int count;
+  dSP;
+
+  ENTER;
+  SAVETMPS;
+  PUSHMARK(SP);
+  XPUSHs(sv_2mortal(newSVpv(layout->klass, 0)));
+  XPUSHs(sv_2mortal(newSVpvn((const char*)bytes, layout->type.size)));
+  PUTBACK;
+  count = call_pv("Ctypes::Type::Struct::_from_bytes", G_SCALAR);
+  SPAGAIN;
+  if( count != 1 )
+    croak("Ctypes: couldn't make a %s object", layout->klass);
+  result = newSVsv(POPs);
+  PUTBACK;
+  FREETMPS;
+  LEAVE;
+  return result;
+}
+
+/* Tie layout's lifetime to sv (a _Layout object's HV); takes over one
+   reference */
+void
+Ct_layout_attach(SV* sv, Ct_layout_t* layout) {
+  MAGIC* mg;
+  mg = sv_magicext(sv, NULL, PERL_MAGIC_ext, &Ct_layout_vtbl,
+                   (const char*)layout, 0);
+#ifdef USE_ITHREADS
+  mg->mg_flags |= MGf_DUP;
+#else
+  PERL_UNUSED_VAR(mg);
+#endif
+}
+
+static int
+Ct_layout_mg_free(pTHX_ SV* sv, MAGIC* mg) {
+  PERL_UNUSED_ARG(sv);
+  Ct_layout_free((Ct_layout_t*)mg->mg_ptr);
+  mg->mg_ptr = NULL;
+  return 0;
+}
+
+#ifdef USE_ITHREADS
+/* Nothing in a layout is Perl data, so threads can share it */
+static int
+Ct_layout_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param) {
+  PERL_UNUSED_ARG(param);
+  Ct_layout_hold((Ct_layout_t*)mg->mg_ptr);
+  return 0;
+}
+#endif
+
+#endif  /* _INC_STRUCT_LAYOUT_C */
@@ -0,0 +1,101 @@
+/*###########################################################################
+## Name:        stubs.c
+## Purpose:     Registry of direct-call stubs built at run time by
+##              Ctypes::Stub, consulted alongside the generated thunks
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_STUBS_C
+#define _INC_STUBS_C
+
+/* Process-wide: a loaded stub works for every interpreter. Entries'
+   sigs are the abi character followed by the signature. */
+static Ct_thunk_t* Ct_stubs = NULL;
+static unsigned int Ct_nstubs = 0;
+#ifdef USE_ITHREADS
+static perl_mutex Ct_stubs_mutex;
+#endif
+
+#ifdef USE_ITHREADS
+#define Ct_STUBS_LOCK   MUTEX_LOCK(&Ct_stubs_mutex)
+#define Ct_STUBS_UNLOCK MUTEX_UNLOCK(&Ct_stubs_mutex)
+#else
+#define Ct_STUBS_LOCK   NOOP
+#define Ct_STUBS_UNLOCK NOOP
+#endif
+
+/* The registered stub for abi and the signature rcode, codes */
+Ct_thunk_fn
+Ct_stub_find(char abi, char rcode, unsigned int nargs, const char* codes) {
+  Ct_thunk_fn found = NULL;
+  unsigned int i;
+  const char* sig;
+
+  Ct_STUBS_LOCK;
+  for( i = 0; i < Ct_nstubs && found == NULL; i++ ) {
+    sig = Ct_stubs[i].sig;
+    if( sig[0] == abi && sig[1] == rcode && strlen(sig + 2) == nargs
+        && memEQ(sig + 2, codes, nargs) )
+      found = Ct_stubs[i].thunk;
+  }
+  Ct_STUBS_UNLOCK;
+  return found;
+}
+
+void
+Ct_stub_register(char abi, const char* sig, Ct_thunk_fn stub) {
+  char* key;
+  STRLEN len = strlen(sig);
+
+  if( len == 0 || Ct_stub_find(abi, sig[0], len - 1, sig + 1) != NULL )
+    return;
+  key = (char*)PerlMemShared_malloc(len + 2);
+  key[0] = abi;
+  Copy(sig, key + 1, len + 1, char);
+  Ct_STUBS_LOCK;
+  Ct_stubs = (Ct_thunk_t*)PerlMemShared_realloc
+    (Ct_stubs, (Ct_nstubs + 1) * sizeof(Ct_thunk_t));
+  Ct_stubs[Ct_nstubs].sig = key;
+  Ct_stubs[Ct_nstubs].thunk = stub;
+  Ct_nstubs++;
+  Ct_STUBS_UNLOCK;
+  debug_warn( "#[%s:%i] Registered stub for %c '%s'",
+              __FILE__, __LINE__, abi, sig );
+}
+
+/* Ask Ctypes::Stub for a stub for the signature, if it's enabled;
+   returns the stub or NULL. Calls Perl, so only for use where the
+   stack can move (compiling a plan, not mid-call). */
+Ct_thunk_fn
+Ct_stub_want(char abi, char rcode, unsigned int nargs, const char* codes) {
+  SV* dir = get_sv("Ctypes::Stub::DIR", 0);
+  char sig[nargs + 2];
+  int count;
+  dSP;
+
+  if( dir == NULL || !SvTRUE(dir) )
+    return NULL;
+  sig[0] = rcode;
+  Copy(codes, sig + 1, nargs, char);
+  sig[nargs + 1] = '\0';
+
+  ENTER;
+  SAVETMPS;
+  PUSHMARK(SP);
+  XPUSHs(sv_2mortal(newSVpvn(&abi, 1)));
+  XPUSHs(sv_2mortal(newSVpv(sig, 0)));
+  PUTBACK;
+  /* A stub is only ever an optimization: never let it fail the call */
+  count = call_pv("Ctypes::Stub::_load", G_SCALAR | G_EVAL);
+  SPAGAIN;
+  if( count == 1 )
+    (void)POPs;
+  PUTBACK;
+  FREETMPS;
+  LEAVE;
+  return Ct_stub_find(abi, rcode, nargs, codes);
+}
+
+#endif  /* _INC_STUBS_C */
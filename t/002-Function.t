@@ -1,6 +1,6 @@
 #!perl
 
-use Test::More tests => 6;
+use Test::More tests => 39;
 use Ctypes::Function;
 use Ctypes;
 
@@ -35,3 +35,139 @@ is( $ret, ord("Y"), 'Function returns native type instead of Type object');
 
 $ret = $to_upper2->( c_int("y") );
 is( $ret, ord("Y"), 'implicit c_char => c_int conversion');
+
+# The compiled call plan is reused, and rebuilt when the signature changes
+is( $to_upper->( ord("a") ), ord("A"), 'second call through cached plan' );
+$to_upper->restype('v');
+ok( !defined $to_upper->( $y ), 'restype change seen by next call' );
+$to_upper->update({ restype => 'i', argtypes => [ 'i', 'i' ] });
+eval { $to_upper->( $y ) };
+like( $@, qr/specified 2 arguments but supplied 1/, 'update() recompiles plan' );
+$to_upper->update({ argtypes => [ 'i' ] });
+is( $to_upper->( $y ), ord("Y"), 'plan rebuilt after second update' );
+$to_upper->{restype} = 'v';
+$to_upper->update;
+ok( !defined $to_upper->( $y ), 'update() picks up direct assignments' );
+$to_upper->{restype} = 'i';
+$to_upper->update;
+
+# attach() installs a native sub bound to the compiled plan
+my $sub = $to_upper->attach('Mylib::toupper');
+is( Mylib::toupper( $y ), ord("Y"), 'attached sub callable by name' );
+is( $sub->( ord("q") ), ord("Q"), 'attach returns the sub' );
+$to_upper->update({ restype => 'v' });
+is( Mylib::toupper( $y ), ord("Y"), 'attached sub keeps its own plan' );
+$to_upper->restype('i');
+$to_upper->attach();
+is( toupper( ord("b") ), ord("B"), 'attach defaults to caller::name' );
+eval { Mylib::toupper( 1, 2 ) };
+like( $@, qr/specified 1 arguments but supplied 2/, 'attached sub checks arg count' );
+
+# call_many() runs a whole batch through one XS entry
+my $lower = [ map { ord } qw(a b c d) ];
+is_deeply( $to_upper->call_many($lower), [ map { ord } qw(A B C D) ],
+           'call_many over a Perl array' );
+my $in = Array( c_int, $lower );
+my $out = Array( c_int, [ 0, 0, 0, 0 ] );
+$to_upper->call_many( $in, { out => $out } );
+is( join(",", @$out), join(",", map { ord } qw(A B C D)),
+    'call_many from Ctypes Array into Ctypes Array' );
+eval { $to_upper->call_many( $lower, $lower ) };
+like( $@, qr/specified 1 arguments but supplied 2/, 'call_many checks column count' );
+
+# Type objects are read directly; user classes go through _as_param_
+{
+  package My::Int;
+  sub new { bless { _typecode => 'i', v => $_[1] }, $_[0] }
+  sub _as_param_ { my $p = pack('i', $_[0]{v}); \$p }
+}
+is( Mylib::toupper( c_int(ord "k") ), ord("K"), 'c_int object argument' );
+is( Mylib::toupper( My::Int->new(ord "m") ), ord("M"),
+    'user class falls back to _as_param_' );
+
+# long long arguments and returns don't go through doubles
+my $llabs = Ctypes::Function->new
+  ( { lib => 'c', name => 'llabs', argtypes => 'q', restype => 'q' } );
+is( $llabs->(-9007199254740993), 9007199254740993, 'long long in and out' );
+is( $llabs->( c_longlong(-9007199254740993) ), 9007199254740993,
+    'c_longlong object argument' );
+my $strtoull = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtoull', argtypes => 'ppi', restype => 'Q' } );
+is( $strtoull->( "18446744073709551615", 0, 10 ), 18446744073709551615,
+    'unsigned long long return' );
+
+# attach( { op => 1 } ) compiles calls into a custom op
+BEGIN {
+  Ctypes::Function->new
+    ( { lib => 'c', name => 'labs', argtypes => 'l', restype => 'l' } )
+    ->attach( 'Mylib::labs', { op => 1 } );
+}
+use B;
+sub op_names {
+  my $op = shift;
+  my @names;
+  for( ; $op && $$op; $op = $op->sibling ) {
+    push @names, $op->name;
+    push @names, op_names( $op->first ) if $op->flags & B::OPf_KIDS;
+  }
+  return @names;
+}
+my $labs_caller = sub { Mylib::labs( $_[0] ) };
+SKIP: {
+  skip "no custom ops before perl 5.14", 1 if $] < 5.014;
+  ok( ( grep { $_ eq 'ctypes_attached' }
+        op_names( B::svref_2object($labs_caller)->ROOT ) ),
+      'call compiled to the ctypes_attached op' );
+}
+is_deeply( [ $labs_caller->(-42), Mylib::labs(7) ], [ 42, 7 ],
+           'op-mode calls return their results' );
+{
+  no warnings 'redefine';
+  *Mylib::labs = sub { 'perl' };
+}
+is( $labs_caller->(-1), 'perl', 'redefined subs are called normally' );
+
+# Signatures in Makefile.PL's THUNKS list skip ffi_call
+my $atoi = Ctypes::Function->new
+  ( { lib => 'c', name => 'atoi', argtypes => 'p', restype => 'i' } );
+is( $atoi->("-1234"), -1234, 'thunk-able signature called' );
+my $strtol = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtol', argtypes => 'ppi', restype => 'l' } );
+is( $strtol->("-77", 0, 10), -77, 'other signatures still use libffi' );
+
+# Tiers: counted calls, promotion at the threshold
+my $strtol2 = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtol', argtypes => 'ppi', restype => 'l' } );
+is( $strtol2->tier, 'none', 'no tier before the first call' );
+$strtol2->("1", 0, 10) for 1..3;
+is( $strtol2->tier . "/" . $strtol2->calls, 'cif/3', 'ffi_call tier, calls counted' );
+is( $atoi->tier, 'direct', 'thunked function is on the direct tier' );
+
+my $labs2 = Ctypes::Function->new
+  ( { lib => 'c', name => 'labs', argtypes => 'l', restype => 'l' } );
+$labs2->promote_after(3);
+is( $labs2->promote_after, 3, 'per-function threshold' );
+$labs2->attach('main::hot_labs', { op => 'auto' });
+# Call sites are only made ops as they're compiled
+eval 'sub run_hot_labs { my $s = 0; $s += hot_labs(-$_) for 1..5; $s } 1'
+  or die $@;
+is( run_hot_labs(), 15, 'op => auto sub called' );
+SKIP: {
+  skip 'custom ops need perl 5.14', 3 if $] < 5.014;
+  is( $labs2->tier, 'op', 'hot call site promoted to an op' );
+  is( run_hot_labs(), 15, 'promoted call site still right' );
+  no warnings 'redefine';
+  *main::hot_labs = sub { 1 };
+  is( run_hot_labs(), 5, 'promoted call site follows redefinition' );
+}
+
+# Small integer returns come back narrowed from libffi's ffi_arg, and a
+# function declared with no arguments takes none
+my $abs = Ctypes::Function->new
+  ( { lib => 'c', name => 'abs', argtypes => 'i', restype => 'c' } );
+is( $abs->( -300 ), 44, 'char return narrowed' );
+my $getpid = Ctypes::Function->new
+  ( { lib => 'c', name => 'getpid', argtypes => '', restype => 'i' } );
+eval { $getpid->( 1 ) };
+like( $@, qr/specified 0 arguments but supplied 1/,
+      'no argtypes is a signature too' );
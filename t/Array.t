@@ -1,9 +1,12 @@
 #!perl
 
-use Test::More tests => 12;
+BEGIN { unshift @INC, './t' }
+
+use Test::More tests => 17;
 use Ctypes;
 use Ctypes::Function;
 use Ctypes::Callback;
+use t_POINT;
 
 note( "Initialization" );
 
@@ -63,3 +66,176 @@ subtest 'Multidimensional' => sub {
   is( $$multi[1][2], 8 );
   is( $$multi[2][4], 15 );
 };
+
+subtest 'Packed buffer' => sub {
+  plan tests => 14;
+  my $big = Array( c_double, [ (0) x 100_000 ] );
+  is( length(${$big->data}), 100_000 * Ctypes::sizeof('d'), 'one buffer' );
+  $big->set_from( [ map { $_ / 2 } 0 .. 99_999 ] );
+  is( $big->[99_999], 49_999.5, 'set_from' );
+  is_deeply( [ $big->slice(-2) ], [ 49_999, 49_999.5 ], 'slice from end' );
+  is_deeply( [ $big->slice(10, 3) ], [ 5, 5.5, 6 ], 'slice' );
+  my @all = $big->to_list;
+  is( scalar @all, 100_000, 'to_list' );
+  $big->fill( 3, 5, 2 );
+  is_deeply( [ $big->slice(4, 4) ], [ 2, 3, 3, 3.5 ], 'fill' );
+
+  my $ints = Array( c_int, [ 1, 2, 3 ] );
+  my $second = $ints->member(1);
+  isa_ok( $second, 'Ctypes::Type::Simple', 'member on demand' );
+  $$second = 20;
+  is( $ints->[1], 20, 'member writes through' );
+  $ints->[1] = 30;
+  is( $$second, 30, 'member reads through' );
+  $ints->[4] = 5;
+  is_deeply( [ @$ints ], [ 1, 30, 3, 0, 5 ], 'storing past the end grows' );
+  is( length(${$ints->data}), 5 * Ctypes::sizeof('i'), 'and so does the buffer' );
+
+  my @warnings;
+  local $SIG{__WARN__} = sub { push @warnings, @_ };
+  my $shorts = Array( c_short, [ 0, 0 ] );
+  $shorts->set_from( [ 70000, 1 ] );
+  like( $warnings[0], qr/-32768 <= x <= 32767 \(got 70000 at index 0\)/,
+        'range checked' );
+  Ctypes::Type::strict_input_all(1);
+  eval { $shorts->[1] = 1.5 };
+  Ctypes::Type::strict_input_all(0);
+  like( $@, qr/numeric values must be integers/, 'strict_input_all dies' );
+  is( $shorts->[1], 1, 'rejected value not stored' );
+};
+
+subtest 'Conversion kernels' => sub {
+  my @levels = grep { eval { Ctypes::Type::Array::_simd($_); 1 } }
+               qw|scalar sse2 avx2|;
+  plan tests => 6 * @levels;
+  my $best = Ctypes::Type::Array::_simd();
+  my @ints = map { $_ * 37 - 5000 } 0 .. 599;
+  my @halves = map { $_ / 2 } 0 .. 599;
+  for my $level (@levels) {
+    Ctypes::Type::Array::_simd($level);
+    my $shorts = Array( c_short, [ (0) x 600 ] );
+    $shorts->set_from( \@ints );
+    is_deeply( [ $shorts->to_list ], \@ints, "$level: int to short" );
+    my $uchars = Array( c_ubyte, [ (0) x 600 ] );
+    $uchars->set_from( [ map { $_ % 256 } @ints ] );
+    is_deeply( [ $uchars->to_list ], [ map { $_ % 256 } @ints ],
+               "$level: int to unsigned char" );
+    my $doubles = Array( c_double, [ (0) x 600 ] );
+    $doubles->set_from( \@ints );
+    is_deeply( [ $doubles->to_list ], \@ints, "$level: int to double" );
+    my $floats = Array( c_float, [ (0) x 600 ] );
+    $floats->set_from( \@halves );
+    is_deeply( [ $floats->to_list ], \@halves, "$level: double to float" );
+
+    my @warnings;
+    local $SIG{__WARN__} = sub { push @warnings, @_ };
+    my $chars = Array( c_byte, [ (0) x 600 ] );
+    $chars->set_from( [ (1) x 299, 200, 2.5, (1) x 299 ] );
+    like( $warnings[0], qr/got 200 at index 299, and 1 more/,
+          "$level: out of range found" );
+    is_deeply( [ $chars->slice(298, 3) ], [ 1, -56, 2 ],
+               "$level: and stored as before" );
+  }
+  Ctypes::Type::Array::_simd($best);
+};
+
+subtest 'Views' => sub {
+  plan tests => 12;
+  my $bytes = pack( 'i*', 1 .. 6 );
+  my $ints = Ctypes::Type::Array->view( c_int, \$bytes );
+  is( $ints->length, 6, 'as many as fit' );
+  is_deeply( [ @$ints ], [ 1 .. 6 ], 'view' );
+  $ints->[0] = 10;
+  is( ( unpack 'i', $bytes ), 10, 'writes go to the string' );
+  eval { $ints->[6] = 7 };
+  like( $@, qr/not allowed to resize/, "views don't grow" );
+  my $tail = Ctypes::Type::Array->view( c_int, \$bytes, 2, 16 );
+  is_deeply( [ $tail->to_list ], [ 5, 6 ], 'count and offset' );
+  my $points = Ctypes::Type::Array->view( 't_POINT', \$bytes );
+  is( scalar @$points, 3, 'Structs' );
+  isa_ok( $points->[1], 't_POINT' );
+  $points->[2]->{y} = 60;
+  is( $ints->[5], 60, 'Struct elements are views too' );
+  my $copy = $ints->copy;
+  $copy->[1] = 20;
+  is( $ints->[1], 2, 'copies have their own data' );
+  my $at = Ctypes::Type::Array->from_address
+    ( c_int, unpack( 'J', pack( 'p', $bytes ) ), 6 );
+  is( $at->[5], 60, 'from_address' );
+  my $members = \@{ Array( c_int, [ 1, 2, 3 ] ) };
+  is( $members->[1], 2, "an ordinary Array's members outlive it" );
+  $members = \@{ Ctypes::Type::Array->view( c_int, \$bytes ) };
+  eval { $members->[1] };
+  like( $@, qr/after the Array was destroyed/, "a view's don't" );
+};
+
+subtest 'Cursors' => sub {
+  plan tests => 12;
+  my $bytes = pack( 'i*', map { ( $_, 10 * $_ ) } 0 .. 4 );
+  my $points = Ctypes::Type::Array->view( 't_POINT', \$bytes );
+  my $c = $points->cursor;
+  isa_ok( $c, 't_POINT' );
+  is( $c->position, -1, 'starts before the first record' );
+  my @ys;
+  while( my $p = $c->next ) {
+    push @ys, $p->{y};
+  }
+  is_deeply( \@ys, [ 0, 10, 20, 30, 40 ], 'next' );
+  is( $c->position, 5, 'ends after the last' );
+  ok( !$c->next, 'and stays there' );
+  $c->seek(-2);
+  is_deeply( [ $c->position, $c->{x} ], [ 3, 3 ], 'seek' );
+  $c->{y} = 33;
+  is( ( unpack 'i*', $bytes )[7], 33, 'writes go to the record' );
+  is( $points->cursor(1)->[1], 10, 'starting at an index' );
+  eval { $c->seek(5) };
+  like( $@, qr/out of range/, 'seeks stay in the Array' );
+  eval { Ctypes::Type::Array->new( c_int, [ 1 ] )->cursor };
+  like( $@, qr/Arrays of Structs/, 'only Arrays of Structs' );
+  {
+    package t_LONGS;
+    use Ctypes;
+    our @ISA = qw|Ctypes::Type::Struct|;
+    our $_fields_ = [ l => c_long, u => c_ulong ];
+  }
+  my $longs = pack( 'l! L!', -2**31 + 1, 2**31 + 5 );
+  my $lc = Ctypes::Type::Array->view( 't_LONGS', \$longs )->cursor(0);
+  is_deeply( [ $lc->{l}, $lc->{u} ], [ -2**31 + 1, 2**31 + 5 ],
+             'longs are native' );
+  if( Ctypes::sizeof('l') > 4 ) {
+    $longs = pack( 'l! L!', -5_000_000_000, 5_000_000_000 );
+    $lc = Ctypes::Type::Array->view( 't_LONGS', \$longs )->cursor(0);
+    is_deeply( [ $lc->{l}, $lc->{u} ], [ -5_000_000_000, 5_000_000_000 ],
+               'wider than 32 bits where they are' );
+  }
+  else {
+    pass( 'longs are 32 bits here' );
+  }
+};
+
+subtest 'mmap' => sub {
+  plan skip_all => 'no mmap here' if $^O eq 'MSWin32';
+  plan tests => 7;
+  require File::Temp;
+  my( $fh, $path ) = File::Temp::tempfile( UNLINK => 1 );
+  binmode $fh;
+  print $fh pack( 'i*', map { ( $_, -$_ ) } 0 .. 99 );
+  close $fh;
+  my $points = Ctypes::Type::Array->mmap( $path, 't_POINT',
+                                          advise => 'sequential' );
+  is( scalar @$points, 100, 'one element per record' );
+  is( $points->[42]->{y}, -42, 'records read in place' );
+  eval { $points->[42]->{y} = 1 };
+  like( $@, qr/read-only/, 'read-only by default' );
+  ok( $points->advise('random'), 'advise' );
+  my $rw = Ctypes::Type::Array->mmap( $path, 't_POINT', mode => 'rw' );
+  $rw->[7]->{x} = 700;
+  is( $points->[7]->{x}, 700, 'rw writes are seen by other mappings' );
+  undef $rw;
+  open $fh, '<', $path or die $!;
+  binmode $fh;
+  local $/;
+  is( ( unpack 'i*', <$fh> )[14], 700, 'and go to the file' );
+  my $ints = Ctypes::Type::Array->mmap( $path, c_int );
+  is( $ints->[15], -7, 'any type a view can have' );
+};
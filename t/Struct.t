@@ -2,7 +2,7 @@
 
 BEGIN { unshift @INC, './t' }
 
-use Test::More tests => 89;
+use Test::More tests => 107;
 use Ctypes;
 use Ctypes::Type::Struct;
 use Data::Dumper;
@@ -213,3 +213,55 @@ is( $total, 165 );
 $$stct->{array}->[0] = 60;
 is( $stct->fields->[1], '<Field type=short_Array, ofs=4, size=10>' );
 is( $stct->fields->[1]->[0], 60 );
+
+note( 'Native buffer' );
+
+is( $struct->data, $struct->data, '->data gives the buffer itself, not a copy' );
+is( ${$garden->data},
+    substr( ${$home->data}, $home->fields->{garden}->index, $garden->size ),
+    'Nested Structs are views on their outer Struct\'s buffer' );
+my $memset = Ctypes::Function->new
+  ( { lib => 'c', name => 'memset', argtypes => 'piL', restype => 'p' } );
+$memset->( $struct, 0, $struct->size );
+is( $struct->[1], 0, 'Writes by C functions are seen by fields' );
+
+note( 'Class layouts' );
+
+my $layout = Ctypes::Type::Struct::_Layout::of('t_POINT');
+is_deeply( $layout->{_offsets}, [ 0, Ctypes::sizeof('i') ],
+           't_POINT offsets computed once for the class' );
+is( $layout->{_size}, 2 * Ctypes::sizeof('i') );
+ok( $layout->{_byvalue}, 'Two ints are laid out as C would' );
+$point->{x} = 31;
+is( $point_2->{x}, 40, 'Instances sharing a layout have their own buffers' );
+
+note( 'By value' );
+
+my $div = Ctypes::Function->new
+  ( { lib => 'c', name => 'div', argtypes => 'ii', restype => t_POINT->new } );
+my $qr = $div->( 7, 2 );
+isa_ok( $qr, 't_POINT', 'Struct returned by value' );
+is( "$qr->{x} $qr->{y}", '3 1', 'div_t read as t_POINT' );
+my $by_value = Ctypes::Function->new
+  ( { func => $div->func, argtypes => [ t_POINT->new ], restype => 'i' } );
+eval { $by_value->( 5 ) };
+like( $@, qr/expected a t_POINT object/, 'By value args must be of the class' );
+
+note( 'Views' );
+
+my $packed = pack( 'i*', 1, 2, 3, 4 );
+my $view = t_POINT->from_buffer( \$packed, Ctypes::sizeof('i') * 2 );
+isa_ok( $view, 't_POINT', 'from_buffer' );
+is( "$view->{x} $view->{y}", '3 4', 'Fields read the string in place' );
+$view->{y} = 40;
+is( ( unpack 'i*', $packed )[3], 40, 'Fields write the string in place' );
+substr( $packed, 8, 4 ) = pack( 'i', 30 );
+is( $view->{x}, 30, 'Writes to the string are seen by the view' );
+undef $packed;
+is( $view->{y}, 40, 'The view keeps the buffer after the string lets go' );
+my $at = t_POINT->from_address( unpack( 'J', pack( 'p', ${$view->data} ) ) );
+is( $at->{x}, 30, 'from_address' );
+eval { t_POINT->from_buffer( \"abc" ) };
+like( $@, qr/read-only/, 'Read-only strings can\'t be viewed' );
+eval { t_POINT->from_buffer( \( my $short = 'abc' ) ) };
+like( $@, qr/can't view 8 bytes/, 'Views must fit in the string' );
@@ -0,0 +1,133 @@
+#!perl
+
+use Test::More;
+use Config;
+use Time::HiRes qw|time|;
+use Ctypes;
+use Ctypes::Function;
+use Ctypes::Callback;
+
+plan skip_all => 'call_async needs pthreads'
+  if $^O eq 'MSWin32' or !$Config{i_pthread};
+plan tests => 22;
+
+is( Ctypes::Function->async_threads(2), 2, 'pool size set' );
+
+my $labs = Ctypes::Function->new
+  ( { lib => 'c', name => 'labs', argtypes => 'l', restype => 'l' } );
+my $call = $labs->call_async(-42);
+isa_ok( $call, 'Ctypes::Function::Async' );
+is( $call->result, 42, 'result of a call on the pool' );
+ok( $call->ready, 'ready once finished' );
+
+# Completion shows up on the fd
+my $rin = '';
+vec($rin, $call->fd, 1) = 1;
+is( select(my $rout = $rin, undef, undef, 5), 1, 'fd readable when done' );
+
+# Blocking calls run concurrently, off the interpreter thread
+my $usleep = Ctypes::Function->new
+  ( { lib => 'c', name => 'usleep', argtypes => 'I', restype => 'i' } );
+my $start = time;
+my @sleeps = map { $usleep->call_async(1_200_000) } 1..2;
+ok( !$sleeps[0]->ready, 'not ready while the call blocks' );
+$_->wait for @sleeps;
+cmp_ok( time - $start, '<', 2.2, 'two 1.2s calls overlapped' );
+
+# Pointer arguments stay alive with the handle
+my $strtol = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtol', argtypes => 'ppi', restype => 'l' } );
+my $parse = $strtol->call_async("-1234", 0, 10);
+is( $parse->result, -1234, 'string argument passed by pointer' );
+
+# Argtype-less functions get the signature from their arguments
+my $abs = Ctypes::Function->new( { lib => 'c', name => 'abs' } );
+is( $abs->call_async(-7)->result, 7, 'signature from the arguments' );
+
+# Many in flight at once
+my @calls = map { $labs->call_async(-$_) } 1..50;
+my $sum = 0;
+$sum += $_->result for @calls;
+is( $sum, 1275, '50 calls in flight' );
+
+eval { $labs->call_async(1, 2) };
+like( $@, qr/specified 1 arguments but supplied 2/, 'bad arity croaks' );
+
+# parallel_map: chunks of a packed Array on the pool
+my $n = 300;
+my $in = Array( c_int, [ map { -$_ } 1..$n ] );
+my $out = Array( c_int, [ (0) x $n ] );
+my $iabs = Ctypes::Function->new
+  ( { lib => 'c', name => 'abs', argtypes => 'i', restype => 'i' } );
+is( Ctypes::parallel_map( $iabs, $in, $out, threads => 3 ), $out,
+    'parallel_map returns out' );
+is( $out->[0] + $out->[149] + $out->[$n-1], 1 + 150 + $n,
+    'every chunk mapped' );
+is( $iabs->calls, $n, 'each element counted as a call' );
+
+my $sqrt = Ctypes::Function->new
+  ( { lib => 'm', name => 'sqrt', argtypes => 'd', restype => 'd' } );
+my $squares = Array( c_double, [ map { $_ * $_ } 1..7 ] );
+my $roots = Array( c_double, [ (0) x 7 ] );
+Ctypes::parallel_map( $sqrt, $squares, $roots );
+is( join(',', @$roots), '1,2,3,4,5,6,7', 'doubles, default threads' );
+
+eval { Ctypes::parallel_map( $iabs, $squares, $out ) };
+like( $@, qr/input Array holds 'd' but argument is 'i'/, 'type mismatch croaks' );
+
+# Callbacks called on a worker run on this thread
+my $qsort = Ctypes::Function->new
+  ( { lib => 'c', name => 'qsort', argtypes => 'piip', restype => 'v' } );
+my $compares = 0;
+my $by_value = Ctypes::Callback->new
+  ( sub { $compares++; $_[0] <=> $_[1] }, 'i', 'ii' );
+my $ints = pack( 'i*', 5, 3, 9, 1, 7, 2 );
+$call = $qsort->call_async( \$ints, 6, 4, $by_value->ptr );
+$call->wait;
+is( join(',', unpack('i*', $ints)), '1,2,3,5,7,9',
+    'worker waits for a Perl comparator' );
+ok( $compares > 0, 'comparator ran on the interpreter thread' );
+
+# Queued calls return at once and wait for dispatch_pending
+my @seen;
+my $noting = Ctypes::Callback->new
+  ( sub { push @seen, $_[0]; 0 }, 'i', 'ii', 'queue' );
+$ints = pack( 'i*', 4, 8, 6 );
+$call = $qsort->call_async( \$ints, 3, 4, $noting->ptr );
+$rin = '';
+vec($rin, $call->fd, 1) = 1;
+select(undef, undef, undef, 0.01) until select(my $done = $rin, undef, undef, 5);
+is( scalar @seen, 0, 'queued calls not run yet' );
+$rin = '';
+vec($rin, Ctypes::Callback::pending_fd(), 1) = 1;
+is( select(my $pending = $rin, undef, undef, 5), 1, 'pending_fd readable' );
+my $ran = Ctypes::Callback::dispatch_pending();
+ok( $ran > 0 && $ran == @seen && !grep( { !/^[468]$/ } @seen ),
+    'dispatch_pending runs them with copied arguments' );
+
+# A thread's queue goes with it, pipe and all
+SKIP: {
+  skip 'needs ithreads and /proc/self/fd', 1
+    unless $Config{useithreads} and -d '/proc/self/fd';
+  require File::Temp;
+  my $script = File::Temp->new( SUFFIX => '.pl' );
+  print $script <<'EOT';
+use threads;
+use Ctypes::Callback;
+sub fds { opendir my $d, '/proc/self/fd' or die $!; grep { !/^\./ } readdir $d }
+sub with_callback {
+  my $cb = Ctypes::Callback->new( sub { 0 }, 'i', 'ii' );
+  Ctypes::Callback::pending_fd();
+  select(undef, undef, undef, 0.2);
+}
+sub together { $_->join for map { threads->create(\&with_callback) } 1..$_[0] }
+together(1);
+my $before = fds();
+together(5);
+print fds() - $before;
+EOT
+  close $script;
+  open my $run, '-|', $^X, ( map { "-I$_" } @INC ), "$script"
+    or die "can't run $^X: $!";
+  is( scalar <$run>, 0, 'threads which made Callbacks leave no fds open' );
+}
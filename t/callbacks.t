@@ -1,8 +1,12 @@
 #!perl
 
-use Test::More tests => 4;
+use Test::More tests => 15;
 use Ctypes::Function;
 use Ctypes::Callback;
+use Scalar::Util qw|weaken|;
+
+BEGIN { unshift @INC, './t' }
+use t_POINT;
 
 sub cb_func {
   my( $ay, $bee ) = @_;
@@ -41,3 +45,74 @@ $qsort->(\$arg, $#array+1, Ctypes::sizeof('s'), $cb->ptr);
 $arrstring = join(", ", @res);
 is($arrstring, "1, 2, 3, 4, 5" , "Array of short reordered: $arrstring" );
 
+# Structs by value, both ways: call the closures straight through Function
+$cb = Ctypes::Callback->new( sub { $_[0]->{x} * 10 + $_[0]->{y} },
+                             'i', [ t_POINT->new ] );
+my $f = Ctypes::Function->new
+  ( { func => $cb->ptr, argtypes => [ t_POINT->new ], restype => 'i' } );
+is( $f->( t_POINT->new( 4, 2 ) ), 42, "Struct argument passed by value" );
+
+$cb = Ctypes::Callback->new( sub { t_POINT->new( $_[0]->{y}, $_[0]->{x} ) },
+                             t_POINT->new, [ t_POINT->new ] );
+$f = Ctypes::Function->new
+  ( { func => $cb->ptr, argtypes => [ t_POINT->new ], restype => t_POINT->new } );
+my $swapped = $f->( t_POINT->new( 5, 6 ) );
+is( "$swapped->{x} $swapped->{y}", "6 5", "Struct returned by value" );
+
+# Callback arguments are read through pointers, as with qsort above
+$cb = Ctypes::Callback->new( sub { $_[0] + 1 }, 'q', 'q' );
+$f = Ctypes::Function->new
+  ( { func => $cb->ptr, argtypes => 'p', restype => 'q' } );
+my $ll = pack( 'q', 9007199254740993 );
+is( $f->( \$ll ), 9007199254740994, "long long argument and return" );
+
+# Destroyed Callbacks give back their closure and their coderef
+my $factor = 2;
+my $code = sub { $_[0] * $factor };
+weaken( my $weak = $code );
+$cb = Ctypes::Callback->new( $code, 'i', 'i' );
+my $ptr = $cb->ptr;
+undef $code;
+ok( defined $weak, "Callback holds its coderef" );
+undef $cb;
+ok( !defined $weak, "coderef released when the Callback is destroyed" );
+my $twice = 0;
+for( 1..1000 ) {
+  $cb = Ctypes::Callback->new( sub { $_[0] * 2 }, 'i', 'i' );
+  $twice++ if $cb->ptr == $ptr;
+  undef $cb;
+}
+ok( $twice == 1000, "closures are reused" );
+
+# Arguments are reused between calls, but never under the sub's feet
+my @kept;
+$cb = Ctypes::Callback->new( sub { push @kept, \$_[0]; $_[0] }, 'i', 'i' );
+$f = Ctypes::Function->new
+  ( { func => $cb->ptr, argtypes => 'p', restype => 'i' } );
+my( $five, $six ) = ( pack('i', 5), pack('i', 6) );
+$f->( \$five );
+is( $f->( \$six ), 6, "argument set for each call" );
+is( join(",", map { $$_ } @kept), "5,6", "arguments kept by the sub are left alone" );
+
+$cb = Ctypes::Callback->new( sub { -3 }, 'c', '' );
+$f = Ctypes::Function->new
+  ( { func => $cb->ptr, argtypes => '', restype => 'c' } );
+is( $f->(), -3, "no arguments, char return" );
+
+# A callback which calls back into C, and so into itself: the inner
+# calls mustn't write over the outer one's arguments
+my @outer;
+my $reentered = 0;
+my $inner = pack( 'i*', 30, 10, 20 );
+$cb = Ctypes::Callback->new( sub {
+  my( $ay, $bee ) = @_;
+  if( !$reentered++ ) {
+    $qsort->( \$inner, 3, Ctypes::sizeof('i'), $cb->ptr );
+    push @outer, "$_[0],$_[1]";
+  }
+  return $_[0] <=> $_[1];
+}, 'i', 'ii' );
+$arg = pack( 'i*', 3, 1, 2 );
+$qsort->( \$arg, 3, Ctypes::sizeof('i'), $cb->ptr );
+is( join(" ", unpack( 'i*', $arg )), "1 2 3", "re-entrant callback sorts" );
+is( join(" ", unpack( 'i*', $inner )), "10 20 30", "and so does the call inside it" );
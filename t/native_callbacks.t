@@ -0,0 +1,55 @@
+#!perl
+
+use Test::More tests => 7;
+use Ctypes;
+use Ctypes::Function;
+use Ctypes::Callback::Native;
+
+my $qsort = Ctypes::Function->new
+  ( { lib => 'c', name => 'qsort', argtypes => 'piip', restype => 'v' } );
+my $bsearch = Ctypes::Function->new
+  ( { lib => 'c', name => 'bsearch', argtypes => 'ppiip', restype => 'p' } );
+
+# struct { char name[8]; int size; double weight; }
+my @recs = ( [ 'pear', 3, 1.5 ], [ 'apple', 9, 0.5 ], [ 'fig', 1, 2.5 ],
+             [ 'kiwi', 7, -1 ], [ 'date', 5, 0 ] );
+my $fmt = 'Z8 i x![d] d';
+my $size = length pack( $fmt, 'x', 0, 0 );
+my $buf = join '', map { pack $fmt, @$_ } @recs;
+sub field {
+  my $i = shift;
+  return join ",", map { ( unpack $fmt, substr( $buf, $_ * $size, $size ) )[$i] }
+    0..$#recs;
+}
+
+my $by_size = Ctypes::Callback::Native->compare( c_int, offset => 8 );
+$qsort->( \$buf, scalar @recs, $size, $by_size->ptr );
+is( field(1), "1,3,5,7,9", "sorted by an int field" );
+
+my $heaviest = Ctypes::Callback::Native->desc( c_double, offset => 16 );
+$qsort->( \$buf, scalar @recs, $size, $heaviest->ptr );
+is( field(2), "2.5,1.5,0.5,0,-1", "sorted by a double field, descending" );
+
+my $by_name = Ctypes::Callback::Native->compare( 'chars', length => 8 );
+$qsort->( \$buf, scalar @recs, $size, $by_name->ptr );
+is( field(0), "apple,date,fig,kiwi,pear", "sorted by an inline char array" );
+
+my @words = qw|pear apple fig kiwi date|;
+my $ptrs = pack( 'p*', @words );
+my $strings = Ctypes::Callback::Native->compare('string');
+$qsort->( \$ptrs, scalar @words, Ctypes::sizeof('p'), $strings->ptr );
+is( join( ",", unpack( 'p*', $ptrs ) ), "apple,date,fig,kiwi,pear",
+    "sorted char* by strcmp" );
+
+$qsort->( \$buf, scalar @recs, $size, $by_size->ptr );
+my $find = Ctypes::Callback::Native->compare
+  ( c_int, offset => 8, key_offset => 0 );
+my $key = pack( 'i', 7 );
+my $found = $bsearch->( \$key, \$buf, scalar @recs, $size, $find->ptr );
+ok( $found, "bsearch with a bare key" );
+$key = pack( 'i', 4 );
+ok( !$bsearch->( \$key, \$buf, scalar @recs, $size, $find->ptr ),
+    "bsearch for a missing key" );
+
+eval { Ctypes::Callback::Native->compare('v') };
+like( $@, qr/can't compare type 'v'/, "void fields are refused" );
@@ -0,0 +1,87 @@
+#!perl
+
+use Test::More;
+use Config;
+use File::Spec;
+use File::Temp qw|tempdir|;
+use Ctypes;
+use Ctypes::Function;
+
+plan skip_all => 'no C compiler to build stubs with'
+  unless $Config{cc} and system("$Config{cc} -v >/dev/null 2>&1") == 0;
+plan tests => 17;
+
+my $dir = tempdir( CLEANUP => 1 );
+# Stubs are built when a function is promoted; here, straight away
+Ctypes::Function->promote_after(0);
+is( Ctypes::Stub->enable( dir => $dir ), $dir, 'stubs enabled' );
+
+# strtoul's 'Lppi' isn't one of the built-in thunks
+my $strtoul = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtoul', argtypes => 'ppi', restype => 'L' } );
+ok( $strtoul->_thunked, 'stub built for Lppi' );
+is( $strtoul->("ff", 0, 16), 255, 'called through the stub' );
+my $path = Ctypes::Stub::_path( 'c', 'Lppi' );
+ok( -f $path, 'stub cached as ' . (File::Spec->splitpath($path))[2] );
+
+# Functions with the same signature share it
+my $again = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtoul', argtypes => 'ppi', restype => 'L' } );
+ok( $again->_thunked, 'loaded stub reused' );
+
+# A later process just loads it
+my $mtime = (stat $path)[9];
+local $ENV{PERL_CTYPES_STUBS} = $dir;
+my $out = `$^X -Mblib -MCtypes -e "Ctypes::Function->promote_after(0); print Ctypes::Function->new({lib=>'c',name=>'strtoul',argtypes=>'ppi',restype=>'L'})->_thunked"`;
+is( $out, 1, 'cached stub loaded by a new process' );
+is( (stat $path)[9], $mtime, 'and not rebuilt' );
+
+# Stubs built from anything else are never used
+my( undef, $key ) = Ctypes::Stub::_source( 'c', 'Lppi' );
+like( $path, qr/-\Q@{[ substr $key, 0, 12 ]}\E\./, 'named for its hash' );
+ok( !Ctypes::Stub::_open( $path, 'f' x 32 ), 'not loaded for another hash' );
+
+# Loading a library runs it, so only ones nobody else could have put
+# there are loaded
+SKIP: {
+  skip 'no Unix permissions', 5 if $^O eq 'MSWin32';
+  {
+    local $ENV{HOME};
+    local $ENV{XDG_CACHE_HOME};
+    eval { Ctypes::Stub->enable };
+    like( $@, qr/no cache directory/, 'no default without a home' );
+  }
+  my $made = File::Spec->catdir( $dir, 'made' );
+  Ctypes::Stub->enable( dir => $made );
+  is( (stat $made)[2] & 0777, 0700, 'cache made private' );
+  my $open = File::Spec->catdir( $dir, 'open' );
+  mkdir $open;
+  chmod 0777, $open;
+  eval { Ctypes::Stub->enable( dir => $open ) };
+  like( $@, qr/writable by nobody else/, 'shared directory refused' );
+  Ctypes::Stub->enable( dir => $dir );
+  chmod 0666, $path;
+  ok( !Ctypes::Stub::_trusted($path), 'writable library not trusted' );
+  chmod 0755, $path;
+  my $link = File::Spec->catfile( $dir, "link.$Config{dlext}" );
+  symlink( $path, $link );
+  ok( !Ctypes::Stub::_trusted($link), 'nor a symlink' );
+}
+
+# Makefile.PL loads Ctypes::Stub: that alone mustn't enable anything
+my $fresh = File::Spec->catdir( $dir, 'fresh' );
+{
+  local $ENV{PERL_CTYPES_STUBS} = $fresh;
+  system( $^X, '-e', 'require "./lib/Ctypes/Stub.pm"' );
+}
+ok( !-d $fresh, 'loading Ctypes::Stub has no side effects' );
+
+Ctypes::Stub->disable;
+my $strtoll = Ctypes::Function->new
+  ( { lib => 'c', name => 'strtoll', argtypes => 'ppi', restype => 'q' } );
+ok( !$strtoll->_thunked, 'nothing built while disabled' );
+
+# 'c' is libffi's schar, whatever plain char is here
+like( Ctypes::Stub::_thunk_source( 'cc', 'f', 'ffi_arg', 'ffi_sarg' ),
+      qr/^  signed char r = \(\(signed char \(\*\)\(signed char\)\)fn\)/m,
+      "chars are signed" );
@@ -0,0 +1,45 @@
+#!perl
+
+use strict;
+use warnings;
+use Config;
+BEGIN {
+  unless( $Config{useithreads} ) {
+    print "1..0 # SKIP needs a perl with ithreads\n";
+    exit 0;
+  }
+}
+use threads;
+use Test::More tests => 4;
+use Ctypes;
+use Ctypes::Function;
+
+# Functions made before the threads are shared with them: each thread
+# calls through its own copy of the plan
+my $abs = Ctypes::Function->new( { lib => 'c', name => 'abs' } );
+my $fixed = Ctypes::Function->new
+  ( { lib => 'c', name => 'labs', argtypes => 'l', restype => 'l' } );
+is( $abs->(-1), 1, 'called before the threads' );
+$fixed->attach('labs_attached');
+
+my @threads = map {
+  my $n = $_;
+  threads->create( sub {
+    my $bad = 0;
+    for my $i ( 1 .. 50_000 ) {
+      # Argtype-less: the signature changes from call to call
+      $bad++ if $abs->( -$i ) != $i;
+      $bad++ if $abs->( -$i, 0, 0 ) != $i;
+    }
+    for my $i ( 1 .. 2000 ) {
+      $bad++ if $fixed->( -$n ) != $n;
+      $bad++ if labs_attached( -$i ) != $i;
+    }
+    return $bad;
+  } );
+} 1 .. 8;
+my @bad = map { $_->join } @threads;
+is( scalar( grep { defined and $_ == 0 } @bad ), 8,
+    'eight threads calling the same Functions' );
+is( $abs->(-3, 0), 3, 'still callable afterwards' );
+is( labs_attached(-4), 4, 'and so is the attached sub' );
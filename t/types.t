@@ -103,4 +103,23 @@ my $ushort = c_uint(691693896);
 my $charptr = Pointer( c_char, $ushort );
 note( join(" ",@$charptr) );
 
+# Type tables come from the C descriptors
+my $types = Ctypes::Type::_types();
+is( $types->{h}{name}, 'c_short', '_types generated from C table' );
+is( $types->{h}{size}, Ctypes::sizeof('s'), '_types size matches sizeof' );
+is( Ctypes::_valid_for_type(-1.5, 'f'), 1, 'negative floats are valid' );
+is( Ctypes::_valid_for_type(70000, 'h'), -1, 'short range checked' );
+
+# 64-bit integers stay IV/UV, past the 53 bits an NV could hold
+my $big = c_longlong(9007199254740993);
+is( $$big, 9007199254740993, 'c_longlong keeps all 64 bits' );
+my $ubig = c_uint64(18446744073709551615);
+is( $$ubig, 18446744073709551615, 'c_uint64 up to ULLONG_MAX' );
+is( Ctypes::_valid_for_type(9223372036854775807, 'q'), 1,
+    'LLONG_MAX is in range' );
+is( Ctypes::_valid_for_type(9223372036854775808, 'q'), -1,
+    'LLONG_MAX + 1 is out of range' );
+my $qarr = Array( c_longlong, [ 1, -9007199254740993 ] );
+is( $$qarr[1], -9007199254740993, 'Arrays of c_longlong' );
+
 done_testing();
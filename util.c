@@ -13,7 +13,218 @@
 #ifndef _INC_UTIL_C
 #define _INC_UTIL_C
 
-// Copied verbatim from FFI.xs on 21/05/2010: http://cpansearch.perl.org/src/GAAL/FFI-1.04/FFI.xs
+#define Ct_ALIGNOF(type) offsetof(struct { char c; type x; }, x)
+#if PTRSIZE == 8
+#define Ct_PTR_PACKCODE 'Q'
+#else
+#define Ct_PTR_PACKCODE 'L'
+#endif
+
+/* Guards what threads share: the closure pool and callback cifs, and
+   the refcounts of call plans, Struct layouts and viewed buffers */
+#ifdef USE_ITHREADS
+static perl_mutex Ct_closures_mutex;
+#define Ct_CLOSURES_LOCK   MUTEX_LOCK(&Ct_closures_mutex)
+#define Ct_CLOSURES_UNLOCK MUTEX_UNLOCK(&Ct_closures_mutex)
+#else
+#define Ct_CLOSURES_LOCK   NOOP
+#define Ct_CLOSURES_UNLOCK NOOP
+#endif
+
+#ifdef HAS_LONG_LONG
+/* long longs to and from Perl: as IV/UV wherever those are wide
+   enough, so nothing goes through an NV's 53 bits */
+#if IVSIZE >= LONGLONGSIZE
+#define Ct_SvLL(sv)     ((long long)SvIV(sv))
+#define Ct_SvULL(sv)    ((unsigned long long)SvUV(sv))
+#define Ct_newSVll(v)   newSViv((IV)(v))
+#define Ct_newSVull(v)  newSVuv((UV)(v))
+#define Ct_sv_setll(sv, v)  sv_setiv(sv, (IV)(v))
+#define Ct_sv_setull(sv, v) sv_setuv(sv, (UV)(v))
+#else
+#define Ct_SvLL(sv)     ((long long)(SvIOK(sv) ? SvIV(sv) : SvNV(sv)))
+#define Ct_SvULL(sv)    ((unsigned long long)(SvIOK(sv) ? SvUV(sv) : SvNV(sv)))
+#define Ct_newSVll(v)   ((v) >= IV_MIN && (v) <= IV_MAX \
+                         ? newSViv((IV)(v)) : newSVnv((NV)(v)))
+#define Ct_newSVull(v)  ((v) <= UV_MAX ? newSVuv((UV)(v)) : newSVnv((NV)(v)))
+#define Ct_sv_setll(sv, v)  ((v) >= IV_MIN && (v) <= IV_MAX \
+                             ? sv_setiv(sv, (IV)(v)) : sv_setnv(sv, (NV)(v)))
+#define Ct_sv_setull(sv, v) ((v) <= UV_MAX ? sv_setuv(sv, (UV)(v)) \
+                             : sv_setnv(sv, (NV)(v)))
+#endif
+#endif
+
+/* Native types, indexed by sizecode */
+static const Ct_typedesc_t Ct_types[256] = {
+  ['v'] = { 'v', &ffi_type_void, 0, 1, 'x', 'v', 0, 0 },
+  ['c'] = { 'c', &ffi_type_schar, sizeof(char), Ct_ALIGNOF(char), 'c', 'i',
+            CHAR_MIN, CHAR_MAX },
+  ['C'] = { 'C', &ffi_type_uchar, sizeof(unsigned char),
+            Ct_ALIGNOF(unsigned char), 'C', 'u', 0, UCHAR_MAX },
+  ['s'] = { 's', &ffi_type_sshort, sizeof(short), Ct_ALIGNOF(short), 's', 'i',
+            PERL_SHORT_MIN, PERL_SHORT_MAX },
+  ['S'] = { 'S', &ffi_type_ushort, sizeof(unsigned short),
+            Ct_ALIGNOF(unsigned short), 'S', 'u',
+            PERL_USHORT_MIN, PERL_USHORT_MAX },
+  ['i'] = { 'i', &ffi_type_sint, sizeof(int), Ct_ALIGNOF(int), 'i', 'i',
+            PERL_INT_MIN, PERL_INT_MAX },
+  ['I'] = { 'I', &ffi_type_uint, sizeof(unsigned int),
+            Ct_ALIGNOF(unsigned int), 'I', 'u',
+            PERL_UINT_MIN, PERL_UINT_MAX },
+  ['l'] = { 'l', &ffi_type_slong, sizeof(long), Ct_ALIGNOF(long), 'l', 'i',
+            PERL_LONG_MIN, PERL_LONG_MAX },
+  ['L'] = { 'L', &ffi_type_ulong, sizeof(unsigned long),
+            Ct_ALIGNOF(unsigned long), 'L', 'u',
+            PERL_ULONG_MIN, PERL_ULONG_MAX },
+  ['f'] = { 'f', &ffi_type_float, sizeof(float), Ct_ALIGNOF(float), 'f', 'f',
+            -FLT_MAX, FLT_MAX },
+  ['d'] = { 'd', &ffi_type_double, sizeof(double), Ct_ALIGNOF(double), 'd', 'f',
+            -DBL_MAX, DBL_MAX },
+#ifdef HAS_LONG_LONG
+  ['q'] = { 'q', &ffi_type_sint64, sizeof(long long), Ct_ALIGNOF(long long),
+            'q', 'i', LLONG_MIN, LLONG_MAX },
+  ['Q'] = { 'Q', &ffi_type_uint64, sizeof(unsigned long long),
+            Ct_ALIGNOF(unsigned long long), 'Q', 'u', 0, ULLONG_MAX },
+#endif
+#ifdef HAS_LONG_DOUBLE
+  ['D'] = { 'D', &ffi_type_longdouble, sizeof(long double),
+            Ct_ALIGNOF(long double), 'D', 'f', -LDBL_MAX, LDBL_MAX },
+#endif
+  ['p'] = { 'p', &ffi_type_pointer, sizeof(void*), Ct_ALIGNOF(void*),
+            Ct_PTR_PACKCODE, 'p', 0, 0 },
+};
+
+/* Perl-visible typecodes, mirroring $_pytypes and $_perltypes as they
+   were written out in Type.pm. Terminated by a 0 typecode. */
+static const Ct_typename_t Ct_pytypes[] = {
+  { 'b', "c_byte",       'c', 'c' },
+  { 'B', "c_ubyte",      'c', 'C' },
+  { 'X', "c_bstr",       'X', 'X' },  /* a? */
+  { 'c', "c_char",       'c', 'c' },  /* signed, possibly multi-char (?) */
+  { 'C', "c_uchar",      'C', 'C' },
+  { 's', "c_char_p",     's', 's' },  /* null terminated string, A? */
+  { 'w', "c_wchar",      'w', 'w' },  /* U */
+  { 'z', "c_wchar_p",    'z', 'z' },  /* U* */
+  { 'h', "c_short",      's', 's' },
+  { 'H', "c_ushort",     'S', 'S' },
+  { 'i', "c_int",        'i', 'i' },  /* alias to c_long where equal */
+  { 'I', "c_uint",       'i', 'I' },  /* alias to c_ulong where equal */
+  { 'l', "c_long",       'l', 'l' },
+  { 'L', "c_ulong",      'l', 'L' },
+#ifdef HAS_LONG_LONG
+  { 'q', "c_longlong",   'q', 'q' },
+  { 'Q', "c_ulonglong",  'Q', 'Q' },
+#endif
+  { 'f', "c_float",      'f', 'f' },
+  { 'd', "c_double",     'd', 'd' },
+  { 'g', "c_longdouble", 'D', 'D' },
+  { 'v', "c_bool",       'c', 'c' },  /* ? */
+  { 'O', "c_void",       'v', 'a' },
+  { 0, NULL, 0, 0 }
+};
+
+static const Ct_typename_t Ct_perltypes[] = {
+  { 'v', "c_void",       'v', 'v' },
+  { 'b', "c_byte",       'b', 'b' },
+  { 'C', "c_char",       'C', 'C' },
+  { 'c', "c_byte",       'c', 'c' },  /* as b, but pack-style c */
+  { 's', "c_short",      's', 's' },
+  { 'S', "c_ushort",     's', 'S' },
+  { 'i', "c_int",        'i', 'i' },
+  { 'I', "c_uint",       'i', 'I' },
+  { 'l', "c_long",       'l', 'l' },
+  { 'L', "c_ulong",      'l', 'L' },
+#ifdef HAS_LONG_LONG
+  { 'q', "c_longlong",   'q', 'q' },
+  { 'Q', "c_ulonglong",  'Q', 'Q' },
+#endif
+  { 'f', "c_float",      'f', 'f' },
+  { 'd', "c_double",     'd', 'd' },
+  { 'D', "c_longdouble", 'D', 'D' },
+  { 'p', "c_void_p",     'p', 'p' },
+  { 0, NULL, 0, 0 }
+};
+
+/* typecode byte -> entry in the typecode table Ctypes::Type chose */
+static const Ct_typename_t* Ct_typenames[256];
+
+/* Descriptor for a sizecode, or NULL if it isn't a native type */
+#define Ct_typedesc_maybe(tc) \
+  (Ct_types[(U8)(tc)].code ? &Ct_types[(U8)(tc)] : NULL)
+
+const Ct_typedesc_t*
+Ct_typedesc(char code)
+{
+  const Ct_typedesc_t* desc = Ct_typedesc_maybe(code);
+  if( desc == NULL )
+    croak( "Unrecognised type '%c'", code );
+  return desc;
+}
+
+/* Called once Ctypes::Type knows which typecodes are in use */
+void
+Ct_select_typenames(int perltypes)
+{
+  const Ct_typename_t* t = perltypes ? Ct_perltypes : Ct_pytypes;
+  Zero(Ct_typenames, 256, const Ct_typename_t*);
+  for( ; t->typecode; t++ )
+    Ct_typenames[(U8)t->typecode] = t;
+}
+
+/* Sizecode of a Ctypes::Type typecode. Codes which aren't in the
+   typecode table (e.g. 'p' for Arrays) are taken to be sizecodes. */
+char
+Ct_sizecode_of(char typecode)
+{
+  const Ct_typename_t* t = Ct_typenames[(U8)typecode];
+  return t ? t->sizecode : typecode;
+}
+
+/* Build the hashref Ctypes::Type keeps as $_pytypes / $_perltypes */
+SV*
+Ct_typenames_hv(int perltypes)
+{
+  const Ct_typename_t* t = perltypes ? Ct_perltypes : Ct_pytypes;
+  const Ct_typedesc_t* desc;
+  HV *types = newHV(), *info;
+  for( ; t->typecode; t++ ) {
+    info = newHV();
+    hv_stores(info, "name", newSVpv(t->name, 0));
+    hv_stores(info, "sizecode", newSVpvn(&t->sizecode, 1));
+    hv_stores(info, "packcode", newSVpvn(&t->packcode, 1));
+    desc = Ct_typedesc_maybe(t->sizecode);
+    if( desc != NULL ) {
+      hv_stores(info, "size", newSVuv(desc->size));
+      hv_stores(info, "align", newSVuv(desc->align));
+    }
+    hv_store(types, &t->typecode, 1, newRV_noinc((SV*)info), 0);
+  }
+  return newRV_noinc((SV*)types);
+}
+
+/* Whether sv's numeric value is within desc's range. Types as wide
+   as Perl's integers are checked on the IV/UV itself when there is
+   one: as NVs their limits can't be told from their neighbours. */
+int
+Ct_in_range(const Ct_typedesc_t* desc, SV* sv)
+{
+  NV nv;
+  if( (desc->kind == 'i' || desc->kind == 'u') && desc->size >= IVSIZE ) {
+    if( SvIOK(sv) ) {
+      if( SvIsUV(sv) )
+        return desc->kind == 'u' || desc->size > IVSIZE
+               || SvUVX(sv) <= (UV)IV_MAX;
+      return desc->kind == 'i' || SvIVX(sv) >= 0;
+    }
+    nv = SvNV(sv);
+    /* max (2**n - 1) rounds up to 2**n, itself out of range */
+    return nv >= desc->min && nv < desc->max;
+  }
+  nv = SvNV(sv);
+  return nv >= desc->min && nv <= desc->max;
+}
+
+// Originally copied from FFI.xs on 21/05/2010: http://cpansearch.perl.org/src/GAAL/FFI-1.04/FFI.xs
 int
 validate_signature (char *sig)
 {
@@ -27,14 +238,14 @@ validate_signature (char *sig)
     if (sig[0] != 'c' && *sig != 's')
         croak("Invalid function signature: '%c' (should be 'c' or 's')", sig[0]);
 
-    if (strchr("cCsSiIlLfdDpv", sig[1]) == NULL)
-        croak("Invalid return type: '%c' (should be one of \"cCsSiIlLfdDpv\")", sig[1]);
+    if (Ct_typedesc_maybe(sig[1]) == NULL)
+        croak("Invalid return type: '%c' (should be one of \"cCsSiIlLqQfdDpv\")", sig[1]);
 
-    i = strspn(sig+2, "cCsSiIlLfdDp");
     args_in_sig = len - 2;
-    if (i != args_in_sig)
-        croak("Invalid argument type (arg %d): '%c' (should be one of \"cCsSiIlLfdDp\")",
-              i+1, sig[i+2]);
+    for (i = 0; i < args_in_sig; i++)
+        if (sig[i+2] == 'v' || Ct_typedesc_maybe(sig[i+2]) == NULL)
+            croak("Invalid argument type (arg %d): '%c' (should be one of \"cCsSiIlLqQfdDp\")",
+                  i+1, sig[i+2]);
     return args_in_sig;
 }
 
@@ -42,62 +253,54 @@ validate_signature (char *sig)
 ffi_type*
 get_ffi_type(char type)
 {
-  switch (type) {
-    case 'v': return &ffi_type_void;         break;
-    case 'c': return &ffi_type_schar;        break;
-    case 'C': return &ffi_type_uchar;        break;
-    case 's': return &ffi_type_sshort;       break;
-    case 'S': return &ffi_type_ushort;       break;
-    case 'i': return &ffi_type_sint;         break;
-    case 'I': return &ffi_type_uint;         break;
-    case 'l': return &ffi_type_slong;        break;
-    case 'L': return &ffi_type_ulong;        break;
-    case 'f': return &ffi_type_float;        break;
-    case 'd': return &ffi_type_double;       break;
-    case 'D': return &ffi_type_longdouble;   break;
-    case 'p': return &ffi_type_pointer;      break;
-    default: croak( "Unrecognised type: %c", type );
-  }
+  return Ct_typedesc(type)->ffi;
 }
 
+/* Make a new SV from a foreign function's return value. Returns
+   NULL for void. Small integer returns are widened by libffi to a
+   full ffi_arg, so read them back through that. */
 SV*
-get_types_info( char typecode, const char* datum, int datum_len )
+Ct_newSV_result(char rtypechar, void* rvalue)
 {
-  const char* tc = &typecode;
-  SV* _types_sv = NULL;
-  HV* _types_hv = NULL;
-  SV** fetched = NULL;
-  SV* typeinfo_sv = NULL;
-  HV* typeinfo_hv = NULL;
-  SV* info_sv = NULL;
-  U32 klen = 0;
-
-  _types_sv = get_sv( "Ctypes::Type::_types", 0 );
-  if( _types_sv == NULL )
-    croak( "get_types_info: Couldn't find $Ctypes::Type::_types hashref" );
-  if( !SvROK(_types_sv) || SvTYPE(SvRV(_types_sv)) != SVt_PVHV )
-    croak( "get_types_info: $_types not a hashref" );
-
-  _types_hv = (HV*)SvRV(_types_sv);
-
-  klen = 1;
-  fetched = hv_fetch( _types_hv, tc, klen, 0 );
-  if( fetched == NULL )
-    croak( "get_types_info: Couldn't find type info for typecode %c", typecode );
-  typeinfo_sv = *fetched;
-
-  if( !SvROK(_types_sv) || SvTYPE(SvRV(_types_sv)) != SVt_PVHV )
-      croak( "get_types_info: $_types->{%c} not a hashref", typecode );
-  typeinfo_hv = (HV*)SvRV(typeinfo_sv);
-
-  fetched = NULL;
-  klen = datum_len;
-  fetched = hv_fetch( typeinfo_hv, datum, klen, 0 );
-  if( !fetched )
-    croak( "get_types_info: Couldn't find key '%s' in $_types->{%c}", datum, typecode );
-  info_sv = *fetched;
-
-  return info_sv;
+  switch (rtypechar)
+  {
+    case 'v': return NULL;
+    case 'c': return newSViv((signed char)*(ffi_sarg*)rvalue);
+    case 'C': return newSVuv((unsigned char)*(ffi_arg*)rvalue);
+    case 's': return newSViv((short)*(ffi_sarg*)rvalue);
+    case 'S': return newSVuv((unsigned short)*(ffi_arg*)rvalue);
+    case 'i': return newSViv((int)*(ffi_sarg*)rvalue);
+    case 'I': return newSVuv((unsigned int)*(ffi_arg*)rvalue);
+    case 'l': return newSViv(*(long*)rvalue);
+    case 'L': return newSVuv(*(unsigned long*)rvalue);
+    case 'f': return newSVnv(*(float*)rvalue);
+    case 'd': return newSVnv(*(double*)rvalue);
+    case 'D': return newSVnv(*(long double*)rvalue);
+    #ifdef HAS_LONG_LONG
+    case 'q': return Ct_newSVll(*(long long*)rvalue);
+    case 'Q': return Ct_newSVull(*(unsigned long long*)rvalue);
+    #endif
+    case 'p': return newSVpv((void*)rvalue, 0);
+  }
+  return NULL;
+}
+
+/* Store a foreign function's return value at dest as its own C
+   type, narrowing libffi's widened small integers back down */
+void
+Ct_store_result(char rtypechar, ffi_type* rtype, void* rvalue, void* dest)
+{
+  switch (rtypechar)
+  {
+    case 'v': break;
+    case 'c': *(signed char*)dest = (signed char)*(ffi_sarg*)rvalue;       break;
+    case 'C': *(unsigned char*)dest = (unsigned char)*(ffi_arg*)rvalue;    break;
+    case 's': *(short*)dest = (short)*(ffi_sarg*)rvalue;                   break;
+    case 'S': *(unsigned short*)dest = (unsigned short)*(ffi_arg*)rvalue;  break;
+    case 'i': *(int*)dest = (int)*(ffi_sarg*)rvalue;                       break;
+    case 'I': *(unsigned int*)dest = (unsigned int)*(ffi_arg*)rvalue;      break;
+    default: Copy(rvalue, dest, rtype->size, char);
+  }
 }
 
 #endif
@@ -0,0 +1,304 @@
+/*###########################################################################
+## Name:        views.c
+## Purpose:     Objects' _data over memory they don't own: a Perl
+##              string's buffer, kept alive for as long as anything
+##              views it, or an address from C
+## Licence:     This program is free software; you can redistribute it and/or
+##              modify it under the Artistic License 2.0. For details see
+##              http://www.opensource.org/licenses/artistic-license-2.0.php
+###########################################################################*/
+
+#ifndef _INC_VIEWS_C
+#define _INC_VIEWS_C
+
+#if defined(HAS_MMAP) && !defined(WIN32)
+#define Ct_HAS_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/* A buffer taken over from a Perl string when it's first viewed. The
+   string keeps using it, but no longer owns it (its SvLEN is 0): so
+   Perl will neither free it nor realloc it, and a string which needs
+   to grow gets a new buffer, leaving views with the old one. It's
+   freed when the string and all the views are gone. Files mapped by
+   Ct_view_file are pinned in the same way, and unmapped. */
+typedef struct _Ct_pin_t {
+  char* buf;
+  STRLEN len;
+  int refcnt;
+  int mapped;
+} Ct_pin_t;
+
+static int Ct_view_mg_set(pTHX_ SV* sv, MAGIC* mg);
+static int Ct_view_mg_free(pTHX_ SV* sv, MAGIC* mg);
+#ifdef USE_ITHREADS
+static int Ct_view_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param);
+#else
+#define Ct_view_mg_dup NULL
+#endif
+
+/* On viewed strings and on views: mg_ptr is the pin, if any, and
+   mg_obj (refcounted) whatever else the memory belongs to. Views have
+   mg_private set. */
+static MGVTBL Ct_view_vtbl = {
+  NULL, Ct_view_mg_set, NULL, NULL, Ct_view_mg_free, NULL, Ct_view_mg_dup
+#ifdef MGf_LOCAL
+  , NULL
+#endif
+};
+
+void
+Ct_pin_release(Ct_pin_t* pin) {
+  int left;
+  if( pin == NULL )
+    return;
+  Ct_CLOSURES_LOCK;
+  left = --pin->refcnt;
+  Ct_CLOSURES_UNLOCK;
+  if( left > 0 )
+    return;
+  debug_warn( "#[%s:%i] Freeing viewed buffer %p (%lu bytes)",
+              __FILE__, __LINE__, pin->buf, (unsigned long)pin->len );
+#ifdef Ct_HAS_MMAP
+  if( pin->mapped )
+    munmap(pin->buf, pin->len);
+  else
+#endif
+    Safefree(pin->buf);
+  Safefree(pin);
+}
+
+static MAGIC*
+Ct_view_mg_attach(SV* sv, Ct_pin_t* pin, SV* keep) {
+  MAGIC* mg = sv_magicext(sv, keep, PERL_MAGIC_ext, &Ct_view_vtbl,
+                          (const char*)pin, 0);
+#ifdef USE_ITHREADS
+  mg->mg_flags |= MGf_DUP;
+#endif
+  if( pin != NULL ) {
+    Ct_CLOSURES_LOCK;
+    pin->refcnt++;
+    Ct_CLOSURES_UNLOCK;
+  }
+  return mg;
+}
+
+/* What the bytes of src belong to: its pin, or the SV to keep alive
+   for them in *keep. Plain strings are pinned here. */
+static Ct_pin_t*
+Ct_view_source(SV* src, SV** keep) {
+  MAGIC* mg = SvTYPE(src) >= SVt_PVMG
+    ? mg_findext(src, PERL_MAGIC_ext, &Ct_view_vtbl) : NULL;
+  Ct_pin_t* pin;
+  STRLEN len;
+
+  *keep = NULL;
+  if( mg != NULL && SvLEN(src) == 0 && SvPOK(src)
+      && ( mg->mg_private || mg->mg_ptr != NULL ) ) {
+    /* A view, or a string still on its pinned buffer */
+    *keep = mg->mg_obj;
+    return (Ct_pin_t*)mg->mg_ptr;
+  }
+  if( SvREADONLY(src) )
+    croak("Ctypes: can't view a read-only string");
+  SvPV_force(src, len);
+  if( SvOOK(src) )
+    SvOOK_off(src);
+  if( SvLEN(src) == 0 ) {
+    /* Someone else's memory: hold on to its string */
+    *keep = src;
+    return NULL;
+  }
+  Newxz(pin, 1, Ct_pin_t);
+  pin->buf = SvPVX(src);
+  pin->len = SvLEN(src);
+  SvLEN_set(src, 0);
+  if( mg != NULL ) {
+    /* Viewed before, but has had a new buffer since */
+    mg->mg_ptr = (char*)pin;
+    pin->refcnt = 1;
+  }
+  else
+    Ct_view_mg_attach(src, pin, NULL);
+  return pin;
+}
+
+/* A string of len bytes at p, which Perl won't free or move */
+SV*
+Ct_view_new(char* p, STRLEN len, Ct_pin_t* pin, SV* keep, int writable) {
+  SV* sv = newSV_type(SVt_PVMG);
+  SvPV_set(sv, p);
+  SvCUR_set(sv, len);
+  SvLEN_set(sv, 0);
+  SvPOK_only(sv);
+  Ct_view_mg_attach(sv, pin, keep)->mg_private = 1;
+  if( !writable )
+    SvREADONLY_on(sv);
+  return sv;
+}
+
+/* Make self's _data a view of length bytes at offset in the string
+   src refers to */
+void
+Ct_view_of_sv(SV* self, SV* src, UV offset, UV length, int writable) {
+  Ct_pin_t* pin;
+  SV* keep;
+  if( !SvROK(self) || SvTYPE(SvRV(self)) != SVt_PVHV )
+    croak("Ctypes: can only give objects views");
+  if( !SvROK(src) || SvROK(SvRV(src)) || SvTYPE(SvRV(src)) >= SVt_PVAV )
+    croak("Ctypes: views need a reference to a string");
+  src = SvRV(src);
+  pin = Ct_view_source(src, &keep);
+  if( offset + length > SvCUR(src) )
+    croak( "Ctypes: can't view %"UVuf" bytes at offset %"UVuf" of a "
+           "%"UVuf"-byte string", length, offset, (UV)SvCUR(src) );
+  writable = writable && !SvREADONLY(src);
+  (void)hv_stores( (HV*)SvRV(self), "_data",
+                   Ct_view_new(SvPVX(src) + offset, length, pin, keep,
+                               writable) );
+}
+
+/* Point self's _data, a view made from span, at its bytes from offset
+   instead. Nothing is made or freed, so a cursor can step along an
+   Array's records this way for nothing but the pointer. */
+void
+Ct_view_move(SV* self, SV* span, UV offset) {
+  SV** svp;
+  SV* sv;
+  MAGIC *mg, *smg;
+  int same;
+
+  if( !SvROK(self) || SvTYPE(SvRV(self)) != SVt_PVHV
+      || (svp = hv_fetchs((HV*)SvRV(self), "_data", 0)) == NULL )
+    croak("Ctypes: can only move objects' views");
+  sv = *svp;
+  mg = SvTYPE(sv) >= SVt_PVMG
+    ? mg_findext(sv, PERL_MAGIC_ext, &Ct_view_vtbl) : NULL;
+  if( mg == NULL || !mg->mg_private || SvLEN(sv) != 0 || !SvPOK(sv) )
+    croak("Ctypes: only views can be moved");
+  smg = SvTYPE(span) >= SVt_PVMG
+    ? mg_findext(span, PERL_MAGIC_ext, &Ct_view_vtbl) : NULL;
+  if( smg != NULL )
+    same = SvLEN(span) == 0 && SvPOK(span)
+           && ( smg->mg_private || smg->mg_ptr != NULL )
+           && smg->mg_ptr == mg->mg_ptr && smg->mg_obj == mg->mg_obj;
+  else
+    same = mg->mg_ptr == NULL && mg->mg_obj == span;
+  if( !same )
+    croak("Ctypes: a view can only move within the memory it was made "
+          "from");
+  if( offset + SvCUR(sv) > SvCUR(span) )
+    croak( "Ctypes: can't move a %"UVuf"-byte view to offset %"UVuf
+           " of %"UVuf" bytes", (UV)SvCUR(sv), offset, (UV)SvCUR(span) );
+  SvPV_set(sv, SvPVX(span) + offset);
+}
+
+/* A string or view given a new buffer, or none, lets go of the old
+   one: it only lives on while others view it */
+static int
+Ct_view_mg_set(pTHX_ SV* sv, MAGIC* mg) {
+  if( mg->mg_ptr == NULL || ( SvLEN(sv) == 0 && SvPOK(sv) ) )
+    return 0;
+  if( SvLEN(sv) == 0 ) {
+    SvPV_set(sv, NULL);
+    SvCUR_set(sv, 0);
+  }
+  Ct_pin_release((Ct_pin_t*)mg->mg_ptr);
+  mg->mg_ptr = NULL;
+  return 0;
+}
+
+#ifdef Ct_HAS_MMAP
+/* A view of the whole of the file at path, mapped shared: writable,
+   writes go to the file */
+SV*
+Ct_view_file(const char* path, int writable) {
+  struct stat st;
+  Ct_pin_t* pin;
+  void* p;
+  int fd, err;
+
+  if( (fd = open(path, writable ? O_RDWR : O_RDONLY)) < 0 )
+    croak("Ctypes: can't open %s: %s", path, Strerror(errno));
+  if( fstat(fd, &st) != 0 ) {
+    err = errno;
+    close(fd);
+    croak("Ctypes: can't stat %s: %s", path, Strerror(err));
+  }
+  if( st.st_size == 0 ) {
+    close(fd);
+    croak("Ctypes: can't map %s: it's empty", path);
+  }
+  p = mmap(NULL, (size_t)st.st_size,
+           PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+  err = errno;
+  close(fd);
+  if( p == MAP_FAILED )
+    croak("Ctypes: can't map %s: %s", path, Strerror(err));
+  debug_warn( "#[%s:%i] Mapped %s at %p (%lu bytes)",
+              __FILE__, __LINE__, path, p, (unsigned long)st.st_size );
+  Newxz(pin, 1, Ct_pin_t);
+  pin->buf = (char*)p;
+  pin->len = (STRLEN)st.st_size;
+  pin->mapped = 1;
+  return Ct_view_new(pin->buf, pin->len, pin, NULL, writable);
+}
+#endif
+
+/* madvise the pages under the string sv; false if there's no such
+   advice here, or the kernel won't take it */
+int
+Ct_view_advise(SV* sv, const char* how) {
+#if defined(Ct_HAS_MMAP) && defined(HAS_MADVISE)
+  UV page = (UV)sysconf(_SC_PAGESIZE), start;
+  int advice;
+
+  if( strEQ(how, "normal") )
+    advice = MADV_NORMAL;
+  else if( strEQ(how, "sequential") )
+    advice = MADV_SEQUENTIAL;
+  else if( strEQ(how, "random") )
+    advice = MADV_RANDOM;
+  else if( strEQ(how, "willneed") )
+    advice = MADV_WILLNEED;
+  else
+    croak("Ctypes: unknown access pattern '%s'", how);
+  if( !SvPOK(sv) || SvCUR(sv) == 0 )
+    return 1;
+  start = PTR2UV(SvPVX(sv)) & ~(page - 1);
+  return madvise( INT2PTR(void*, start),
+                  PTR2UV(SvPVX(sv)) + SvCUR(sv) - start, advice ) == 0;
+#else
+  PERL_UNUSED_ARG(sv);
+  PERL_UNUSED_ARG(how);
+  return 0;
+#endif
+}
+
+static int
+Ct_view_mg_free(pTHX_ SV* sv, MAGIC* mg) {
+  PERL_UNUSED_ARG(sv);
+  Ct_pin_release((Ct_pin_t*)mg->mg_ptr);
+  mg->mg_ptr = NULL;
+  return 0;
+}
+
+#ifdef USE_ITHREADS
+/* The new thread's copies of views point at the same memory */
+static int
+Ct_view_mg_dup(pTHX_ MAGIC* mg, CLONE_PARAMS* param) {
+  Ct_pin_t* pin = (Ct_pin_t*)mg->mg_ptr;
+  PERL_UNUSED_ARG(param);
+  if( pin != NULL ) {
+    Ct_CLOSURES_LOCK;
+    pin->refcnt++;
+    Ct_CLOSURES_UNLOCK;
+  }
+  return 0;
+}
+#endif
+
+#endif  /* _INC_VIEWS_C */